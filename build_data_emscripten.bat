@@ -8,3 +8,4 @@ if not exist "%outDir%" mkdir "%outDir%"
 
 robocopy "%inDir%" %outDir% *-ubyte %roboCopyOpt% /S
 robocopy "%inDir%" %outDir% *.bin %roboCopyOpt% /S
+robocopy "%inDir%" %outDir% *.gz %roboCopyOpt% /S
@@ -0,0 +1,106 @@
+#include "BatchPipeline.h"
+#include "NeuralNetwork.h"
+
+BatchPipeline::BatchPipeline(const LabeledImageSet& images, const NeuralNetwork& nn, int batchSize, uint64_t seed, int nbBufferedBatches)
+	: m_images(images)
+	, m_batchSize(batchSize)
+	, m_inputStride(nn.layers[0].weightsStride)
+	, m_outputsStride(nn.getLastLayer().outputsStride)
+	, m_sampler(images.size(), seed)
+{
+	assert(!images.empty() && batchSize > 0);
+
+	// All allocations are done here: preparing a batch only overwrites a slot
+	m_slots.resize(std::max(1, nbBufferedBatches));
+	for(TrainingBatch& batch : m_slots)
+	{
+		batch.nbImages = batchSize;
+		batch.inputValues.assign((size_t)batchSize * m_inputStride, 0.f);
+		batch.expectedOutputValues.assign((size_t)batchSize * m_outputsStride, 0.f);
+		batch.imageIndices.resize(batchSize);
+	}
+
+#ifndef __EMSCRIPTEN__
+	m_producerThread = std::thread(&BatchPipeline::producerThreadFunc, this);
+#endif
+}
+
+BatchPipeline::~BatchPipeline()
+{
+#ifndef __EMSCRIPTEN__
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bExit = true;
+	}
+	m_slotFreedCondition.notify_one();
+	m_producerThread.join();
+#endif
+}
+
+void BatchPipeline::prepareBatch(TrainingBatch& batch)
+{
+	m_sampler.nextBatch(batch.imageIndices.data(), m_batchSize);
+	m_images.gatherFloat(batch.imageIndices.data(), m_batchSize, batch.inputValues.data(), m_inputStride);
+
+	std::fill(batch.expectedOutputValues.begin(), batch.expectedOutputValues.end(), 0.f);
+	for(int i=0 ; i < m_batchSize ; i++)
+		batch.expectedOutputValues[(size_t)i * m_outputsStride + m_images.labels[batch.imageIndices[i]]] = 1.f;
+}
+
+void BatchPipeline::producerThreadFunc()
+{
+	const uint32_t nbSlots = (uint32_t)m_slots.size();
+	for(uint32_t idxBatch=0 ; ; idxBatch++)
+	{
+		// Wait for a free slot. The waiting flag and the counter are both seq_cst, so either we see the slot freed
+		// by releaseBatch(), or releaseBatch() sees the flag and wakes us up.
+		if(idxBatch - m_nbConsumedBatches.load() == nbSlots)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_bProducerWaiting = true;
+			m_slotFreedCondition.wait(lock, [&]{ return m_bExit || idxBatch - m_nbConsumedBatches.load() < nbSlots; });
+			m_bProducerWaiting = false;
+		}
+		if(m_bExit)
+			return;
+
+		prepareBatch(m_slots[idxBatch % nbSlots]);
+
+		m_nbProducedBatches.store(idxBatch + 1);
+		if(m_bConsumerWaiting)
+		{
+			{ std::lock_guard<std::mutex> lock(m_mutex); }
+			m_batchReadyCondition.notify_one();
+		}
+	}
+}
+
+const TrainingBatch& BatchPipeline::acquireBatch()
+{
+#ifdef __EMSCRIPTEN__
+	prepareBatch(m_slots[0]);
+	return m_slots[0];
+#else
+	const uint32_t idxBatch = m_nbConsumedBatches.load(std::memory_order_relaxed);
+	if(m_nbProducedBatches.load() == idxBatch)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_bConsumerWaiting = true;
+		m_batchReadyCondition.wait(lock, [&]{ return m_nbProducedBatches.load() != idxBatch; });
+		m_bConsumerWaiting = false;
+	}
+	return m_slots[idxBatch % m_slots.size()];
+#endif
+}
+
+void BatchPipeline::releaseBatch()
+{
+#ifndef __EMSCRIPTEN__
+	m_nbConsumedBatches.fetch_add(1);
+	if(m_bProducerWaiting)
+	{
+		{ std::lock_guard<std::mutex> lock(m_mutex); }
+		m_slotFreedCondition.notify_one();
+	}
+#endif
+}
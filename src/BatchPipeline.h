@@ -0,0 +1,68 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "Random.h"
+
+struct NeuralNetwork;
+
+// Minibatch ready to be trained on: inputs already gathered and normalized, expected outputs already one-hot encoded
+struct TrainingBatch
+{
+	int						nbImages = 0;
+	AlignedVector<float>	inputValues;			// [nbImages x layers[0].weightsStride], zero padded
+	AlignedVector<float>	expectedOutputValues;	// [nbImages x outputsStride of the last layer]
+	std::vector<int>		imageIndices;			// sampled images, in the source LabeledImageSet
+};
+
+// Producer/consumer pipeline of training batches: a background thread samples the images of the next batches, gathers
+// and normalizes them into contiguous aligned buffers, while the current batch trains. Sampling and the scattered
+// pixel reads are thus off the critical path of NeuralNetwork::trainStep().
+//
+// Prepared batches are handed over through a bounded single-producer/single-consumer ring: slots are published with
+// two atomic counters, without locks. A side only sleeps on a condition variable when the ring is full (producer)
+// or empty (consumer), and the other side only takes the mutex to wake it up.
+// Without thread support (Emscripten build), acquireBatch() prepares the batch on the calling thread.
+class BatchPipeline
+{
+public:
+	static const int	kDefaultNbBufferedBatches = 3;
+
+	// images and nn must outlive the pipeline. Batches are drawn by an EpochSampler: the sequence of batches only depends on seed.
+	BatchPipeline(const LabeledImageSet& images, const NeuralNetwork& nn, int batchSize, uint64_t seed, int nbBufferedBatches = kDefaultNbBufferedBatches);
+	~BatchPipeline();
+
+	BatchPipeline(const BatchPipeline&) = delete;
+	BatchPipeline& operator=(const BatchPipeline&) = delete;
+
+	// Waits for the next batch. It stays valid and untouched until releaseBatch(), which hands its slot back to the producer.
+	const TrainingBatch&	acquireBatch();
+	void					releaseBatch();
+
+private:
+	void	producerThreadFunc();
+	void	prepareBatch(TrainingBatch& batch);
+
+	const LabeledImageSet&		m_images;
+	int							m_batchSize = 0;
+	int							m_inputStride = 0;
+	int							m_outputsStride = 0;
+	EpochSampler				m_sampler;	// only used by the producer
+
+	// Ring: slot i % size is owned by the producer while i >= m_nbConsumedBatches, by the consumer while i < m_nbProducedBatches
+	std::vector<TrainingBatch>	m_slots;
+	std::atomic<uint32_t>		m_nbProducedBatches{0};
+	std::atomic<uint32_t>		m_nbConsumedBatches{0};
+
+	// Sleeping when the ring is full or empty
+	std::mutex					m_mutex;
+	std::condition_variable		m_slotFreedCondition;
+	std::condition_variable		m_batchReadyCondition;
+	std::atomic<bool>			m_bProducerWaiting{false};
+	std::atomic<bool>			m_bConsumerWaiting{false};
+	std::atomic<bool>			m_bExit{false};
+
+	std::thread					m_producerThread;
+};
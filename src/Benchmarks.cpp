@@ -0,0 +1,852 @@
+#include "Benchmarks.h"
+#include "NeuralNetwork.h"
+#include "ThreadPool.h"
+#include "BatchPipeline.h"
+#include "StaticNetwork.h"
+#include "Kernels.h"
+#include "Checkpointer.h"
+#include "QuantizedNetwork.h"
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <cstdlib>
+
+// Set COUNT_HEAP_ALLOCATIONS to 1 to replace the global operator new/delete by counting versions, for checkTrainStepAllocations()
+#ifndef COUNT_HEAP_ALLOCATIONS
+	#define COUNT_HEAP_ALLOCATIONS 0
+#endif
+
+#if COUNT_HEAP_ALLOCATIONS
+static std::atomic<int64_t> s_nbHeapAllocations{0};
+
+static void* _countedAlloc(size_t size, size_t alignment)
+{
+	s_nbHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	size = std::max<size_t>(size, 1);
+#ifdef _MSC_VER
+	void* p = _aligned_malloc(size, alignment);
+#else
+	void* p = std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+#endif
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+static void _countedFree(void* p)
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+void* operator new(size_t size)										{ return _countedAlloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size)									{ return _countedAlloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, std::align_val_t alignment)			{ return _countedAlloc(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment)		{ return _countedAlloc(size, (size_t)alignment); }
+void operator delete(void* p) noexcept								{ _countedFree(p); }
+void operator delete[](void* p) noexcept							{ _countedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept			{ _countedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept			{ _countedFree(p); }
+#endif
+
+static double _getTimeMs()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Calls func() nbIterations times, returns average duration in ms
+template<typename Func>
+static double _measureMs(int nbIterations, Func func)
+{
+	func();	// warm-up
+	const double startTime = _getTimeMs();
+	for(int i=0 ; i < nbIterations ; i++)
+		func();
+	return (_getTimeMs() - startTime) / (double)nbIterations;
+}
+
+// Pretrained 784-16-16-10 network of the data directory. Fails if the file is missing or holds another topology.
+static const char* const kPretrainedFileName = DATA_DIR "/weightsAndBiases_30000.bin";
+static bool _loadPretrainedNetwork(NeuralNetwork& nn)
+{
+	return nn.initFromFile(kPretrainedFileName) && nn.checkImageTopology(kPretrainedFileName);
+}
+
+// Delta pass as it was before transposed weights: next layer weights are walked column-wise, with a stride of a full row
+static void _computeBatchBackpropagationDeltaStrided(const Layer& layer, const Layer& nextLayer, const LayerWorkspace& nextLayerWs, int nbImages, LayerWorkspace& ws)
+{
+	for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+	{
+		const float* imgNextLayerDelta = &nextLayerWs.batchBackpropDelta[idxImage * nextLayer.outputsStride];
+		for(int idxNeuron=0 ; idxNeuron < layer.nbOutputs ; idxNeuron++)
+		{
+			float delta = 0.f;
+			for(int idxNextLayerOutput=0 ; idxNextLayerOutput < nextLayer.nbOutputs ; idxNextLayerOutput++)
+				delta += imgNextLayerDelta[idxNextLayerOutput] * nextLayer.getWeight(idxNextLayerOutput, idxNeuron);
+
+			const int index = idxImage * layer.outputsStride + idxNeuron;
+			const float activation = ws.batchNeuronValues[index];
+			ws.batchBackpropDelta[index] = delta * activation * (1.f - activation);	// sigmoid'(z)
+		}
+	}
+}
+
+void benchmarkTransposedWeights()
+{
+	printf("=== Benchmark: back propagation delta pass, strided VS transposed weights ===\n");
+
+	const int nbImages = 64;
+	const int nbIterations = 20;
+	const int layerSizes[][2] = {{784, 256}, {1024, 1024}};	// next layer: nbInputs x nbOutputs
+	for(const auto& layerSize : layerSizes)
+	{
+		NeuralNetwork nn;
+		nn.initRandom({16, layerSize[0], layerSize[1]}, 1);
+		Layer& layer = nn.layers[0];
+		Layer& nextLayer = nn.layers[1];
+		LayerWorkspace& ws = nn.workspace.layers[0];
+		LayerWorkspace& nextLayerWs = nn.workspace.layers[1];
+
+		// Fill the temporary values read by the delta pass
+		AlignedVector<float> inputs(nbImages * layer.weightsStride, 0.f);
+		for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+			for(int i=0 ; i < layer.nbInputs ; i++)
+				inputs[idxImage * layer.weightsStride + i] = randNormal();
+		layer.feedForwardBatch(inputs.data(), nbImages, layer.nbInputs, ws);
+		ws.batchBackpropDelta.assign(nbImages * layer.outputsStride, 0.f);
+		nextLayerWs.batchBackpropDelta.assign(nbImages * nextLayer.outputsStride, 0.f);
+		for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+			for(int i=0 ; i < nextLayer.nbOutputs ; i++)
+				nextLayerWs.batchBackpropDelta[idxImage * nextLayer.outputsStride + i] = randNormal();
+
+		const double stridedMs = _measureMs(nbIterations, [&]{ _computeBatchBackpropagationDeltaStrided(layer, nextLayer, nextLayerWs, nbImages, ws); });
+		const AlignedVector<float> stridedDelta = ws.batchBackpropDelta;
+
+		const double transposeMs = _measureMs(nbIterations, [&]{ nextLayer.bTransposedWeightsDirty = true; nextLayer.updateTransposedWeights(); });
+		const double transposedMs = _measureMs(nbIterations, [&]{ layer.computeBatchBackpropagationDelta(nextLayer, nextLayerWs, nbImages, ws); });
+
+		float maxDiff = 0.f;
+		for(size_t i=0 ; i < stridedDelta.size() ; i++)
+			maxDiff = std::max(maxDiff, fabsf(stridedDelta[i] - ws.batchBackpropDelta[i]));
+
+		printf("%4dx%-4d (%d images): strided: %.3f ms  transposed: %.3f ms (+ %.3f ms refresh per weights update)  speedup: x%.2f  max diff: %g\n",
+			layerSize[0], layerSize[1], nbImages, stridedMs, transposedMs, transposeMs, stridedMs / transposedMs, maxDiff);
+	}
+}
+
+void benchmarkHogwild(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool)
+{
+	printf("=== Benchmark: synchronous data-parallel SGD VS asynchronous Hogwild SGD ===\n");
+
+	const int batchSize = 100;
+	const float learningRate = 3.f;
+	const int nbThreads = threadPool.getNbThreads();
+	const int nbBatchesPerThread = 500;
+	const int nbBatches = nbBatchesPerThread * nbThreads;	// same number of images for both modes
+
+	NeuralNetwork initialNN;
+	initialNN.initRandom();
+
+	// Synchronous: every batch is split across all threads, threads wait for each other before the weights update
+	{
+		NeuralNetwork nn = initialNN;
+		const double startTime = _getTimeMs();
+		std::vector<int> batch(batchSize);
+		for(int idxBatch=0 ; idxBatch < nbBatches ; idxBatch++)
+		{
+			for(int& idxImage : batch)
+				idxImage = randInt(0, trainingImages.size()-1);
+			nn.trainStep(trainingImages, batch, learningRate, &threadPool);
+		}
+		const double durationMs = _getTimeMs() - startTime;
+
+		const double imagesPerSec = (double)nbBatches * batchSize * 1000. / durationMs;
+		printf("Sync    (%d threads): %.0f ms  %.0f images/s (%.0f per thread)  test accuracy: %.2f%%\n",
+			nbThreads, durationMs, imagesPerSec, imagesPerSec / nbThreads, 100. * nn.computeNbGoodAnswers(testImages) / (double)testImages.size());
+	}
+
+	// Hogwild: each thread runs its own batches and updates the shared weights without waiting
+	{
+		NeuralNetwork nn = initialNN;
+		HogwildStats stats;
+		const double startTime = _getTimeMs();
+		nn.trainHogwild(trainingImages, nbBatchesPerThread, batchSize, learningRate, threadPool, &stats);
+		const double durationMs = _getTimeMs() - startTime;
+
+		const double imagesPerSec = (double)nbBatches * batchSize * 1000. / durationMs;
+		printf("Hogwild (%d threads): %.0f ms  %.0f images/s  test accuracy: %.2f%%\n",
+			nbThreads, durationMs, imagesPerSec, 100. * nn.computeNbGoodAnswers(testImages) / (double)testImages.size());
+		for(int idxThread=0 ; idxThread < nbThreads ; idxThread++)
+			printf("  thread %d: %.0f images/s\n", idxThread, stats.nbImagesPerThread[idxThread] * 1000. / stats.durationMsPerThread[idxThread]);
+	}
+}
+
+void benchmarkBatchPipeline(const LabeledImageSet& trainingImages, ThreadPool& threadPool)
+{
+	printf("=== Benchmark: batches sampled and gathered in the training step VS prepared by a BatchPipeline ===\n");
+
+	const int batchSize = 100;
+	const int nbBatches = 2000;
+	const float learningRate = 3.f;
+
+	NeuralNetwork initialNN;
+	initialNN.initRandom();
+
+	// Inline: sampling and gathering are on the critical path of each step
+	{
+		NeuralNetwork nn = initialNN;
+		std::vector<int> batch(batchSize);
+		const double batchMs = _measureMs(nbBatches, [&]
+		{
+			for(int& idxImage : batch)
+				idxImage = randInt(0, trainingImages.size()-1);
+			nn.trainStep(trainingImages, batch, learningRate, &threadPool);
+		});
+		printf("Inline:   %.3f ms/batch\n", batchMs);
+	}
+
+	// Pipeline: the next batches are prepared by a background thread
+	{
+		NeuralNetwork nn = initialNN;
+		BatchPipeline batchPipeline(trainingImages, nn, batchSize, 1234);
+		const double batchMs = _measureMs(nbBatches, [&]
+		{
+			nn.trainStep(batchPipeline.acquireBatch(), learningRate, &threadPool);
+			batchPipeline.releaseBatch();
+		});
+		printf("Pipeline: %.3f ms/batch\n", batchMs);
+	}
+}
+
+void benchmarkRandomInit(ThreadPool& threadPool)
+{
+	printf("=== Benchmark: random initialization of a 784 x 2048 layer (1.6M parameters) ===\n");
+
+	const int nbInputs = IMG_SX*IMG_SY;
+	const int nbOutputs = 2048;
+	const int nbIterations = 5;
+
+	// Previous implementation: std::normal_distribution on a shared std::default_random_engine, one call per weight
+	{
+		std::default_random_engine randGenerator;
+		std::normal_distribution<double> randNormalDistribution(0., 1.);
+		std::vector<float> values((size_t)nbInputs * nbOutputs + nbOutputs);
+		const double ms = _measureMs(nbIterations, [&]
+		{
+			for(float& value : values)
+				value = (float)randNormalDistribution(randGenerator);
+		});
+		printf("std::normal_distribution:   %.2f ms\n", ms);
+	}
+
+	NeuralNetwork singleThreadNN;
+	singleThreadNN.init({nbInputs, nbOutputs});
+	const double singleThreadMs = _measureMs(nbIterations, [&]{ singleThreadNN.layers[0].initRandom(1234); });
+	printf("Counter-based, 1 thread:    %.2f ms\n", singleThreadMs);
+
+	NeuralNetwork multiThreadNN;
+	multiThreadNN.init({nbInputs, nbOutputs});
+	const double multiThreadMs = _measureMs(nbIterations, [&]{ multiThreadNN.layers[0].initRandom(1234, &threadPool); });
+	const bool bIdentical = singleThreadNN.parameters == multiThreadNN.parameters;
+	printf("Counter-based, %d threads:   %.2f ms  (%s to 1 thread)\n", threadPool.getNbThreads(), multiThreadMs, bIdentical ? "identical" : "DIFFERENT");
+}
+
+void benchmarkNetworkSizes(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool)
+{
+	printf("=== Benchmark: training and inference of wider and deeper networks ===\n");
+
+	const int batchSize = 100;
+	const int nbBatches = 1000;
+	const float learningRate = 3.f;
+	const std::vector<int> layerSizesList[] =
+	{
+		{IMG_SX*IMG_SY, 16, 16, 10},
+		{IMG_SX*IMG_SY, 64, 64, 10},
+		{IMG_SX*IMG_SY, 256, 256, 10},
+		{IMG_SX*IMG_SY, 1024, 10},
+		{IMG_SX*IMG_SY, 32, 32, 32, 32, 32, 10},
+		{IMG_SX*IMG_SY, 128, 128, 128, 128, 10},
+	};
+	for(const std::vector<int>& layerSizes : layerSizesList)
+	{
+		NeuralNetwork nn;
+		nn.initRandom(layerSizes, 1234, &threadPool);
+
+		char strLayerSizes[128] = {};
+		for(size_t i=0 ; i < layerSizes.size() ; i++)
+			snprintf(strLayerSizes + strlen(strLayerSizes), sizeof(strLayerSizes) - strlen(strLayerSizes), i == 0 ? "%d" : "-%d", layerSizes[i]);
+
+		BatchPipeline batchPipeline(trainingImages, nn, batchSize, 1234);
+		const double batchMs = _measureMs(nbBatches, [&]
+		{
+			nn.trainStep(batchPipeline.acquireBatch(), learningRate, &threadPool);
+			batchPipeline.releaseBatch();
+		});
+
+		const double evalMs = _measureMs(1, [&]{ nn.computeNbGoodAnswers(testImages); });
+
+		printf("%-28s %8zu parameters: train %.3f ms/batch (%.0f images/s)  eval %.2f us/image\n",
+			strLayerSizes, nn.parameters.size(), batchMs, batchSize * 1000. / batchMs, evalMs * 1000. / testImages.size());
+	}
+}
+
+void benchmarkStaticNetwork(const LabeledImageSet& testImages)
+{
+	printf("=== Benchmark: dynamic NeuralNetwork VS compile-time StaticNetwork<784,16,16,10> ===\n");
+
+	NeuralNetwork nn;
+	std::unique_ptr<DeployedStaticNetwork> pStaticNN = std::make_unique<DeployedStaticNetwork>();
+	if(!_loadPretrainedNetwork(nn) || !pStaticNN->initFromFile(kPretrainedFileName))
+		return;
+
+	const int nbImages = testImages.size();
+	const int nbIterations = 5;
+	const int inputStride = nn.layers[0].weightsStride;
+	AlignedVector<float> inputValues((size_t)nbImages * inputStride, 0.f);
+	testImages.gatherFloat(0, nbImages, inputValues.data(), inputStride);
+
+	// Single image latency, over the whole test set
+	InferenceWorkspace ws;
+	ws.init(nn);
+	std::vector<int> answers(nbImages);
+	const double dynamicMs = _measureMs(nbIterations, [&]
+	{
+		for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+			answers[idxImage] = nn.predict(&inputValues[(size_t)idxImage * inputStride], ws);
+	});
+
+	std::unique_ptr<DeployedStaticNetwork::Workspace> pStaticWs = std::make_unique<DeployedStaticNetwork::Workspace>();	// too large for the stack
+	DeployedStaticNetwork::Workspace& staticWs = *pStaticWs;
+	int nbSameAnswers = 0;
+	float maxDiff = 0.f;
+	const double staticMs = _measureMs(nbIterations, [&]
+	{
+		nbSameAnswers = 0;
+		for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+			nbSameAnswers += pStaticNN->predict(&inputValues[(size_t)idxImage * inputStride], staticWs) == answers[idxImage] ? 1 : 0;
+	});
+	for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+	{
+		nn.predict(&inputValues[(size_t)idxImage * inputStride], ws);
+		pStaticNN->predict(&inputValues[(size_t)idxImage * inputStride], staticWs);
+		for(int i=0 ; i < DeployedStaticNetwork::kNbOutputs ; i++)
+			maxDiff = std::max(maxDiff, fabsf(ws.neuronValues.back()[i] - staticWs.getOutputValues()[i]));
+	}
+
+	printf("predict(): dynamic: %.3f us/image  static: %.3f us/image  speedup: x%.2f  same answers: %d/%d  max output diff: %g\n",
+		dynamicMs * 1000. / nbImages, staticMs * 1000. / nbImages, dynamicMs / staticMs, nbSameAnswers, nbImages, maxDiff);
+
+	// Single-threaded training steps: batched GEMMs of the dynamic network VS one image at a time, fully unrolled
+	const int batchSize = 100;
+	const int nbBatches = 200;
+	std::vector<int> batch(batchSize);
+	int idxBatch = 0;
+	auto nextBatch = [&]
+	{
+		for(int i=0 ; i < batchSize ; i++)
+			batch[i] = (idxBatch * batchSize + i) % nbImages;
+		idxBatch++;
+	};
+
+	const double dynamicTrainMs = _measureMs(nbBatches, [&]{ nextBatch(); nn.trainStep(testImages, batch, 3.f); });
+	idxBatch = 0;
+	const double staticTrainMs = _measureMs(nbBatches, [&]{ nextBatch(); pStaticNN->trainStep(testImages, batch.data(), batchSize, 3.f, staticWs); });
+	printf("trainStep() (%d images): dynamic: %.3f ms  static: %.3f ms  speedup: x%.2f\n", batchSize, dynamicTrainMs, staticTrainMs, dynamicTrainMs / staticTrainMs);
+}
+
+void benchmarkSigmoidModes(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages)
+{
+	printf("=== Benchmark: sigmoid evaluation modes ===\n");
+
+	// Inputs: floats of [-100;100] sampled by their bit patterns, so that all magnitudes are covered
+	const uint32_t kMaxBits = 0x42C80000;	// 100.f
+	const uint32_t kBitsStep = 61;
+	std::vector<float> inputs;
+	for(uint32_t bits = 0 ; bits <= kMaxBits ; bits += kBitsStep)
+	{
+		float x;
+		memcpy(&x, &bits, 4);
+		inputs.push_back(x);
+		inputs.push_back(-x);
+	}
+	std::vector<float> outputs(inputs.size());
+	std::vector<float> refOutputs(inputs.size());
+
+	// Timings on z values of a typical magnitude (tiny inputs would be denormals)
+	const int kNbValues = 4096;
+	const int nbIterations = 2000;
+	std::vector<float> zValues(kNbValues);
+	for(int i=0 ; i < kNbValues ; i++)
+		zValues[i] = -10.f + 20.f * (float)i / (float)kNbValues;
+
+	const SigmoidMode prevMode = gKernels.sigmoidMode;
+	const KernelsISA bestISA = gKernels.isa;
+	const SigmoidMode modes[] = {SigmoidMode::Exact, SigmoidMode::Polynomial, SigmoidMode::Rational};
+	for(SigmoidMode mode : modes)
+	{
+		setSigmoidMode(mode);
+
+		double maxError = 0.;
+		gKernels.sigmoid(outputs.data(), inputs.data(), (int)inputs.size());
+		for(size_t i=0 ; i < inputs.size() ; i++)
+			maxError = std::max(maxError, fabs((double)outputs[i] - 1. / (1. + exp(-(double)inputs[i]))));
+
+		// All ISAs must give the same values
+		bool bIdenticalISAs = true;
+		for(int isa = (int)KernelsISA::Scalar ; isa <= (int)bestISA ; isa++)
+		{
+			initKernels(gKernels.mode, (KernelsISA)isa);
+			gKernels.sigmoid(refOutputs.data(), inputs.data(), (int)inputs.size());
+			bIdenticalISAs = bIdenticalISAs && memcmp(refOutputs.data(), outputs.data(), outputs.size() * sizeof(float)) == 0;
+		}
+		initKernels(gKernels.mode, bestISA);
+
+		const double ms = _measureMs(nbIterations, [&]{ gKernels.sigmoid(outputs.data(), zValues.data(), kNbValues); });
+
+		printf("%-10s max error: %.2e  %s on all ISAs  %.3f ns/value\n", getSigmoidModeName(mode), maxError,
+			bIdenticalISAs ? "identical" : "DIFFERENT", ms * 1e6 / kNbValues);
+	}
+
+	// End to end: accuracy of the trained network, and training from the same initialization
+	NeuralNetwork trainedNN;
+	if(!_loadPretrainedNetwork(trainedNN))
+		return;
+	const int batchSize = 100;
+	const int nbBatches = 1000;
+	for(SigmoidMode mode : modes)
+	{
+		setSigmoidMode(mode);
+
+		int nbGoodAnswers = 0;
+		const double evalMs = _measureMs(1, [&]{ nbGoodAnswers = trainedNN.computeNbGoodAnswers(testImages); });
+
+		NeuralNetwork nn;
+		nn.initRandom({IMG_SX*IMG_SY, 16, 16, 10}, 1234);
+		std::vector<int> batch(batchSize);
+		int idxBatch = 0;
+		const double trainMs = _measureMs(nbBatches, [&]
+		{
+			for(int i=0 ; i < batchSize ; i++)
+				batch[i] = (idxBatch * batchSize + i) % trainingImages.size();
+			idxBatch++;
+			nn.trainStep(trainingImages, batch, 3.f);
+		});
+
+		printf("%-10s trained network: %d/%d  eval %.2f us/image  train %.3f ms/batch -> %d/%d\n", getSigmoidModeName(mode),
+			nbGoodAnswers, testImages.size(), evalMs * 1000. / testImages.size(), trainMs, nn.computeNbGoodAnswers(testImages), testImages.size());
+	}
+	setSigmoidMode(prevMode);
+}
+
+void benchmarkActivations(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool)
+{
+	printf("=== Benchmark: activations of a 784-64-64-10 network, squared error (sigmoid output) VS cross-entropy (softmax output) ===\n");
+
+	// Learning rates tuned per configuration: (leaky) ReLU and tanh diverge with the learning rate of the sigmoid
+	struct ActivationRun
+	{
+		Activation	hiddenActivation;
+		Activation	outputActivation;
+		float		learningRate;
+	};
+	const ActivationRun runs[] =
+	{
+		{Activation::Sigmoid,	Activation::Sigmoid,	3.f},
+		{Activation::Tanh,		Activation::Sigmoid,	0.05f},
+		{Activation::ReLU,		Activation::Sigmoid,	0.1f},
+		{Activation::LeakyReLU,	Activation::Sigmoid,	0.1f},
+		{Activation::Sigmoid,	Activation::Softmax,	1.f},
+		{Activation::ReLU,		Activation::Softmax,	0.2f},
+	};
+	const int batchSize = 100;
+	const int nbBatchesPerEvaluation = 250;
+	const int nbEvaluations = 8;
+	const int targetNbGoodAnswers = testImages.size() * 95 / 100;
+	for(const ActivationRun& run : runs)
+	{
+		NeuralNetwork nn;
+		nn.initRandom({IMG_SX*IMG_SY, 64, 64, 10}, {run.hiddenActivation, run.hiddenActivation, run.outputActivation}, 1234, &threadPool);
+		BatchPipeline batchPipeline(trainingImages, nn, batchSize, 1234);
+
+		printf("%-9s + %-7s (learning rate %.2f): good answers after", getActivationName(run.hiddenActivation), getActivationName(run.outputActivation), run.learningRate);
+		double trainMs = 0.;
+		int nbBatchesToTarget = 0;
+		for(int idxEvaluation=1 ; idxEvaluation <= nbEvaluations ; idxEvaluation++)
+		{
+			const double startTime = _getTimeMs();
+			for(int idxBatch=0 ; idxBatch < nbBatchesPerEvaluation ; idxBatch++)
+			{
+				nn.trainStep(batchPipeline.acquireBatch(), run.learningRate, &threadPool);
+				batchPipeline.releaseBatch();
+			}
+			trainMs += _getTimeMs() - startTime;
+
+			const int nbGoodAnswers = nn.computeNbGoodAnswers(testImages);
+			if(nbBatchesToTarget == 0 && nbGoodAnswers >= targetNbGoodAnswers)
+				nbBatchesToTarget = idxEvaluation * nbBatchesPerEvaluation;
+			printf(" %d: %d", idxEvaluation * nbBatchesPerEvaluation, nbGoodAnswers);
+		}
+		if(nbBatchesToTarget > 0)
+			printf(" batches  95%% after %d batches (%.3f ms/batch)\n", nbBatchesToTarget, trainMs / (nbEvaluations * nbBatchesPerEvaluation));
+		else
+			printf(" batches  95%% not reached (%.3f ms/batch)\n", trainMs / (nbEvaluations * nbBatchesPerEvaluation));
+	}
+}
+
+void benchmarkModelFile(const LabeledImageSet& testImages, ThreadPool& threadPool)
+{
+	printf("=== Benchmark: legacy import VS model file copy VS zero-copy mapping ===\n");
+
+	struct ModelFileRun
+	{
+		const char*				strName;
+		std::vector<int>		layerSizes;		// empty: the pretrained legacy network
+		std::vector<Activation>	activations;
+	};
+	const ModelFileRun runs[] =
+	{
+		{"pretrained 784-16-16-10",	{},									{}},
+		{"random 784-2048-2048-10",	{IMG_SX*IMG_SY, 2048, 2048, 10},	{Activation::ReLU, Activation::ReLU, Activation::Softmax}},
+	};
+	const char* strFileName = "benchmark_model.nnm";
+	const int nbIterations = 5;
+	for(const ModelFileRun& run : runs)
+	{
+		NeuralNetwork nn;
+		double legacyMs = 0.;
+		if(run.layerSizes.empty())
+		{
+			legacyMs = _measureMs(nbIterations, [&]{ nn.initFromFile(kPretrainedFileName); });
+			if(!nn.checkImageTopology(kPretrainedFileName))
+				return;
+		}
+		else
+			nn.initRandom(run.layerSizes, run.activations, 1234, &threadPool);
+		const int nbGoodAnswers = nn.computeNbGoodAnswers(testImages);
+
+		const double saveMs = _measureMs(1, [&]{ nn.saveToFile(strFileName); });
+
+		// File pages stay in the OS cache between iterations: these are warm load times
+		NeuralNetwork copiedNN, mappedNN, uncheckedMappedNN;
+		const double copyMs = _measureMs(nbIterations, [&]{ copiedNN.initFromFile(strFileName); });
+		const double mapMs = _measureMs(nbIterations, [&]{ mappedNN.mapFromFile(strFileName); });
+		const double uncheckedMapMs = _measureMs(nbIterations, [&]{ uncheckedMappedNN.mapFromFile(strFileName, false); });
+
+		const bool bIdentical = copiedNN.getNbParameters() == nn.getNbParameters() && mappedNN.getNbParameters() == nn.getNbParameters()
+			&& memcmp(copiedNN.getParameters(), nn.getParameters(), nn.getNbParameters() * sizeof(float)) == 0
+			&& memcmp(mappedNN.getParameters(), nn.getParameters(), nn.getNbParameters() * sizeof(float)) == 0
+			&& copiedNN.computeNbGoodAnswers(testImages) == nbGoodAnswers && mappedNN.computeNbGoodAnswers(testImages) == nbGoodAnswers;
+
+		printf("%-24s %zu parameters  save %.3f ms", run.strName, nn.getNbParameters(), saveMs);
+		if(legacyMs > 0.)
+			printf("  legacy import %.3f ms", legacyMs);
+		printf("  copy %.3f ms  map %.3f ms (%.3f ms without CRC)  %d good answers, %s\n", copyMs, mapMs, uncheckedMapMs,
+			nbGoodAnswers, bIdentical ? "identical" : "DIFFERENT");
+	}
+	remove(strFileName);
+}
+
+void benchmarkCheckpointing(const LabeledImageSet& trainingImages, ThreadPool& threadPool)
+{
+	printf("=== Benchmark: training throughput while checkpointing ===\n");
+
+	const int batchSize = 100;
+	const int nbBatches = 400;
+	const int nbBatchesBetweenCheckpoints = 20;
+	const char* strBasePath = "benchmark_checkpoint";
+	enum class CheckpointMode { None, Blocking, Background };
+	const char* modeNames[] = {"no checkpoint", "blocking saveToFile()", "Checkpointer"};
+	for(CheckpointMode mode : {CheckpointMode::None, CheckpointMode::Blocking, CheckpointMode::Background})
+	{
+		NeuralNetwork nn;
+		nn.initRandom({IMG_SX*IMG_SY, 1024, 1024, 10}, {Activation::ReLU, Activation::ReLU, Activation::Softmax}, 1234, &threadPool);
+		BatchPipeline batchPipeline(trainingImages, nn, batchSize, 1234);
+		Checkpointer checkpointer(nn, strBasePath, 2);
+
+		double maxStepMs = 0.;
+		const double startTime = _getTimeMs();
+		for(int idxBatch=1 ; idxBatch <= nbBatches ; idxBatch++)
+		{
+			const double stepStartTime = _getTimeMs();
+			nn.trainStep(batchPipeline.acquireBatch(), 0.05f, &threadPool);
+			batchPipeline.releaseBatch();
+			if(idxBatch % nbBatchesBetweenCheckpoints == 0)
+			{
+				if(mode == CheckpointMode::Blocking)
+					nn.saveToFile("benchmark_checkpoint.nnm");
+				else if(mode == CheckpointMode::Background)
+					checkpointer.requestCheckpoint(nn, idxBatch);
+			}
+			maxStepMs = std::max(maxStepMs, _getTimeMs() - stepStartTime);
+		}
+		const double trainMs = _getTimeMs() - startTime;
+		checkpointer.waitForPendingCheckpoint();
+
+		printf("%-22s %.3f ms/batch (slowest step %.3f ms)", modeNames[(int)mode], trainMs / nbBatches, maxStepMs);
+		if(mode == CheckpointMode::Background)
+			printf("  %d checkpoints written, %d skipped while writing", checkpointer.getNbWrittenCheckpoints(), checkpointer.getNbSkippedRequests());
+		printf("\n");
+	}
+	remove("benchmark_checkpoint.nnm");
+	for(int idxBatch=nbBatches - nbBatchesBetweenCheckpoints ; idxBatch <= nbBatches ; idxBatch += nbBatchesBetweenCheckpoints)
+	{
+		char strFileName[256];
+		snprintf(strFileName, sizeof(strFileName), "%s_%08d.nnm", strBasePath, idxBatch);
+		remove(strFileName);
+	}
+}
+
+void benchmarkQuantization(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool)
+{
+	printf("=== Benchmark: float VS int8 quantized inference, calibrated on the test images ===\n");
+
+	struct QuantizationRun
+	{
+		const char*				strName;
+		std::vector<int>		layerSizes;		// empty: the pretrained legacy network
+		std::vector<Activation>	activations;
+		float					learningRate;
+	};
+	const QuantizationRun runs[] =
+	{
+		{"pretrained 784-16-16-10 sigmoid",	{},								{},																0.f},
+		{"784-128-64-10 relu/softmax",		{IMG_SX*IMG_SY, 128, 64, 10},	{Activation::ReLU, Activation::ReLU, Activation::Softmax},		0.2f},
+		{"784-128-64-10 tanh/sigmoid",		{IMG_SX*IMG_SY, 128, 64, 10},	{Activation::Tanh, Activation::Tanh, Activation::Sigmoid},		0.05f},
+	};
+	const int batchSize = 100;
+	const int nbBatches = 2000;
+	const int nbIterations = 3;
+	const KernelsISA bestISA = gKernels.isa;
+	for(const QuantizationRun& run : runs)
+	{
+		NeuralNetwork nn;
+		if(run.layerSizes.empty())
+		{
+			if(!_loadPretrainedNetwork(nn))
+				return;
+		}
+		else
+		{
+			nn.initRandom(run.layerSizes, run.activations, 1234, &threadPool);
+			BatchPipeline batchPipeline(trainingImages, nn, batchSize, 1234);
+			for(int idxBatch=0 ; idxBatch < nbBatches ; idxBatch++)
+			{
+				nn.trainStep(batchPipeline.acquireBatch(), run.learningRate, &threadPool);
+				batchPipeline.releaseBatch();
+			}
+		}
+
+		QuantizedNetwork qnn;
+		const double quantizeMs = _measureMs(1, [&]{ qnn.quantize(nn, testImages); });
+		printf("--- %s: quantized in %.3f ms\n", run.strName, quantizeMs);
+		printQuantizationReport(nn, qnn, testImages);
+
+		// Single image inference, as StaticNetwork
+		InferenceWorkspace floatWs;
+		floatWs.init(nn);
+		const double floatMs = _measureMs(nbIterations, [&]
+		{
+			for(int idxImage=0 ; idxImage < testImages.size() ; idxImage++)
+				nn.predict(testImages[idxImage], floatWs);
+		});
+		printf("ns/image: float %.1f", floatMs * 1e6 / testImages.size());
+
+		// All ISAs must give the same answers, the int32 sums being exact
+		QuantizedWorkspace quantizedWs;
+		quantizedWs.init(qnn);
+		const int nbGoodAnswers = qnn.computeNbGoodAnswers(testImages);
+		for(int isa = (int)KernelsISA::Scalar ; isa <= (int)bestISA ; isa++)
+		{
+			initKernels(gKernels.mode, (KernelsISA)isa);
+			const double quantizedMs = _measureMs(nbIterations, [&]
+			{
+				for(int idxImage=0 ; idxImage < testImages.size() ; idxImage++)
+					qnn.predict(testImages[idxImage], quantizedWs);
+			});
+			const bool bIdentical = qnn.computeNbGoodAnswers(testImages) == nbGoodAnswers;
+			printf("  int8 %s%s %.1f%s", getKernelsISAName((KernelsISA)isa), gKernels.bVNNI ? " VNNI" : "", quantizedMs * 1e6 / testImages.size(), bIdentical ? "" : " (DIFFERENT)");
+		}
+		initKernels(gKernels.mode, bestISA);
+		printf("\n");
+	}
+}
+
+static long _getFileSize(const char* strFileName)
+{
+	FILE* f = fopen(strFileName, "rb");
+	if(!f)
+		return -1;
+	Defer(fclose(f));
+	fseek(f, 0, SEEK_END);
+	return ftell(f);
+}
+
+void benchmarkWeightsFormats(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool)
+{
+	printf("=== Benchmark: float32 VS fp16 VS bf16 weights, float32 accumulation ===\n");
+
+	const char* strFileName = "benchmark_weights.nnm";
+	const int batchSize = 100;
+	const int nbBatches = 1000;
+	const int nbImages = 1000;
+	const int nbIterations = 3;
+	for(WeightsFormat format : {WeightsFormat::Float32, WeightsFormat::Float16, WeightsFormat::BFloat16})
+	{
+		printf("--- %s weights\n", getWeightsFormatName(format));
+
+		// Accuracy loss of the conversion alone
+		NeuralNetwork pretrainedNN;
+		if(!_loadPretrainedNetwork(pretrainedNN))
+			return;
+		pretrainedNN.setWeightsFormat(format);
+		printf("pretrained 784-16-16-10: %d good answers\n", pretrainedNN.computeNbGoodAnswers(testImages));
+
+		// Inference of a network whose weights don't fit in the caches: bound by the bandwidth of the weight reads
+		NeuralNetwork wideNN;
+		wideNN.initRandom({IMG_SX*IMG_SY, 2048, 2048, 10}, {Activation::ReLU, Activation::ReLU, Activation::Softmax}, 1234, &threadPool);
+		wideNN.setWeightsFormat(format);
+		InferenceWorkspace ws;
+		ws.init(wideNN);
+		const double predictMs = _measureMs(nbIterations, [&]
+		{
+			for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+				wideNN.predict(testImages[idxImage], ws);
+		});
+		const double batchMs = _measureMs(nbIterations, [&]{ wideNN.feedForwardBatch(testImages, 0, nbImages); });
+		const double saveMs = _measureMs(1, [&]{ wideNN.saveToFile(strFileName); });
+		NeuralNetwork loadedNN;
+		const double loadMs = _measureMs(1, [&]{ loadedNN.initFromFile(strFileName); });
+		const bool bIdentical = loadedNN.getWeightsFormat() == format && loadedNN.halfParameters == wideNN.halfParameters
+			&& loadedNN.computeNbGoodAnswers(testImages) == wideNN.computeNbGoodAnswers(testImages);
+		printf("random 784-2048-2048-10: predict %.1f us/image  batch %.1f us/image  file %.2f MB  save %.3f ms  load %.3f ms  reloaded %s\n",
+			predictMs * 1e3 / nbImages, batchMs * 1e3 / nbImages, _getFileSize(strFileName) / (1024. * 1024.), saveMs, loadMs,
+			bIdentical ? "identical" : "DIFFERENT");
+
+		// Training: forward passes read the 16-bit weights, updates go to the float32 master weights
+		NeuralNetwork nn;
+		nn.initRandom({IMG_SX*IMG_SY, 128, 64, 10}, {Activation::ReLU, Activation::ReLU, Activation::Softmax}, 1234, &threadPool);
+		nn.setWeightsFormat(format);
+		BatchPipeline batchPipeline(trainingImages, nn, batchSize, 1234);
+		const double startTime = _getTimeMs();
+		for(int idxBatch=0 ; idxBatch < nbBatches ; idxBatch++)
+		{
+			nn.trainStep(batchPipeline.acquireBatch(), 0.2f, &threadPool);
+			batchPipeline.releaseBatch();
+		}
+		const double trainMs = _getTimeMs() - startTime;
+		printf("trained 784-128-64-10: %.3f ms/batch  %d good answers\n", trainMs / nbBatches, nn.computeNbGoodAnswers(testImages));
+	}
+	remove(strFileName);
+}
+
+void benchmarkPruning(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool)
+{
+	printf("=== Benchmark: magnitude pruning of the first layer, dense VS CSR kernels ===\n");
+
+	struct PruningRun
+	{
+		const char*				strName;
+		std::vector<int>		layerSizes;		// empty: the pretrained legacy network
+		std::vector<Activation>	activations;
+		float					learningRate;
+	};
+	const PruningRun runs[] =
+	{
+		{"pretrained 784-16-16-10 sigmoid",	{},							{},										3.f},
+		{"784-512-10 relu/softmax",			{IMG_SX*IMG_SY, 512, 10},	{Activation::ReLU, Activation::Softmax},	0.2f},
+	};
+	const float sparsities[] = {0.f, 0.5f, 0.8f, 0.95f};
+	const int batchSize = 100;
+	const int nbTrainingBatches = 1000;
+	const int nbFineTuningBatches = 300;
+	const int nbIterations = 3;
+	for(const PruningRun& run : runs)
+	{
+		NeuralNetwork trainedNN;
+		if(run.layerSizes.empty())
+		{
+			if(!_loadPretrainedNetwork(trainedNN))
+				return;
+		}
+		else
+		{
+			trainedNN.initRandom(run.layerSizes, run.activations, 1234, &threadPool);
+			BatchPipeline batchPipeline(trainingImages, trainedNN, batchSize, 1234);
+			for(int idxBatch=0 ; idxBatch < nbTrainingBatches ; idxBatch++)
+			{
+				trainedNN.trainStep(batchPipeline.acquireBatch(), run.learningRate, &threadPool);
+				batchPipeline.releaseBatch();
+			}
+		}
+		printf("--- %s\n", run.strName);
+
+		for(float sparsity : sparsities)
+		{
+			NeuralNetwork nn = trainedNN;
+			nn.pruneWeights(0, sparsity);
+			const int nbGoodAnswers = nn.computeNbGoodAnswers(testImages);
+
+			InferenceWorkspace ws;
+			ws.init(nn);
+			const double predictMs = _measureMs(nbIterations, [&]
+			{
+				for(int idxImage=0 ; idxImage < testImages.size() ; idxImage++)
+					nn.predict(testImages[idxImage], ws);
+			});
+			const double batchMs = _measureMs(nbIterations, [&]{ nn.feedForwardBatch(testImages, 0, testImages.size()); });
+
+			// Training keeps the sparsity pattern: the kept weights recover part of the accuracy lost by pruning
+			BatchPipeline batchPipeline(trainingImages, nn, batchSize, 5678);
+			for(int idxBatch=0 ; idxBatch < nbFineTuningBatches ; idxBatch++)
+			{
+				nn.trainStep(batchPipeline.acquireBatch(), run.learningRate, &threadPool);
+				batchPipeline.releaseBatch();
+			}
+			const Layer& layer = nn.layers[0];
+			const int nbNonZeros = layer.isSparse() ? layer.sparseWeights.getNbNonZeros() : layer.nbOutputs * layer.nbInputs;
+			printf("%2.0f%% sparse (%6d weights, %s): %d good answers, %d after %d fine-tuning batches  predict %.1f ns/image  batch %.1f ns/image\n",
+				sparsity * 100.f, nbNonZeros, layer.isSparse() ? "CSR" : "dense", nbGoodAnswers, nn.computeNbGoodAnswers(testImages), nbFineTuningBatches,
+				predictMs * 1e6 / testImages.size(), batchMs * 1e6 / testImages.size());
+		}
+	}
+}
+
+void checkTrainStepAllocations(const LabeledImageSet& trainingImages, ThreadPool& threadPool)
+{
+	printf("=== Check: heap allocations of a steady-state training step ===\n");
+#if COUNT_HEAP_ALLOCATIONS
+	const int batchSize = 100;
+	const int nbSteps = 100;
+
+	NeuralNetwork nn;
+	nn.initRandom();
+	std::vector<int> batch(batchSize);
+	auto trainSteps = [&](int nbTrainSteps, ThreadPool* pThreadPool)
+	{
+		for(int idxStep=0 ; idxStep < nbTrainSteps ; idxStep++)
+		{
+			for(int i=0 ; i < batchSize ; i++)
+				batch[i] = (idxStep * batchSize + i) % trainingImages.size();
+			nn.trainStep(trainingImages, batch, 3.f, pThreadPool);
+		}
+	};
+
+	for(ThreadPool* pThreadPool : {(ThreadPool*)nullptr, &threadPool})
+	{
+		trainSteps(2, pThreadPool);	// warm-up: workspaces grow to the batch size
+
+		const int64_t nbAllocationsBefore = s_nbHeapAllocations.load();
+		trainSteps(nbSteps, pThreadPool);
+		const int64_t nbAllocations = s_nbHeapAllocations.load() - nbAllocationsBefore;
+
+		printf("%d threads: %lld allocations in %d steps: %s\n", pThreadPool ? pThreadPool->getNbThreads() : 1, (long long)nbAllocations, nbSteps, nbAllocations == 0 ? "OK" : "FAILED");
+	}
+#else
+	(void)trainingImages;
+	(void)threadPool;
+	printf("Disabled: build with COUNT_HEAP_ALLOCATIONS=1\n");
+#endif
+}
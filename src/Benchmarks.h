@@ -0,0 +1,22 @@
+#pragma once
+
+// Micro-benchmarks, run from the debug blocks of main.cpp. Results are printed to stdout.
+
+class ThreadPool;
+
+void benchmarkTransposedWeights();
+void benchmarkHogwild(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool);
+void benchmarkBatchPipeline(const LabeledImageSet& trainingImages, ThreadPool& threadPool);
+void benchmarkRandomInit(ThreadPool& threadPool);
+void benchmarkNetworkSizes(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool);
+void benchmarkStaticNetwork(const LabeledImageSet& testImages);
+void benchmarkSigmoidModes(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages);
+void benchmarkActivations(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool);
+void benchmarkModelFile(const LabeledImageSet& testImages, ThreadPool& threadPool);
+void benchmarkCheckpointing(const LabeledImageSet& trainingImages, ThreadPool& threadPool);
+void benchmarkQuantization(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool);
+void benchmarkWeightsFormats(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool);
+void benchmarkPruning(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages, ThreadPool& threadPool);
+
+// Counts heap allocations of NeuralNetwork::trainStep() once warmed up, which must be 0. Requires COUNT_HEAP_ALLOCATIONS (see Benchmarks.cpp).
+void checkTrainStepAllocations(const LabeledImageSet& trainingImages, ThreadPool& threadPool);
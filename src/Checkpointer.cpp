@@ -0,0 +1,125 @@
+#include "Checkpointer.h"
+#include "NeuralNetwork.h"
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#endif
+
+// Replaces strDstFileName by strSrcFileName in one step: readers see either the old file or the whole new one
+static bool _renameFileAtomically(const char* strSrcFileName, const char* strDstFileName)
+{
+#ifdef _WIN32
+	return MoveFileExA(strSrcFileName, strDstFileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(strSrcFileName, strDstFileName) == 0;
+#endif
+}
+
+Checkpointer::Checkpointer(const NeuralNetwork& nn, const char* strBasePath, int nbKeptCheckpoints)
+	: m_basePath(strBasePath)
+	, m_nbKeptCheckpoints(std::max(1, nbKeptCheckpoints))
+	, m_weightsFormat(nn.getWeightsFormat())
+{
+	// All allocations are done here: a request only copies the parameters
+	getModelFileLayers(nn, m_fileLayers);
+	m_snapshot.assign(nn.getNbParameters(), 0.f);
+	m_keptFileNames.reserve(m_nbKeptCheckpoints + 1);
+
+#ifndef __EMSCRIPTEN__
+	m_writerThread = std::thread(&Checkpointer::writerThreadFunc, this);
+#endif
+}
+
+Checkpointer::~Checkpointer()
+{
+#ifndef __EMSCRIPTEN__
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bExit = true;
+	}
+	m_snapshotReadyCondition.notify_one();
+	m_writerThread.join();
+#endif
+}
+
+bool Checkpointer::requestCheckpoint(const NeuralNetwork& nn, int step)
+{
+	assert(nn.getNbParameters() == m_snapshot.size());
+
+	// The writer clears m_bPending after its last read of the snapshot: once seen cleared, the snapshot is ours
+	if(m_bPending.load())
+	{
+		m_nbSkippedRequests++;
+		return false;
+	}
+	memcpy(m_snapshot.data(), nn.getParameters(), m_snapshot.size() * sizeof(float));
+	m_snapshotStep = step;
+
+#ifdef __EMSCRIPTEN__
+	writeSnapshot();
+#else
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bPending = true;
+	}
+	m_snapshotReadyCondition.notify_one();
+#endif
+	return true;
+}
+
+void Checkpointer::waitForPendingCheckpoint()
+{
+#ifndef __EMSCRIPTEN__
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_snapshotWrittenCondition.wait(lock, [&]{ return !m_bPending; });
+#endif
+}
+
+void Checkpointer::writerThreadFunc()
+{
+	for(;;)
+	{
+		// A pending snapshot is still written on exit
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_snapshotReadyCondition.wait(lock, [&]{ return m_bExit || m_bPending; });
+			if(!m_bPending)
+				return;
+		}
+
+		writeSnapshot();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bPending = false;
+		}
+		m_snapshotWrittenCondition.notify_all();
+	}
+}
+
+void Checkpointer::writeSnapshot()
+{
+	char strFileName[1024];
+	snprintf(strFileName, sizeof(strFileName), "%s_%08d.nnm", m_basePath.c_str(), m_snapshotStep);
+	const std::string strTempFileName = std::string(strFileName) + ".tmp";
+
+	if(!writeModelFile(strTempFileName.c_str(), m_fileLayers, m_snapshot.data(), m_snapshot.size(), m_weightsFormat, true)
+		|| !_renameFileAtomically(strTempFileName.c_str(), strFileName))
+	{
+		fprintf(stderr, "Failed to write checkpoint: %s\n", strFileName);
+		remove(strTempFileName.c_str());
+		m_nbFailedCheckpoints++;
+		return;
+	}
+	m_nbWrittenCheckpoints++;
+
+	// A step checkpointed twice replaced its file instead of adding one
+	if(std::find(m_keptFileNames.begin(), m_keptFileNames.end(), strFileName) == m_keptFileNames.end())
+		m_keptFileNames.push_back(strFileName);
+	while((int)m_keptFileNames.size() > m_nbKeptCheckpoints)
+	{
+		remove(m_keptFileNames.front().c_str());
+		m_keptFileNames.erase(m_keptFileNames.begin());
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <string>
+#include "ModelFile.h"
+
+struct NeuralNetwork;
+
+// Periodic saves of a network being trained, without blocking training on the file writes.
+//
+// requestCheckpoint() copies the parameters into a spare buffer allocated up front, which is the only work done on the
+// training thread, and hands it over to a background thread. That thread computes the CRC and writes the model file to
+// "<name>.tmp", flushes it to disk, then renames it to "<strBasePath>_<step>.nnm": the rename is atomic, so a crash
+// mid-write never leaves a truncated checkpoint, only a stale temporary file. Once a checkpoint is written, the oldest
+// ones beyond nbKeptCheckpoints are deleted.
+// Checkpoints are written in the weights format of nn at construction: fp16 and bf16 ones are half the size of float32 ones.
+// A request made while the previous checkpoint is still being written is skipped rather than waited for.
+// Without thread support (Emscripten build), requestCheckpoint() writes the checkpoint on the calling thread.
+class Checkpointer
+{
+public:
+	static const int	kDefaultNbKeptCheckpoints = 3;
+
+	// nn only gives the topology: later requests must be made with networks of the same topology
+	Checkpointer(const NeuralNetwork& nn, const char* strBasePath, int nbKeptCheckpoints = kDefaultNbKeptCheckpoints);
+	~Checkpointer();	// waits for the checkpoint being written, if any
+
+	Checkpointer(const Checkpointer&) = delete;
+	Checkpointer& operator=(const Checkpointer&) = delete;
+
+	// Returns false if the request was skipped because the previous checkpoint is still being written
+	bool	requestCheckpoint(const NeuralNetwork& nn, int step);
+	void	waitForPendingCheckpoint();
+
+	int		getNbWrittenCheckpoints() const	{ return m_nbWrittenCheckpoints.load(); }
+	int		getNbSkippedRequests() const	{ return m_nbSkippedRequests; }
+	int		getNbFailedCheckpoints() const	{ return m_nbFailedCheckpoints.load(); }
+
+private:
+	void	writerThreadFunc();
+	void	writeSnapshot();
+
+	std::string					m_basePath;
+	int							m_nbKeptCheckpoints = 0;
+	std::vector<ModelFileLayer>	m_fileLayers;
+	WeightsFormat				m_weightsFormat;
+
+	// Parameters copied by the last request, and its step. Owned by the writer while m_bPending is set.
+	AlignedVector<float>		m_snapshot;
+	int							m_snapshotStep = 0;
+
+	// Written checkpoints, oldest first. Only used by the writer.
+	std::vector<std::string>	m_keptFileNames;
+
+	int							m_nbSkippedRequests = 0;
+	std::atomic<int>			m_nbWrittenCheckpoints{0};
+	std::atomic<int>			m_nbFailedCheckpoints{0};
+
+	std::mutex					m_mutex;
+	std::condition_variable		m_snapshotReadyCondition;
+	std::condition_variable		m_snapshotWrittenCondition;
+	std::atomic<bool>			m_bPending{false};
+	bool						m_bExit = false;
+
+	std::thread					m_writerThread;
+};
@@ -117,13 +117,14 @@ void GUI::updateAndDrawImGui()
 	if(ImGui::Begin("Main window", nullptr, windowFlags))
 	{
 		static int s_idxTestImage = 0;
-		const LabeledImage* pImg = &gData.testImages[s_idxTestImage];
+		LabeledImage testImg = gData.testImages[s_idxTestImage];
 
 		static bool s_bFirstTime = true;
 		if(s_bFirstTime)
 		{
 			s_bFirstTime = false;
-			gData.pNN->feedForward(*pImg, false);
+			m_inferenceWs.init(*gData.pNN);
+			gData.pNN->predict(testImg, m_inferenceWs);
 		}
 
 		if(ImGui::Button(formatTempStr("Test image %d###btnTestImage", s_idxTestImage)))
@@ -131,8 +132,8 @@ void GUI::updateAndDrawImGui()
 			s_idxTestImage++;
 			if(s_idxTestImage >= (int)gData.testImages.size())
 				s_idxTestImage = 0;
-			pImg = &gData.testImages[s_idxTestImage];
-			gData.pNN->feedForward(*pImg, false);
+			testImg = gData.testImages[s_idxTestImage];
+			gData.pNN->predict(testImg, m_inferenceWs);
 		}
 
 		ImGui::BeginDisabled();
@@ -147,7 +148,7 @@ void GUI::updateAndDrawImGui()
 		ImGui::BeginDisabled(!m_bFreeFormDrawing);
 		ImGui::SameLine();
 		if(ImGui::SmallButton("Reset"))
-			memset(&m_freeFormDrawingImg.data[0], 0, IMG_SX*IMG_SY);
+			memset(m_freeFormDrawingPixels, 0, IMG_SX*IMG_SY);
 		ImGui::EndDisabled();
 		
 		ImDrawList* pDrawList = ImGui::GetWindowDrawList();
@@ -160,15 +161,16 @@ void GUI::updateAndDrawImGui()
 		glfwGetWindowSize(m_pMainWindow, &winSizeX, &winSizeY);
 		const ImVec2 winSize = ImVec2((float)winSizeX, (float)winSizeY);
 
-		const int	nbLayers = _countof(gData.pNN->layers);
+		const int	nbLayers = gData.pNN->getNbLayers();
 		const float	leftMargin = 0.2f * winSize.x;
 		const float	rightMargin = 0.1f * winSize.x;
 		const float	topMargin = 0.05f * winSize.y;
 		const float	bottomMargin = 0.05f * winSize.y;
 		const float	betweenLayers = (winSize.x-leftMargin-rightMargin) / (float)(nbLayers-1);
 
-		const LabeledImage	backupFreeFormImg = m_freeFormDrawingImg;
+		unsigned char		backupFreeFormPixels[IMG_SX*IMG_SY];
 		bool				bShouldBackupFreeFormImg = false;
+		memcpy(backupFreeFormPixels, m_freeFormDrawingPixels, sizeof(backupFreeFormPixels));
 
 		// Draw & update input image
 		{
@@ -201,18 +203,17 @@ void GUI::updateAndDrawImGui()
 						static float s_minVal = 0.01f;
 						static float s_powVal = 1.1f;
 						const unsigned char colValue = (unsigned char)std::min(255.f, std::max(0.f, s_scale / std::max(s_minVal, powf(dx*dx + dy*dy, s_powVal))));
-						unsigned char& outValue = m_freeFormDrawingImg.data[x + y*IMG_SX];
+						unsigned char& outValue = m_freeFormDrawingPixels[x + y*IMG_SX];
 						outValue = std::max(colValue, outValue);
 					}
 				}
 				
-				m_freeFormDrawingImg.updateFloatDataFromData();
-				gData.pNN->feedForward(m_freeFormDrawingImg, false);
+				gData.pNN->predict(m_freeFormDrawingImg, m_inferenceWs);
 			}
 
 			// Draw input image
 			{
-				const LabeledImage& img = m_bFreeFormDrawing ? m_freeFormDrawingImg : gData.testImages[s_idxTestImage];
+				const LabeledImage img = m_bFreeFormDrawing ? m_freeFormDrawingImg : gData.testImages[s_idxTestImage];
 				ImVec2 pos = posStart;
 				for(int y=0 ; y < IMG_SY ; y++, pos.y += pixelSize.y)
 				{
@@ -251,8 +252,8 @@ void GUI::updateAndDrawImGui()
 					for(int idxStartNeuron=0 ; idxStartNeuron < nbStartNeurons ; idxStartNeuron++, curStartNeuronPos.y += verticalSpaceBetweenStartNeurons)
 					{
 						static float s_lineScale = 1.f;
-						const float weight = endLayer.weightsAndBias[idxStartNeuron];
-						const float inputNeuronValue = startLayer.neuronValues[idxStartNeuron];
+						const float weight = endLayer.getWeight(0, idxStartNeuron);
+						const float inputNeuronValue = m_inferenceWs.neuronValues[idxEndLayer-1][idxStartNeuron];
 						static const ImColor s_weightColorPos = ImColor(0.5f,1.0f,0.5f,1.0f);;
 						static const ImColor s_weightColorNeg = ImColor(1.0f,0.5f,0.5f,1.0f);
 						pDrawList->AddLine(winPos + curStartNeuronPos, winPos + curEndNeuronPos,
@@ -267,11 +268,11 @@ void GUI::updateAndDrawImGui()
 		// Compute final answer
 		int idxHighestNeuronInLastLayer = -1;
 		{
-			const Layer& lastLayer = gData.pNN->layers[_countof(gData.pNN->layers)-1];
+			const Layer& lastLayer = gData.pNN->getLastLayer();
 			float highestValue = -FLT_MAX;
 			for(int idxNeuron=0 ; idxNeuron < lastLayer.nbOutputs ; idxNeuron++)
 			{
-				const float neuronValue = lastLayer.neuronValues[idxNeuron];
+				const float neuronValue = m_inferenceWs.neuronValues[nbLayers-1][idxNeuron];
 				if(neuronValue > highestValue)
 				{
 					highestValue = neuronValue;
@@ -294,7 +295,7 @@ void GUI::updateAndDrawImGui()
 			
 				for(int idxNeuron=0 ; idxNeuron < nbNeurons ; idxNeuron++, curNeuronPos.y += verticalSpaceBetweenNeurons)
 				{
-					float f = layer.neuronValues[idxNeuron];
+					float f = m_inferenceWs.neuronValues[idxLayer][idxNeuron];
 					pDrawList->AddCircleFilled(winPos + curNeuronPos, ((float)fabs(f) + 0.2f)*5.f, f >= 0.f ? neuronColorPos : neuronColorNeg);
 
 					if(idxLayer == nbLayers-1)
@@ -309,7 +310,7 @@ void GUI::updateAndDrawImGui()
 		}
 
 		if(bShouldBackupFreeFormImg)
-			m_freeFormDrawingImg = backupFreeFormImg;
+			memcpy(m_freeFormDrawingPixels, backupFreeFormPixels, sizeof(backupFreeFormPixels));
 	}
 	ImGui::End();
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "NeuralNetwork.h"
+
 struct LabeledImage;
 struct GLFWwindow;
 
@@ -15,5 +17,9 @@ public:
 private:
 	GLFWwindow*		m_pMainWindow = nullptr;
 	bool			m_bFreeFormDrawing = false;
-	LabeledImage	m_freeFormDrawingImg;
+	unsigned char	m_freeFormDrawingPixels[IMG_SX*IMG_SY] = {};
+	LabeledImage	m_freeFormDrawingImg = {m_freeFormDrawingPixels};
+
+	// Neuron values of the displayed image
+	InferenceWorkspace	m_inferenceWs;
 };
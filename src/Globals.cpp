@@ -1,7 +1,7 @@
 #include "Globals.h"
 #include "NeuralNetwork.h"
 #include "GUI.h"
-#include <random>
+#include "Random.h"
 
 #define STB_SPRINTF_IMPLEMENTATION
 #include "stb_sprintf.h"
@@ -33,19 +33,15 @@ void testPGM()
 	delete [] data;
 }
 
-static std::default_random_engine randGenerator;
-static std::normal_distribution<double> randNormalDistribution(0.f, 1.f);
-
+// Each thread has its own generator: thread-safe without locks
 float randNormal()
 {
-	const double d = randNormalDistribution.operator()(randGenerator);
-	return (float)d;
+	return getThreadRandomGenerator().nextNormal();
 }
 
 int randInt(int minVal, int maxVal)
 {
-	std::uniform_int_distribution<int> distrib(minVal, maxVal);
-	return distrib(randGenerator);
+	return getThreadRandomGenerator().nextInt(minVal, maxVal);
 }
 
 [[nodiscard]] const char* formatTempStr(const char* fmt, ...)
@@ -4,9 +4,11 @@
 #include <stdio.h>
 #include <assert.h>
 #include <vector>
+#include <algorithm>
 #include <math.h>
 #include <functional>
 #include <memory>
+#include <new>
 
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include <imgui.h>
@@ -24,6 +26,13 @@
 #define TEST_IMAGES_FILENAME	DATA_DIR "/t10k-images.idx3-ubyte"
 #define TEST_LABELS_FILENAME	DATA_DIR "/t10k-labels.idx1-ubyte"
 
+// Original gzipped files, used when the decompressed ones above are missing
+#define TRAINING_IMAGES_GZ_FILENAME	DATA_DIR "/original/train-images-idx3-ubyte.gz"
+#define TRAINING_LABELS_GZ_FILENAME	DATA_DIR "/original/train-labels-idx1-ubyte.gz"
+
+#define TEST_IMAGES_GZ_FILENAME	DATA_DIR "/original/t10k-images-idx3-ubyte.gz"
+#define TEST_LABELS_GZ_FILENAME	DATA_DIR "/original/t10k-labels-idx1-ubyte.gz"
+
 #ifndef _countof
 	#define _countof(_Array) (sizeof(_Array) / sizeof(_Array[0]))
 #endif
@@ -40,14 +49,46 @@ inline void debugSavePxM(const unsigned char *data, int width, int height, const
 inline void	debugSavePGM(const unsigned char *data, int width, int height, const char *name)		{ debugSavePxM(data, width, height, name, "P5\n", 1); }					// data is grayscale
 inline void	debugSavePPM(const unsigned char *data, int width, int height, const char *name)		{ debugSavePxM(data, width, height, name, "P6\n", 3); }					// data is RGB
 
-#include "LabeledImage.h"
-
 union U32Union
 {
 	uint32_t u32;
 	uint8_t  u8[4];
 };
 
+// Allocator for SIMD-friendly buffers: memory is aligned on a cache line by default
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() = default;
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t n)
+	{
+		return (T*)::operator new(n * sizeof(T), std::align_val_t(Alignment));
+	}
+
+	void deallocate(T* p, size_t)
+	{
+		::operator delete(p, std::align_val_t(Alignment));
+	}
+
+	template<typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+	template<typename U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#include "LabeledImage.h"
+
 float	randNormal();
 int		randInt(int minVal, int maxVal);
 
@@ -78,8 +119,8 @@ struct Globals
 {
 	std::unique_ptr<GUI>			pGUI;
 	std::unique_ptr<NeuralNetwork>	pNN;
-	std::vector<LabeledImage>		trainingImages;
-	std::vector<LabeledImage>		testImages;
+	LabeledImageSet					trainingImages;
+	LabeledImageSet					testImages;
 	bool							bDebugAlwaysRedrawContent = false;
 	int								curFrame = 0;
 	bool							bExitApp = false;
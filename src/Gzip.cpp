@@ -0,0 +1,572 @@
+#include "Gzip.h"
+#include "MappedFile.h"
+#ifndef __EMSCRIPTEN__
+	#include <thread>
+	#include <mutex>
+	#include <condition_variable>
+	#include <atomic>
+#endif
+
+// ============================== CRC-32 ==============================
+
+// Slicing-by-8: s_crc32Tables[k][b] is the CRC of byte b followed by k zero bytes, so that 8 bytes are folded at once
+// with independent lookups instead of a chain of 8 dependent ones.
+static uint32_t s_crc32Tables[8][256];
+
+static bool _initCrc32Table()
+{
+	for(uint32_t i=0 ; i < 256 ; i++)
+	{
+		uint32_t c = i;
+		for(int k=0 ; k < 8 ; k++)
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : (c >> 1);
+		s_crc32Tables[0][i] = c;
+	}
+	for(uint32_t i=0 ; i < 256 ; i++)
+	{
+		for(int k=1 ; k < 8 ; k++)
+			s_crc32Tables[k][i] = s_crc32Tables[0][s_crc32Tables[k-1][i] & 0xFF] ^ (s_crc32Tables[k-1][i] >> 8);
+	}
+	return true;
+}
+
+uint32_t updateCrc32(uint32_t crc, const void* data, size_t size)
+{
+	[[maybe_unused]] static const bool s_bTableInitialized = _initCrc32Table();
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	crc = ~crc;
+	size_t i = 0;
+	for( ; i + 8 <= size ; i += 8)
+	{
+		const unsigned char* b = &bytes[i];
+		const uint32_t lo = crc ^ (b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24);
+		crc = s_crc32Tables[7][lo & 0xFF] ^ s_crc32Tables[6][(lo >> 8) & 0xFF] ^ s_crc32Tables[5][(lo >> 16) & 0xFF] ^ s_crc32Tables[4][lo >> 24]
+			^ s_crc32Tables[3][b[4]] ^ s_crc32Tables[2][b[5]] ^ s_crc32Tables[1][b[6]] ^ s_crc32Tables[0][b[7]];
+	}
+	for( ; i < size ; i++)
+		crc = s_crc32Tables[0][(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+// ============================== Bit reader ==============================
+
+// DEFLATE bits are packed LSB first. Reading past the end of the input returns zeros, see isOverrun().
+struct _BitReader
+{
+	const unsigned char*	data = nullptr;
+	size_t					size = 0;
+	size_t					pos = 0;
+	uint64_t				bitBuffer = 0;
+	int						nbBits = 0;
+
+	void refill()
+	{
+		while(nbBits <= 56)
+		{
+			const uint64_t byte = pos < size ? data[pos] : 0;
+			pos++;
+			bitBuffer |= byte << nbBits;
+			nbBits += 8;
+		}
+	}
+
+	uint32_t peekBits(int n)
+	{
+		if(nbBits < n)
+			refill();
+		return (uint32_t)(bitBuffer & ((1ull << n) - 1));
+	}
+
+	void consumeBits(int n)
+	{
+		bitBuffer >>= n;
+		nbBits -= n;
+	}
+
+	uint32_t getBits(int n)
+	{
+		const uint32_t value = peekBits(n);
+		consumeBits(n);
+		return value;
+	}
+
+	void alignToByte()
+	{
+		consumeBits(nbBits & 7);
+	}
+
+	// Position of the next unread byte, once aligned
+	size_t getBytePos() const
+	{
+		return pos - nbBits / 8;
+	}
+
+	// True if bits past the end of the input have been consumed: the stream is truncated
+	bool isOverrun() const
+	{
+		return pos * 8 - nbBits > size * 8;
+	}
+};
+
+// ============================== Huffman decoding ==============================
+
+static int _reverseBits(int code, int nbBits)
+{
+	int reversed = 0;
+	for(int i=0 ; i < nbBits ; i++, code >>= 1)
+		reversed = (reversed << 1) | (code & 1);
+	return reversed;
+}
+
+// Canonical Huffman decoder: codes up to kFastBits long are decoded with one table lookup, longer ones by code length
+struct _Huffman
+{
+	static const int	kFastBits = 10;
+	static const int	kMaxSymbols = 288;
+
+	uint16_t	fast[1 << kFastBits];	// (code length << 9) | symbol, 0 if the code is longer than kFastBits
+	int			maxCode[17];			// first code of next length, left aligned on 16 bits
+	uint16_t	firstCode[16];
+	uint16_t	firstSymbolIndex[16];
+	uint16_t	symbols[kMaxSymbols];	// symbols sorted by code
+	int			nbSymbols = 0;
+
+	bool build(const unsigned char* codeLengths, int nbCodeLengths)
+	{
+		int nbCodesPerLength[16] = {0};
+		for(int i=0 ; i < nbCodeLengths ; i++)
+			nbCodesPerLength[codeLengths[i]]++;
+		nbCodesPerLength[0] = 0;
+
+		memset(fast, 0, sizeof(fast));
+		int nextCode[16] = {0};
+		int code = 0;
+		int symbolIndex = 0;
+		for(int length=1 ; length < 16 ; length++)
+		{
+			nextCode[length] = code;
+			firstCode[length] = (uint16_t)code;
+			firstSymbolIndex[length] = (uint16_t)symbolIndex;
+			code += nbCodesPerLength[length];
+			if(nbCodesPerLength[length] > 0 && code - 1 >= (1 << length))
+				return false;	// over-subscribed
+			maxCode[length] = code << (16 - length);
+			code <<= 1;
+			symbolIndex += nbCodesPerLength[length];
+		}
+		maxCode[16] = 0x10000;
+		nbSymbols = symbolIndex;
+
+		for(int symbol=0 ; symbol < nbCodeLengths ; symbol++)
+		{
+			const int length = codeLengths[symbol];
+			if(length == 0)
+				continue;
+
+			symbols[nextCode[length] - firstCode[length] + firstSymbolIndex[length]] = (uint16_t)symbol;
+			if(length <= kFastBits)
+			{
+				const uint16_t fastValue = (uint16_t)((length << 9) | symbol);
+				for(int j = _reverseBits(nextCode[length], length) ; j < (1 << kFastBits) ; j += 1 << length)
+					fast[j] = fastValue;
+			}
+			nextCode[length]++;
+		}
+		return true;
+	}
+
+	// Returns the decoded symbol, -1 for an invalid code
+	int decode(_BitReader& bitReader) const
+	{
+		const uint32_t bits = bitReader.peekBits(16);
+		const uint16_t fastValue = fast[bits & ((1 << kFastBits) - 1)];
+		if(fastValue)
+		{
+			bitReader.consumeBits(fastValue >> 9);
+			return fastValue & 0x1FF;
+		}
+
+		// Codes are stored MSB first: compare the reversed bits with the code ranges of each length
+		const int reversedBits = _reverseBits(bits, 16);
+		int length = kFastBits + 1;
+		while(length < 16 && reversedBits >= maxCode[length])
+			length++;
+		if(length >= 16)
+			return -1;
+
+		const int symbolIndex = (reversedBits >> (16 - length)) - firstCode[length] + firstSymbolIndex[length];
+		if(symbolIndex >= nbSymbols)
+			return -1;
+		bitReader.consumeBits(length);
+		return symbols[symbolIndex];
+	}
+};
+
+// ============================== Inflate ==============================
+
+static const int kLengthBase[29]	= {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const int kLengthExtra[29]	= {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const int kDistBase[30]		= {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const int kDistExtra[30]		= {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+// Decompressed bytes go to a buffer holding the 32 KB window needed by back references, followed by the chunk being filled
+struct _InflateOutput
+{
+	static const size_t	kWindowSize = 32*1024;
+	static const size_t	kMaxMatchLength = 258;
+
+	std::vector<unsigned char>	buffer = std::vector<unsigned char>(kWindowSize + kGzipChunkSize);
+	size_t						pos = 0;			// write position in buffer
+	size_t						flushedPos = 0;		// start of the bytes not sent to onData yet
+	size_t						totalSize = 0;		// number of bytes decompressed so far
+	uint32_t					crc = 0;
+	const GzipDataFunc*			pOnData = nullptr;
+
+	bool flush()
+	{
+		if(pos == flushedPos)
+			return true;
+		crc = updateCrc32(crc, &buffer[flushedPos], pos - flushedPos);
+		if(!(*pOnData)(&buffer[flushedPos], pos - flushedPos))
+			return false;
+
+		// Keep the last window for back references
+		if(pos > kWindowSize)
+		{
+			memmove(&buffer[0], &buffer[pos - kWindowSize], kWindowSize);
+			pos = kWindowSize;
+		}
+		flushedPos = pos;
+		return true;
+	}
+
+	// Makes room for a literal or a match, so that chunks never exceed kGzipChunkSize
+	bool reserve()
+	{
+		if(pos - flushedPos + kMaxMatchLength <= kGzipChunkSize)
+			return true;
+		return flush();
+	}
+};
+
+static bool _inflateStoredBlock(_BitReader& bitReader, _InflateOutput& output)
+{
+	bitReader.alignToByte();
+	const uint32_t len = bitReader.getBits(16);
+	const uint32_t nlen = bitReader.getBits(16);
+	if((len ^ 0xFFFF) != nlen)
+		return false;
+
+	// Bytes already in the bit buffer, then straight copies from the input
+	uint32_t nbCopied = 0;
+	for( ; nbCopied < len && bitReader.nbBits >= 8 ; nbCopied++)
+	{
+		if(!output.reserve())
+			return false;
+		output.buffer[output.pos++] = (unsigned char)bitReader.getBits(8);
+	}
+	while(nbCopied < len)
+	{
+		if(!output.reserve())
+			return false;
+		if(bitReader.pos >= bitReader.size)
+			return false;
+		const size_t nbBytes = std::min({(size_t)(len - nbCopied), bitReader.size - bitReader.pos, kGzipChunkSize - (output.pos - output.flushedPos)});
+		memcpy(&output.buffer[output.pos], &bitReader.data[bitReader.pos], nbBytes);
+		output.pos += nbBytes;
+		bitReader.pos += nbBytes;
+		nbCopied += (uint32_t)nbBytes;
+	}
+	output.totalSize += len;
+	return !bitReader.isOverrun();
+}
+
+static bool _inflateHuffmanBlock(_BitReader& bitReader, const _Huffman& litLenHuffman, const _Huffman& distHuffman, _InflateOutput& output)
+{
+	while(true)
+	{
+		if(!output.reserve())
+			return false;
+
+		const int symbol = litLenHuffman.decode(bitReader);
+		if(symbol < 0 || bitReader.isOverrun())
+			return false;
+
+		if(symbol < 256)
+		{
+			output.buffer[output.pos++] = (unsigned char)symbol;
+			output.totalSize++;
+			continue;
+		}
+		if(symbol == 256)
+			return true;
+
+		const int lengthCode = symbol - 257;
+		if(lengthCode >= 29)
+			return false;
+		const int length = kLengthBase[lengthCode] + (int)bitReader.getBits(kLengthExtra[lengthCode]);
+
+		const int distCode = distHuffman.decode(bitReader);
+		if(distCode < 0 || distCode >= 30)
+			return false;
+		const size_t dist = (size_t)kDistBase[distCode] + bitReader.getBits(kDistExtra[distCode]);
+		if(dist > output.pos || dist > output.totalSize)
+			return false;
+
+		// Byte per byte: source and destination overlap when dist < length
+		unsigned char* dst = &output.buffer[output.pos];
+		const unsigned char* src = dst - dist;
+		for(int i=0 ; i < length ; i++)
+			dst[i] = src[i];
+		output.pos += length;
+		output.totalSize += length;
+	}
+}
+
+static bool _readDynamicHuffmanTables(_BitReader& bitReader, _Huffman& litLenHuffman, _Huffman& distHuffman)
+{
+	static const int kCodeLengthOrder[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+
+	const int nbLitLenCodes = (int)bitReader.getBits(5) + 257;
+	const int nbDistCodes = (int)bitReader.getBits(5) + 1;
+	const int nbCodeLengthCodes = (int)bitReader.getBits(4) + 4;
+
+	unsigned char codeLengthCodeLengths[19] = {0};
+	for(int i=0 ; i < nbCodeLengthCodes ; i++)
+		codeLengthCodeLengths[kCodeLengthOrder[i]] = (unsigned char)bitReader.getBits(3);
+
+	_Huffman codeLengthHuffman;
+	if(!codeLengthHuffman.build(codeLengthCodeLengths, 19))
+		return false;
+
+	unsigned char codeLengths[286 + 30] = {0};
+	const int nbCodeLengths = nbLitLenCodes + nbDistCodes;
+	for(int i=0 ; i < nbCodeLengths ; )
+	{
+		const int symbol = codeLengthHuffman.decode(bitReader);
+		if(symbol < 0 || bitReader.isOverrun())
+			return false;
+
+		if(symbol < 16)
+		{
+			codeLengths[i++] = (unsigned char)symbol;
+			continue;
+		}
+
+		unsigned char repeatedLength = 0;
+		int nbRepeats = 0;
+		if(symbol == 16)
+		{
+			if(i == 0)
+				return false;
+			repeatedLength = codeLengths[i-1];
+			nbRepeats = 3 + (int)bitReader.getBits(2);
+		}
+		else if(symbol == 17)
+			nbRepeats = 3 + (int)bitReader.getBits(3);
+		else
+			nbRepeats = 11 + (int)bitReader.getBits(7);
+
+		if(i + nbRepeats > nbCodeLengths)
+			return false;
+		for(int j=0 ; j < nbRepeats ; j++)
+			codeLengths[i++] = repeatedLength;
+	}
+
+	return litLenHuffman.build(codeLengths, nbLitLenCodes) && distHuffman.build(&codeLengths[nbLitLenCodes], nbDistCodes);
+}
+
+static bool _inflate(_BitReader& bitReader, _InflateOutput& output)
+{
+	static _Huffman s_fixedLitLenHuffman;
+	static _Huffman s_fixedDistHuffman;
+	[[maybe_unused]] static bool s_bFixedHuffmanInitialized = []
+	{
+		unsigned char codeLengths[288];
+		memset(&codeLengths[0], 8, 144);
+		memset(&codeLengths[144], 9, 112);
+		memset(&codeLengths[256], 7, 24);
+		memset(&codeLengths[280], 8, 8);
+		s_fixedLitLenHuffman.build(codeLengths, 288);
+		memset(codeLengths, 5, 30);
+		s_fixedDistHuffman.build(codeLengths, 30);
+		return true;
+	}();
+
+	_Huffman dynamicLitLenHuffman;
+	_Huffman dynamicDistHuffman;
+	bool bFinalBlock = false;
+	while(!bFinalBlock)
+	{
+		bFinalBlock = bitReader.getBits(1) != 0;
+		const uint32_t blockType = bitReader.getBits(2);
+		bool bOk = false;
+		switch(blockType)
+		{
+		case 0:
+			bOk = _inflateStoredBlock(bitReader, output);
+			break;
+		case 1:
+			bOk = _inflateHuffmanBlock(bitReader, s_fixedLitLenHuffman, s_fixedDistHuffman, output);
+			break;
+		case 2:
+			bOk = _readDynamicHuffmanTables(bitReader, dynamicLitLenHuffman, dynamicDistHuffman)
+				&& _inflateHuffmanBlock(bitReader, dynamicLitLenHuffman, dynamicDistHuffman, output);
+			break;
+		default:
+			break;
+		}
+		if(!bOk || bitReader.isOverrun())
+			return false;
+	}
+	return output.flush();
+}
+
+// ============================== Gzip ==============================
+
+static uint32_t _readLE32(const unsigned char* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Parses the gzip header, decompresses the DEFLATE stream and checks the CRC-32 and size of the trailer
+static bool _gunzip(const unsigned char* data, size_t size, const GzipDataFunc& onData)
+{
+	// ===== GZIP HEADER =====
+	// ID1 ID2 CM FLG | MTIME (4) | XFL OS | [FEXTRA: XLEN (2) + data] [FNAME: zero terminated] [FCOMMENT: zero terminated] [FHCRC (2)]
+	if(size < 18 || data[0] != 0x1F || data[1] != 0x8B || data[2] != 8)
+		return false;
+	const unsigned char flags = data[3];
+	size_t pos = 10;
+	if(flags & 0x04)	// FEXTRA
+	{
+		if(pos + 2 > size)
+			return false;
+		pos += 2 + (data[pos] | (data[pos+1] << 8));
+	}
+	for(int flag : {0x08, 0x10})	// FNAME, FCOMMENT
+	{
+		if(flags & flag)
+		{
+			while(pos < size && data[pos] != 0)
+				pos++;
+			pos++;
+		}
+	}
+	if(flags & 0x02)	// FHCRC
+		pos += 2;
+	if(pos + 8 > size)
+		return false;
+
+	_BitReader bitReader;
+	bitReader.data = data + pos;
+	bitReader.size = size - pos - 8;	// trailer: CRC32, ISIZE
+
+	_InflateOutput output;
+	output.pOnData = &onData;
+	if(!_inflate(bitReader, output))
+		return false;
+
+	bitReader.alignToByte();
+	const unsigned char* trailer = data + pos + bitReader.getBytePos();
+	if(trailer + 8 > data + size)
+		return false;
+	return _readLE32(trailer) == output.crc && _readLE32(trailer + 4) == (uint32_t)output.totalSize;
+}
+
+bool gunzipFile(const char* strFileName, const GzipDataFunc& onData, bool bBackgroundThread)
+{
+	MappedFile file;
+	if(!file.open(strFileName))
+		return false;
+
+#ifdef __EMSCRIPTEN__
+	(void)bBackgroundThread;	// no threads: decompressed on the calling thread
+	return _gunzip(file.getData(), file.getSize(), onData);
+#else
+	if(!bBackgroundThread)
+		return _gunzip(file.getData(), file.getSize(), onData);
+
+	// Producer/consumer: the decompression thread fills a ring of chunks, the calling thread consumes them in order
+	const int kNbChunks = 4;
+	struct Chunk
+	{
+		std::vector<unsigned char>	data;
+		size_t						size = 0;
+	};
+	Chunk chunks[kNbChunks];
+	for(Chunk& chunk : chunks)
+		chunk.data.resize(kGzipChunkSize);
+
+	std::mutex mutex;
+	std::condition_variable chunkFilledCondition;
+	std::condition_variable chunkConsumedCondition;
+	int nbFilledChunks = 0;
+	bool bDecompressionDone = false;
+	bool bDecompressionOk = false;
+	bool bAborted = false;
+
+	std::thread decompressionThread([&]
+	{
+		int idxChunk = 0;
+		const GzipDataFunc pushChunk = [&](const unsigned char* data, size_t size)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				chunkConsumedCondition.wait(lock, [&]{ return nbFilledChunks < kNbChunks || bAborted; });
+				if(bAborted)
+					return false;
+			}
+			// The consumer never touches a chunk until it is counted as filled
+			memcpy(chunks[idxChunk].data.data(), data, size);
+			chunks[idxChunk].size = size;
+			idxChunk = (idxChunk + 1) % kNbChunks;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				nbFilledChunks++;
+			}
+			chunkFilledCondition.notify_one();
+			return true;
+		};
+
+		const bool bOk = _gunzip(file.getData(), file.getSize(), pushChunk);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			bDecompressionDone = true;
+			bDecompressionOk = bOk;
+		}
+		chunkFilledCondition.notify_one();
+	});
+
+	bool bConsumerOk = true;
+	int idxChunk = 0;
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			chunkFilledCondition.wait(lock, [&]{ return nbFilledChunks > 0 || bDecompressionDone; });
+			if(nbFilledChunks == 0)
+				break;	// done, all chunks consumed
+		}
+
+		if(!onData(chunks[idxChunk].data.data(), chunks[idxChunk].size))
+		{
+			bConsumerOk = false;
+			std::lock_guard<std::mutex> lock(mutex);
+			bAborted = true;
+		}
+		idxChunk = (idxChunk + 1) % kNbChunks;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			nbFilledChunks--;
+		}
+		chunkConsumedCondition.notify_one();
+		if(!bConsumerOk)
+			break;
+	}
+
+	decompressionThread.join();
+	return bConsumerOk && bDecompressionOk;
+#endif
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Minimal gzip (RFC 1952) / DEFLATE (RFC 1951) decompression, so that datasets can be read from their original .gz files
+// without depending on zlib.
+
+// Called with consecutive chunks of decompressed data. Returns false to abort decompression.
+using GzipDataFunc = std::function<bool(const unsigned char* data, size_t size)>;
+
+// Maximum size of the chunks passed to GzipDataFunc
+const size_t kGzipChunkSize = 64*1024;
+
+// Decompresses a .gz file by chunks: the whole decompressed content is never held in memory.
+// With bBackgroundThread, inflate runs on a second thread while onData() is called on the calling thread,
+// so that decompression of the next chunks overlaps with the processing of the current one.
+// Returns false if the file can't be read, is corrupted (including CRC and size checks) or if onData() aborted.
+bool gunzipFile(const char* strFileName, const GzipDataFunc& onData, bool bBackgroundThread = true);
+
+// Standard CRC-32 (IEEE 802.3, as used by gzip and zip). Start with crc = 0.
+uint32_t updateCrc32(uint32_t crc, const void* data, size_t size);
@@ -0,0 +1,1973 @@
+#include "Kernels.h"
+
+#ifdef KERNELS_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+#endif
+
+// Strict mode relies on a*b+c being computed as 2 rounded operations, never contracted to FMA by the compiler
+#if defined(__clang__)
+	#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+	#pragma GCC optimize("fp-contract=off")
+#endif
+
+Kernels gKernels;
+
+static bool _bKernelsInitialized = initKernels(KernelsMode::Fast);
+
+// ============================== Scalar ==============================
+
+// Reduction order shared by all strict implementations: ((l0+l4)+(l2+l6)) + ((l1+l5)+(l3+l7))
+static float _reduce8(const float lanes[8])
+{
+	const float s0 = lanes[0] + lanes[4];
+	const float s1 = lanes[1] + lanes[5];
+	const float s2 = lanes[2] + lanes[6];
+	const float s3 = lanes[3] + lanes[7];
+	return (s0 + s2) + (s1 + s3);
+}
+
+static float _dotScalar(const float* a, const float* b, int n)
+{
+	float lanes[8] = {0.f};
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		for(int l=0 ; l < 8 ; l++)
+			lanes[l] += a[i+l] * b[i+l];
+	}
+	if(i < n)
+	{
+		for(int l=0 ; l < 8 ; l++)
+			lanes[l] += (i+l < n) ? a[i+l] * b[i+l] : 0.f;	// same as a zero-padded vector load
+	}
+	return _reduce8(lanes);
+}
+
+static void _dot4Scalar(const float* a, const float* b, int bStride, int n, float* out)
+{
+	for(int j=0 ; j < 4 ; j++)
+		out[j] = _dotScalar(a, &b[j*bStride], n);
+}
+
+static void _axpyScalar(float* y, float alpha, const float* x, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		y[i] += alpha * x[i];
+}
+
+static void _u8ToFloatScalar(float* out, const unsigned char* in, float scale, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = (float)in[i] * scale;
+}
+
+static int32_t _dotU8S8Scalar(const uint8_t* a, const int8_t* b, int n)
+{
+	int32_t sum = 0;
+	for(int i=0 ; i < n ; i++)
+		sum += (int32_t)a[i] * b[i];
+	return sum;
+}
+
+static void _dot4U8S8Scalar(const uint8_t* a, const int8_t* b, int bStride, int n, int32_t* out)
+{
+	for(int j=0 ; j < 4 ; j++)
+		out[j] = _dotU8S8Scalar(a, &b[j*bStride], n);
+}
+
+// IEEE half precision <-> float32, rounding to nearest even as F16C does. NaN are made quiet and keep the upper payload bits.
+static float _f16ToFloat(uint16_t h)
+{
+	const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	const uint32_t exponent = (h >> 10) & 0x1F;
+	const uint32_t mantissa = h & 0x3FF;
+	uint32_t bits = 0;
+	if(exponent == 0)
+	{
+		// Zero or subnormal: mantissa * 2^-24, exact in float32
+		const float value = (float)mantissa * 5.9604644775390625e-8f;
+		memcpy(&bits, &value, sizeof(bits));
+		bits |= sign;
+	}
+	else if(exponent == 31)
+		bits = sign | 0x7F800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0);
+	else
+		bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	float value = 0.f;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static uint16_t _floatToF16(float value)
+{
+	uint32_t bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	const uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	uint32_t absBits = bits & 0x7FFFFFFF;
+	if(absBits > 0x7F800000)
+		return sign | 0x7E00 | (uint16_t)((absBits >> 13) & 0x3FF);	// NaN
+	if(absBits >= (uint32_t)(127 + 16) << 23)
+		return sign | 0x7C00;	// 65536 or more: infinity
+	if(absBits < (uint32_t)(127 - 14) << 23)
+	{
+		// Subnormal or zero: adding 0.5 aligns the half mantissa on the low bits, the float addition rounds it to nearest even
+		const uint32_t kMagicBits = (uint32_t)(127 - 15 + 23 - 10 + 1) << 23;
+		float magic = 0.f, absValue = 0.f;
+		memcpy(&magic, &kMagicBits, sizeof(magic));
+		memcpy(&absValue, &absBits, sizeof(absValue));
+		absValue += magic;
+		memcpy(&absBits, &absValue, sizeof(absBits));
+		return sign | (uint16_t)(absBits - kMagicBits);
+	}
+	// Normal: rebias the exponent and round the 13 dropped bits to nearest even. A carry may round up to infinity.
+	const uint32_t mantissaOdd = (absBits >> 13) & 1;
+	absBits += ((uint32_t)(15 - 127) << 23) + 0xFFF + mantissaOdd;
+	return sign | (uint16_t)(absBits >> 13);
+}
+
+// bfloat16 is the upper half of a float32: the conversion to float32 is exact, the other way rounds to nearest even
+static float _bf16ToFloat(uint16_t h)
+{
+	const uint32_t bits = (uint32_t)h << 16;
+	float value = 0.f;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static uint16_t _floatToBF16(float value)
+{
+	uint32_t bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	if((bits & 0x7FFFFFFF) > 0x7F800000)
+		return (uint16_t)((bits >> 16) | 0x40);	// NaN
+	return (uint16_t)((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+}
+
+static void _f16ToFloatScalar(float* out, const uint16_t* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = _f16ToFloat(in[i]);
+}
+
+static void _floatToF16Scalar(uint16_t* out, const float* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = _floatToF16(in[i]);
+}
+
+static void _bf16ToFloatScalar(float* out, const uint16_t* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = _bf16ToFloat(in[i]);
+}
+
+static void _floatToBF16Scalar(uint16_t* out, const float* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = _floatToBF16(in[i]);
+}
+
+// Same lanes as _dotScalar(), a being converted to float32 first
+template<float (*ToFloat)(uint16_t)>
+static float _dotHalfScalar(const uint16_t* a, const float* b, int n)
+{
+	float lanes[8] = {0.f};
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		for(int l=0 ; l < 8 ; l++)
+			lanes[l] += ToFloat(a[i+l]) * b[i+l];
+	}
+	if(i < n)
+	{
+		for(int l=0 ; l < 8 ; l++)
+			lanes[l] += (i+l < n) ? ToFloat(a[i+l]) * b[i+l] : 0.f;
+	}
+	return _reduce8(lanes);
+}
+
+template<float (*ToFloat)(uint16_t)>
+static void _dot4HalfScalar(const uint16_t* a, const float* b, int bStride, int n, float* out)
+{
+	for(int j=0 ; j < 4 ; j++)
+		out[j] = _dotHalfScalar<ToFloat>(a, &b[j*bStride], n);
+}
+
+// Same lanes as _dotScalar(), b being read at the indices
+static float _sparseDotScalar(const float* values, const int32_t* indices, const float* b, int n)
+{
+	float lanes[8] = {0.f};
+	int k = 0;
+	for( ; k + 8 <= n ; k += 8)
+	{
+		for(int l=0 ; l < 8 ; l++)
+			lanes[l] += values[k+l] * b[indices[k+l]];
+	}
+	if(k < n)
+	{
+		for(int l=0 ; l < 8 ; l++)
+			lanes[l] += (k+l < n) ? values[k+l] * b[indices[k+l]] : 0.f;
+	}
+	return _reduce8(lanes);
+}
+
+static void _sparseDot4Scalar(const float* values, const int32_t* indices, const float* b, int bStride, int n, float* out)
+{
+	for(int j=0 ; j < 4 ; j++)
+		out[j] = _sparseDotScalar(values, indices, &b[j*bStride], n);
+}
+
+// Box-Muller polynomials, shared by all paths (Cephes logf, sinf, cosf)
+static const float kSqrtHalf	= 0.70710678f;
+static const float kLogP[9]		= {7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f, -1.2420140846e-1f, 1.4249322787e-1f,
+								   -1.6668057665e-1f, 2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f};
+static const float kLogQ1		= -2.12194440e-4f;
+static const float kLogQ2		= 0.693359375f;
+static const float kHalfPi		= 1.57079632679f;
+static const float kSinP[3]		= {-1.6666654611e-1f, 8.3321608736e-3f, -1.9515295891e-4f};
+static const float kCosP[3]		= {4.166664568298827e-2f, -1.388731625493765e-3f, 2.443315711809948e-5f};
+
+static void _boxMullerScalar(float* out, const float* u1, const float* u2, int nbPairs)
+{
+	for(int i=0 ; i < nbPairs ; i++)
+	{
+		// ln(u1): u1 = m * 2^e, m in [sqrt(0.5);sqrt(2)[
+		uint32_t bits;
+		memcpy(&bits, &u1[i], 4);
+		float e = (float)((int)(bits >> 23) - 126);
+		bits = (bits & 0x007FFFFF) | 0x3F000000;
+		float m;
+		memcpy(&m, &bits, 4);
+		const bool bSmall = m < kSqrtHalf;
+		e = e - (bSmall ? 1.f : 0.f);
+		m = (bSmall ? m + m : m) - 1.f;
+
+		const float z = m * m;
+		float y = kLogP[0];
+		for(int k=1 ; k < 9 ; k++)
+			y = y * m + kLogP[k];
+		y = (y * m) * z;
+		y = y + kLogQ1 * e;
+		y = y + -0.5f * z;
+		const float logU1 = (m + y) + kLogQ2 * e;
+		const float r = sqrtf(-2.f * logU1);
+
+		// sin/cos(2 pi u2): quadrant q and x in [-pi/4;pi/4], angle = x + q*pi/2
+		const float quadrants = u2[i] * 4.f;
+		const int roundedQuadrants = (int)(quadrants + 0.5f);
+		const float x = (quadrants - (float)roundedQuadrants) * kHalfPi;
+		const float x2 = x * x;
+		const float sinX = x + (x * x2) * (kSinP[0] + x2 * (kSinP[1] + x2 * kSinP[2]));
+		const float cosX = (1.f - 0.5f * x2) + (x2 * x2) * (kCosP[0] + x2 * (kCosP[1] + x2 * kCosP[2]));
+
+		const bool bSwap = (roundedQuadrants & 1) != 0;
+		float s = bSwap ? cosX : sinX;
+		float c = bSwap ? sinX : cosX;
+		s = (roundedQuadrants & 2) ? -s : s;
+		c = ((roundedQuadrants + 1) & 2) ? -c : c;
+
+		out[2*i] = r * c;
+		out[2*i+1] = r * s;
+	}
+}
+
+// Sigmoid approximations, shared by all paths.
+// Polynomial: exp(t) = 2^n * exp(r), t = n ln2 + r, |r| <= ln2/2, exp(r) by the Cephes expf polynomial.
+// t is clamped so that 2^n stays a normal float: sigmoid is then within 1e-38 of 0 or 1.
+static const float kExpMax		= 88.f;
+static const float kLog2e		= 1.44269504089f;
+static const float kExpP[6]		= {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f, 4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+// Rational: sigmoid(x) = 0.5 + 0.5 tanh(x/2), tanh(y) = y P(y^2) / Q(y^2) (Eigen ptanh), clamped where tanh rounds to +-1
+static const float kTanhMax		= 7.90531110763549805f;
+static const float kTanhP[7]	= {-2.76076847742355e-16f, 2.00018790482477e-13f, -8.60467152213735e-11f, 5.12229709037114e-08f,
+								   1.48572235717979e-05f, 6.37261928875436e-04f, 4.89352455891786e-03f};
+static const float kTanhQ[4]	= {1.19825839466702e-06f, 1.18534705686654e-04f, 2.26843463243900e-03f, 4.89352518554385e-03f};
+
+static void _sigmoidExact(float* out, const float* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = 1.f / (1.f + expf(-in[i]));
+}
+
+static float _expPolynomial(float x)
+{
+	const float t = std::min(kExpMax, std::max(-kExpMax, x));
+	const float fn = floorf(t * kLog2e + 0.5f);
+	const float r = (t - fn * kLogQ2) - fn * kLogQ1;	// ln2 split in 2 parts, as for the logarithm
+	float p = kExpP[0];
+	for(int k=1 ; k < 6 ; k++)
+		p = p * r + kExpP[k];
+	const float expR = (p * (r * r) + r) + 1.f;
+	const uint32_t bits = (uint32_t)((int)fn + 127) << 23;
+	float pow2n;
+	memcpy(&pow2n, &bits, 4);
+	return expR * pow2n;
+}
+
+static void _sigmoidPolynomialScalar(float* out, const float* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = 1.f / (1.f + _expPolynomial(-in[i]));
+}
+
+static void _expExact(float* out, const float* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = expf(in[i]);
+}
+
+static void _expPolynomialScalar(float* out, const float* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = _expPolynomial(in[i]);
+}
+
+static float _tanhRational(float x)
+{
+	const float y = std::min(kTanhMax, std::max(-kTanhMax, x));
+	const float y2 = y * y;
+	float p = kTanhP[0];
+	for(int k=1 ; k < 7 ; k++)
+		p = p * y2 + kTanhP[k];
+	float q = kTanhQ[0];
+	for(int k=1 ; k < 4 ; k++)
+		q = q * y2 + kTanhQ[k];
+	return (y * p) / q;
+}
+
+static void _sigmoidRationalScalar(float* out, const float* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+	{
+		const float s = 0.5f + 0.5f * _tanhRational(0.5f * in[i]);
+		out[i] = std::min(1.f, std::max(0.f, s));	// so that a * (1-a) >= 0
+	}
+}
+
+static void _tanhExact(float* out, const float* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = tanhf(in[i]);
+}
+
+static void _tanhRationalScalar(float* out, const float* in, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = std::min(1.f, std::max(-1.f, _tanhRational(in[i])));	// so that 1 - a^2 >= 0
+}
+
+static void _reluScalar(float* out, const float* in, float negativeSlope, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		out[i] = in[i] > 0.f ? in[i] : negativeSlope * in[i];
+}
+
+static void _mulSigmoidDerivativeScalar(float* delta, const float* a, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		delta[i] = delta[i] * (a[i] * (1.f - a[i]));
+}
+
+static void _mulTanhDerivativeScalar(float* delta, const float* a, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		delta[i] = delta[i] * (1.f - a[i] * a[i]);
+}
+
+static void _mulReluDerivativeScalar(float* delta, const float* a, float negativeSlope, int n)
+{
+	for(int i=0 ; i < n ; i++)
+		delta[i] = a[i] > 0.f ? delta[i] : negativeSlope * delta[i];
+}
+
+#ifdef KERNELS_X86
+
+// ============================== SSE4.2 ==============================
+// Two 4-wide accumulators = the 8 strict lanes, so this path is always strict.
+
+KERNELS_TARGET_SSE42
+static float _reduce8SSE(__m128 lanes0123, __m128 lanes4567)
+{
+	const __m128 s = _mm_add_ps(lanes0123, lanes4567);		// s0 s1 s2 s3
+	const __m128 t = _mm_add_ps(s, _mm_movehl_ps(s, s));	// s0+s2 s1+s3
+	return _mm_cvtss_f32(_mm_add_ss(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1,1,1,1))));
+}
+
+KERNELS_TARGET_SSE42
+static float _dotSSE42(const float* a, const float* b, int n)
+{
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i])));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(&a[i+4]), _mm_loadu_ps(&b[i+4])));
+	}
+	if(i < n)
+	{
+		float tailA[8] = {0.f};
+		float tailB[8] = {0.f};
+		for(int l=0 ; i+l < n ; l++)
+		{
+			tailA[l] = a[i+l];
+			tailB[l] = b[i+l];
+		}
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(&tailA[0]), _mm_loadu_ps(&tailB[0])));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(&tailA[4]), _mm_loadu_ps(&tailB[4])));
+	}
+	return _reduce8SSE(acc0, acc1);
+}
+
+KERNELS_TARGET_SSE42
+static void _dot4SSE42(const float* a, const float* b, int bStride, int n, float* out)
+{
+	for(int j=0 ; j < 4 ; j++)
+		out[j] = _dotSSE42(a, &b[j*bStride], n);
+}
+
+KERNELS_TARGET_SSE42
+static void _axpySSE42(float* y, float alpha, const float* x, int n)
+{
+	const __m128 vAlpha = _mm_set1_ps(alpha);
+	int i = 0;
+	for( ; i + 4 <= n ; i += 4)
+		_mm_storeu_ps(&y[i], _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(vAlpha, _mm_loadu_ps(&x[i]))));
+	for( ; i < n ; i++)
+		y[i] += alpha * x[i];
+}
+
+KERNELS_TARGET_SSE42
+static void _u8ToFloatSSE42(float* out, const unsigned char* in, float scale, int n)
+{
+	const __m128 vScale = _mm_set1_ps(scale);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m128i bytes = _mm_loadu_si128((const __m128i*)&in[i]);
+		_mm_storeu_ps(&out[i+0],  _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes)), vScale));
+		_mm_storeu_ps(&out[i+4],  _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4))), vScale));
+		_mm_storeu_ps(&out[i+8],  _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 8))), vScale));
+		_mm_storeu_ps(&out[i+12], _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 12))), vScale));
+	}
+	for( ; i < n ; i++)
+		out[i] = (float)in[i] * scale;
+}
+
+KERNELS_TARGET_SSE42
+static int32_t _reduceEpi32SSE(__m128i lanes)
+{
+	const __m128i s = _mm_add_epi32(lanes, _mm_shuffle_epi32(lanes, _MM_SHUFFLE(1,0,3,2)));
+	return _mm_cvtsi128_si32(_mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2,3,0,1))));
+}
+
+KERNELS_TARGET_SSE42
+static void _dot4U8S8SSE42(const uint8_t* a, const int8_t* b, int bStride, int n, int32_t* out)
+{
+	const int8_t* b0 = &b[0*bStride];
+	const int8_t* b1 = &b[1*bStride];
+	const int8_t* b2 = &b[2*bStride];
+	const int8_t* b3 = &b[3*bStride];
+	__m128i acc0 = _mm_setzero_si128();
+	__m128i acc1 = _mm_setzero_si128();
+	__m128i acc2 = _mm_setzero_si128();
+	__m128i acc3 = _mm_setzero_si128();
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m128i va = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)&a[i]));
+		acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(va, _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)&b0[i]))));
+		acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(va, _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)&b1[i]))));
+		acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(va, _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)&b2[i]))));
+		acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(va, _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)&b3[i]))));
+	}
+	out[0] = _reduceEpi32SSE(acc0) + _dotU8S8Scalar(&a[i], &b0[i], n - i);
+	out[1] = _reduceEpi32SSE(acc1) + _dotU8S8Scalar(&a[i], &b1[i], n - i);
+	out[2] = _reduceEpi32SSE(acc2) + _dotU8S8Scalar(&a[i], &b2[i], n - i);
+	out[3] = _reduceEpi32SSE(acc3) + _dotU8S8Scalar(&a[i], &b3[i], n - i);
+}
+
+KERNELS_TARGET_SSE42
+static void _boxMullerSSE42(float* out, const float* u1, const float* u2, int nbPairs)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 4 <= nbPairs ; i += 4)
+	{
+		const __m128i bits = _mm_castps_si128(_mm_loadu_ps(&u1[i]));
+		__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+		__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F000000)));
+		const __m128 smallMask = _mm_cmplt_ps(m, _mm_set1_ps(kSqrtHalf));
+		e = _mm_sub_ps(e, _mm_and_ps(smallMask, one));
+		m = _mm_sub_ps(_mm_blendv_ps(m, _mm_add_ps(m, m), smallMask), one);
+
+		const __m128 z = _mm_mul_ps(m, m);
+		__m128 y = _mm_set1_ps(kLogP[0]);
+		for(int k=1 ; k < 9 ; k++)
+			y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(kLogP[k]));
+		y = _mm_mul_ps(_mm_mul_ps(y, m), z);
+		y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(kLogQ1), e));
+		y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(-0.5f), z));
+		const __m128 logU1 = _mm_add_ps(_mm_add_ps(m, y), _mm_mul_ps(_mm_set1_ps(kLogQ2), e));
+		const __m128 r = _mm_sqrt_ps(_mm_mul_ps(_mm_set1_ps(-2.f), logU1));
+
+		const __m128 quadrants = _mm_mul_ps(_mm_loadu_ps(&u2[i]), _mm_set1_ps(4.f));
+		const __m128i roundedQuadrants = _mm_cvttps_epi32(_mm_add_ps(quadrants, _mm_set1_ps(0.5f)));
+		const __m128 x = _mm_mul_ps(_mm_sub_ps(quadrants, _mm_cvtepi32_ps(roundedQuadrants)), _mm_set1_ps(kHalfPi));
+		const __m128 x2 = _mm_mul_ps(x, x);
+		const __m128 sinX = _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(x, x2),
+			_mm_add_ps(_mm_set1_ps(kSinP[0]), _mm_mul_ps(x2, _mm_add_ps(_mm_set1_ps(kSinP[1]), _mm_mul_ps(x2, _mm_set1_ps(kSinP[2])))))));
+		const __m128 cosX = _mm_add_ps(_mm_sub_ps(one, _mm_mul_ps(_mm_set1_ps(0.5f), x2)), _mm_mul_ps(_mm_mul_ps(x2, x2),
+			_mm_add_ps(_mm_set1_ps(kCosP[0]), _mm_mul_ps(x2, _mm_add_ps(_mm_set1_ps(kCosP[1]), _mm_mul_ps(x2, _mm_set1_ps(kCosP[2])))))));
+
+		const __m128 swapMask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(roundedQuadrants, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+		const __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(roundedQuadrants, _mm_set1_epi32(2)), 30));
+		const __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(roundedQuadrants, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+		const __m128 s = _mm_xor_ps(_mm_blendv_ps(sinX, cosX, swapMask), sinSign);
+		const __m128 c = _mm_xor_ps(_mm_blendv_ps(cosX, sinX, swapMask), cosSign);
+
+		const __m128 rc = _mm_mul_ps(r, c);
+		const __m128 rs = _mm_mul_ps(r, s);
+		_mm_storeu_ps(&out[2*i], _mm_unpacklo_ps(rc, rs));
+		_mm_storeu_ps(&out[2*i+4], _mm_unpackhi_ps(rc, rs));
+	}
+	_boxMullerScalar(&out[2*i], &u1[i], &u2[i], nbPairs - i);
+}
+
+KERNELS_TARGET_SSE42
+static __m128 _expPolynomialVectorSSE42(__m128 x)
+{
+	const __m128 t = _mm_min_ps(_mm_set1_ps(kExpMax), _mm_max_ps(_mm_set1_ps(-kExpMax), x));
+	const __m128 fn = _mm_floor_ps(_mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(kLog2e)), _mm_set1_ps(0.5f)));
+	const __m128 r = _mm_sub_ps(_mm_sub_ps(t, _mm_mul_ps(fn, _mm_set1_ps(kLogQ2))), _mm_mul_ps(fn, _mm_set1_ps(kLogQ1)));
+	__m128 p = _mm_set1_ps(kExpP[0]);
+	for(int k=1 ; k < 6 ; k++)
+		p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(kExpP[k]));
+	const __m128 expR = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), r), _mm_set1_ps(1.f));
+	const __m128 pow2n = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(fn), _mm_set1_epi32(127)), 23));
+	return _mm_mul_ps(expR, pow2n);
+}
+
+KERNELS_TARGET_SSE42
+static void _sigmoidPolynomialSSE42(float* out, const float* in, int n)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 4 <= n ; i += 4)
+		_mm_storeu_ps(&out[i], _mm_div_ps(one, _mm_add_ps(one, _expPolynomialVectorSSE42(_mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&in[i]))))));
+	_sigmoidPolynomialScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_SSE42
+static void _expPolynomialSSE42(float* out, const float* in, int n)
+{
+	int i = 0;
+	for( ; i + 4 <= n ; i += 4)
+		_mm_storeu_ps(&out[i], _expPolynomialVectorSSE42(_mm_loadu_ps(&in[i])));
+	_expPolynomialScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_SSE42
+static __m128 _tanhRationalVectorSSE42(__m128 x)
+{
+	const __m128 y = _mm_min_ps(_mm_set1_ps(kTanhMax), _mm_max_ps(_mm_set1_ps(-kTanhMax), x));
+	const __m128 y2 = _mm_mul_ps(y, y);
+	__m128 p = _mm_set1_ps(kTanhP[0]);
+	for(int k=1 ; k < 7 ; k++)
+		p = _mm_add_ps(_mm_mul_ps(p, y2), _mm_set1_ps(kTanhP[k]));
+	__m128 q = _mm_set1_ps(kTanhQ[0]);
+	for(int k=1 ; k < 4 ; k++)
+		q = _mm_add_ps(_mm_mul_ps(q, y2), _mm_set1_ps(kTanhQ[k]));
+	return _mm_div_ps(_mm_mul_ps(y, p), q);
+}
+
+KERNELS_TARGET_SSE42
+static void _sigmoidRationalSSE42(float* out, const float* in, int n)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	int i = 0;
+	for( ; i + 4 <= n ; i += 4)
+	{
+		const __m128 s = _mm_add_ps(half, _mm_mul_ps(half, _tanhRationalVectorSSE42(_mm_mul_ps(half, _mm_loadu_ps(&in[i])))));
+		_mm_storeu_ps(&out[i], _mm_min_ps(_mm_set1_ps(1.f), _mm_max_ps(_mm_setzero_ps(), s)));
+	}
+	_sigmoidRationalScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_SSE42
+static void _tanhRationalSSE42(float* out, const float* in, int n)
+{
+	int i = 0;
+	for( ; i + 4 <= n ; i += 4)
+		_mm_storeu_ps(&out[i], _mm_min_ps(_mm_set1_ps(1.f), _mm_max_ps(_mm_set1_ps(-1.f), _tanhRationalVectorSSE42(_mm_loadu_ps(&in[i])))));
+	_tanhRationalScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_SSE42
+static void _reluSSE42(float* out, const float* in, float negativeSlope, int n)
+{
+	const __m128 vSlope = _mm_set1_ps(negativeSlope);
+	int i = 0;
+	for( ; i + 4 <= n ; i += 4)
+	{
+		const __m128 x = _mm_loadu_ps(&in[i]);
+		_mm_storeu_ps(&out[i], _mm_blendv_ps(_mm_mul_ps(vSlope, x), x, _mm_cmpgt_ps(x, _mm_setzero_ps())));
+	}
+	_reluScalar(&out[i], &in[i], negativeSlope, n - i);
+}
+
+KERNELS_TARGET_SSE42
+static void _mulSigmoidDerivativeSSE42(float* delta, const float* a, int n)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 4 <= n ; i += 4)
+	{
+		const __m128 va = _mm_loadu_ps(&a[i]);
+		_mm_storeu_ps(&delta[i], _mm_mul_ps(_mm_loadu_ps(&delta[i]), _mm_mul_ps(va, _mm_sub_ps(one, va))));
+	}
+	_mulSigmoidDerivativeScalar(&delta[i], &a[i], n - i);
+}
+
+KERNELS_TARGET_SSE42
+static void _mulTanhDerivativeSSE42(float* delta, const float* a, int n)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 4 <= n ; i += 4)
+	{
+		const __m128 va = _mm_loadu_ps(&a[i]);
+		_mm_storeu_ps(&delta[i], _mm_mul_ps(_mm_loadu_ps(&delta[i]), _mm_sub_ps(one, _mm_mul_ps(va, va))));
+	}
+	_mulTanhDerivativeScalar(&delta[i], &a[i], n - i);
+}
+
+KERNELS_TARGET_SSE42
+static void _mulReluDerivativeSSE42(float* delta, const float* a, float negativeSlope, int n)
+{
+	const __m128 vSlope = _mm_set1_ps(negativeSlope);
+	int i = 0;
+	for( ; i + 4 <= n ; i += 4)
+	{
+		const __m128 d = _mm_loadu_ps(&delta[i]);
+		_mm_storeu_ps(&delta[i], _mm_blendv_ps(_mm_mul_ps(vSlope, d), d, _mm_cmpgt_ps(_mm_loadu_ps(&a[i]), _mm_setzero_ps())));
+	}
+	_mulReluDerivativeScalar(&delta[i], &a[i], negativeSlope, n - i);
+}
+
+// ============================== AVX2 ==============================
+
+// Mask to load the first n (< 8) floats of a vector with _mm256_maskload_ps()
+KERNELS_TARGET_AVX2
+static __m256i _tailMaskAVX2(int n)
+{
+	static const int s_maskTable[16] = {-1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+	return _mm256_loadu_si256((const __m256i*)&s_maskTable[8 - n]);
+}
+
+KERNELS_TARGET_AVX2
+static float _reduce8AVX2(__m256 lanes)
+{
+	return _reduce8SSE(_mm256_castps256_ps128(lanes), _mm256_extractf128_ps(lanes, 1));
+}
+
+KERNELS_TARGET_AVX2
+static float _dotAVX2Strict(const float* a, const float* b, int n)
+{
+	__m256 acc = _mm256_setzero_ps();
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i])));
+	if(i < n)
+	{
+		const __m256i mask = _tailMaskAVX2(n - i);
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_maskload_ps(&a[i], mask), _mm256_maskload_ps(&b[i], mask)));
+	}
+	return _reduce8AVX2(acc);
+}
+
+KERNELS_TARGET_AVX2
+static void _dot4AVX2Strict(const float* a, const float* b, int bStride, int n, float* out)
+{
+	const float* b0 = &b[0*bStride];
+	const float* b1 = &b[1*bStride];
+	const float* b2 = &b[2*bStride];
+	const float* b3 = &b[3*bStride];
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m256 va = _mm256_loadu_ps(&a[i]);
+		acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(va, _mm256_loadu_ps(&b0[i])));
+		acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(va, _mm256_loadu_ps(&b1[i])));
+		acc2 = _mm256_add_ps(acc2, _mm256_mul_ps(va, _mm256_loadu_ps(&b2[i])));
+		acc3 = _mm256_add_ps(acc3, _mm256_mul_ps(va, _mm256_loadu_ps(&b3[i])));
+	}
+	if(i < n)
+	{
+		const __m256i mask = _tailMaskAVX2(n - i);
+		const __m256 va = _mm256_maskload_ps(&a[i], mask);
+		acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(va, _mm256_maskload_ps(&b0[i], mask)));
+		acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(va, _mm256_maskload_ps(&b1[i], mask)));
+		acc2 = _mm256_add_ps(acc2, _mm256_mul_ps(va, _mm256_maskload_ps(&b2[i], mask)));
+		acc3 = _mm256_add_ps(acc3, _mm256_mul_ps(va, _mm256_maskload_ps(&b3[i], mask)));
+	}
+	out[0] = _reduce8AVX2(acc0);
+	out[1] = _reduce8AVX2(acc1);
+	out[2] = _reduce8AVX2(acc2);
+	out[3] = _reduce8AVX2(acc3);
+}
+
+KERNELS_TARGET_AVX2
+static void _axpyAVX2Strict(float* y, float alpha, const float* x, int n)
+{
+	const __m256 vAlpha = _mm256_set1_ps(alpha);
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		_mm256_storeu_ps(&y[i], _mm256_add_ps(_mm256_loadu_ps(&y[i]), _mm256_mul_ps(vAlpha, _mm256_loadu_ps(&x[i]))));
+	for( ; i < n ; i++)
+		y[i] += alpha * x[i];
+}
+
+KERNELS_TARGET_AVX2
+static float _dotAVX2(const float* a, const float* b, int n)
+{
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i+8]), _mm256_loadu_ps(&b[i+8]), acc1);
+	}
+	for( ; i + 8 <= n ; i += 8)
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]), acc0);
+	if(i < n)
+	{
+		const __m256i mask = _tailMaskAVX2(n - i);
+		acc1 = _mm256_fmadd_ps(_mm256_maskload_ps(&a[i], mask), _mm256_maskload_ps(&b[i], mask), acc1);
+	}
+	return _reduce8AVX2(_mm256_add_ps(acc0, acc1));
+}
+
+KERNELS_TARGET_AVX2
+static void _dot4AVX2(const float* a, const float* b, int bStride, int n, float* out)
+{
+	const float* b0 = &b[0*bStride];
+	const float* b1 = &b[1*bStride];
+	const float* b2 = &b[2*bStride];
+	const float* b3 = &b[3*bStride];
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m256 va = _mm256_loadu_ps(&a[i]);
+		acc0 = _mm256_fmadd_ps(va, _mm256_loadu_ps(&b0[i]), acc0);
+		acc1 = _mm256_fmadd_ps(va, _mm256_loadu_ps(&b1[i]), acc1);
+		acc2 = _mm256_fmadd_ps(va, _mm256_loadu_ps(&b2[i]), acc2);
+		acc3 = _mm256_fmadd_ps(va, _mm256_loadu_ps(&b3[i]), acc3);
+	}
+	if(i < n)
+	{
+		const __m256i mask = _tailMaskAVX2(n - i);
+		const __m256 va = _mm256_maskload_ps(&a[i], mask);
+		acc0 = _mm256_fmadd_ps(va, _mm256_maskload_ps(&b0[i], mask), acc0);
+		acc1 = _mm256_fmadd_ps(va, _mm256_maskload_ps(&b1[i], mask), acc1);
+		acc2 = _mm256_fmadd_ps(va, _mm256_maskload_ps(&b2[i], mask), acc2);
+		acc3 = _mm256_fmadd_ps(va, _mm256_maskload_ps(&b3[i], mask), acc3);
+	}
+	out[0] = _reduce8AVX2(acc0);
+	out[1] = _reduce8AVX2(acc1);
+	out[2] = _reduce8AVX2(acc2);
+	out[3] = _reduce8AVX2(acc3);
+}
+
+KERNELS_TARGET_AVX2
+static void _axpyAVX2(float* y, float alpha, const float* x, int n)
+{
+	const __m256 vAlpha = _mm256_set1_ps(alpha);
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		_mm256_storeu_ps(&y[i], _mm256_fmadd_ps(vAlpha, _mm256_loadu_ps(&x[i]), _mm256_loadu_ps(&y[i])));
+	if(i < n)
+	{
+		const __m256i mask = _tailMaskAVX2(n - i);
+		_mm256_maskstore_ps(&y[i], mask, _mm256_fmadd_ps(vAlpha, _mm256_maskload_ps(&x[i], mask), _mm256_maskload_ps(&y[i], mask)));
+	}
+}
+
+KERNELS_TARGET_AVX2
+static void _u8ToFloatAVX2(float* out, const unsigned char* in, float scale, int n)
+{
+	const __m256 vScale = _mm256_set1_ps(scale);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m128i bytes = _mm_loadu_si128((const __m128i*)&in[i]);
+		_mm256_storeu_ps(&out[i+0], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)), vScale));
+		_mm256_storeu_ps(&out[i+8], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8))), vScale));
+	}
+	for( ; i < n ; i++)
+		out[i] = (float)in[i] * scale;
+}
+
+KERNELS_TARGET_AVX2
+static int32_t _reduceEpi32AVX2(__m256i lanes)
+{
+	const __m128i s = _mm_add_epi32(_mm256_castsi256_si128(lanes), _mm256_extracti128_si256(lanes, 1));
+	const __m128i t = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1,0,3,2)));
+	return _mm_cvtsi128_si32(_mm_add_epi32(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(2,3,0,1))));
+}
+
+// 16 products per row and iteration: uint8 and int8 are widened to int16, and pmaddwd sums them by pairs into int32
+KERNELS_TARGET_AVX2
+static void _dot4U8S8AVX2(const uint8_t* a, const int8_t* b, int bStride, int n, int32_t* out)
+{
+	const int8_t* b0 = &b[0*bStride];
+	const int8_t* b1 = &b[1*bStride];
+	const int8_t* b2 = &b[2*bStride];
+	const int8_t* b3 = &b[3*bStride];
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	__m256i acc2 = _mm256_setzero_si256();
+	__m256i acc3 = _mm256_setzero_si256();
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)&a[i]));
+		acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(va, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)&b0[i]))));
+		acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(va, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)&b1[i]))));
+		acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(va, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)&b2[i]))));
+		acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(va, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)&b3[i]))));
+	}
+	out[0] = _reduceEpi32AVX2(acc0) + _dotU8S8Scalar(&a[i], &b0[i], n - i);
+	out[1] = _reduceEpi32AVX2(acc1) + _dotU8S8Scalar(&a[i], &b1[i], n - i);
+	out[2] = _reduceEpi32AVX2(acc2) + _dotU8S8Scalar(&a[i], &b2[i], n - i);
+	out[3] = _reduceEpi32AVX2(acc3) + _dotU8S8Scalar(&a[i], &b3[i], n - i);
+}
+
+// 8 fp16 or bf16 values to float32. bf16 only needs a shift, F16C converts fp16.
+template<bool bBF16>
+KERNELS_TARGET_AVX2 KERNELS_FORCE_INLINE
+static __m256 _loadHalfAVX2(const uint16_t* p)
+{
+	const __m128i h = _mm_loadu_si128((const __m128i*)p);
+	if constexpr(bBF16)
+		return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+	else
+		return _mm256_cvtph_ps(h);
+}
+
+// Last n (< 8) values, zero padded: there are no masked 16-bit loads before AVX-512BW
+template<bool bBF16>
+KERNELS_TARGET_AVX2 KERNELS_FORCE_INLINE
+static __m256 _loadHalfTailAVX2(const uint16_t* p, int n)
+{
+	alignas(16) uint16_t values[8] = {};
+	memcpy(values, p, n * sizeof(uint16_t));
+	return _loadHalfAVX2<bBF16>(values);
+}
+
+// Strict mode: same operations as _dotAVX2Strict() on the converted values, fast mode: FMA
+template<bool bStrict>
+KERNELS_TARGET_AVX2 KERNELS_FORCE_INLINE
+static __m256 _multiplyAddAVX2(__m256 a, __m256 b, __m256 acc)
+{
+	if constexpr(bStrict)
+		return _mm256_add_ps(acc, _mm256_mul_ps(a, b));
+	else
+		return _mm256_fmadd_ps(a, b, acc);
+}
+
+template<bool bBF16, bool bStrict>
+KERNELS_TARGET_AVX2
+static float _dotHalfAVX2(const uint16_t* a, const float* b, int n)
+{
+	__m256 acc = _mm256_setzero_ps();
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		acc = _multiplyAddAVX2<bStrict>(_loadHalfAVX2<bBF16>(&a[i]), _mm256_loadu_ps(&b[i]), acc);
+	if(i < n)
+		acc = _multiplyAddAVX2<bStrict>(_loadHalfTailAVX2<bBF16>(&a[i], n - i), _mm256_maskload_ps(&b[i], _tailMaskAVX2(n - i)), acc);
+	return _reduce8AVX2(acc);
+}
+
+template<bool bBF16, bool bStrict>
+KERNELS_TARGET_AVX2
+static void _dot4HalfAVX2(const uint16_t* a, const float* b, int bStride, int n, float* out)
+{
+	const float* b0 = &b[0*bStride];
+	const float* b1 = &b[1*bStride];
+	const float* b2 = &b[2*bStride];
+	const float* b3 = &b[3*bStride];
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m256 va = _loadHalfAVX2<bBF16>(&a[i]);
+		acc0 = _multiplyAddAVX2<bStrict>(va, _mm256_loadu_ps(&b0[i]), acc0);
+		acc1 = _multiplyAddAVX2<bStrict>(va, _mm256_loadu_ps(&b1[i]), acc1);
+		acc2 = _multiplyAddAVX2<bStrict>(va, _mm256_loadu_ps(&b2[i]), acc2);
+		acc3 = _multiplyAddAVX2<bStrict>(va, _mm256_loadu_ps(&b3[i]), acc3);
+	}
+	if(i < n)
+	{
+		const __m256i mask = _tailMaskAVX2(n - i);
+		const __m256 va = _loadHalfTailAVX2<bBF16>(&a[i], n - i);
+		acc0 = _multiplyAddAVX2<bStrict>(va, _mm256_maskload_ps(&b0[i], mask), acc0);
+		acc1 = _multiplyAddAVX2<bStrict>(va, _mm256_maskload_ps(&b1[i], mask), acc1);
+		acc2 = _multiplyAddAVX2<bStrict>(va, _mm256_maskload_ps(&b2[i], mask), acc2);
+		acc3 = _multiplyAddAVX2<bStrict>(va, _mm256_maskload_ps(&b3[i], mask), acc3);
+	}
+	out[0] = _reduce8AVX2(acc0);
+	out[1] = _reduce8AVX2(acc1);
+	out[2] = _reduce8AVX2(acc2);
+	out[3] = _reduce8AVX2(acc3);
+}
+
+template<bool bStrict>
+KERNELS_TARGET_AVX2
+static float _sparseDotAVX2(const float* values, const int32_t* indices, const float* b, int n)
+{
+	__m256 acc = _mm256_setzero_ps();
+	int k = 0;
+	for( ; k + 8 <= n ; k += 8)
+	{
+		const __m256 vb = _mm256_i32gather_ps(b, _mm256_loadu_si256((const __m256i*)&indices[k]), 4);
+		acc = _multiplyAddAVX2<bStrict>(_mm256_loadu_ps(&values[k]), vb, acc);
+	}
+	if(k < n)
+	{
+		// Masked lanes are neither loaded nor gathered
+		const __m256i mask = _tailMaskAVX2(n - k);
+		const __m256 vb = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), b, _mm256_maskload_epi32(&indices[k], mask), _mm256_castsi256_ps(mask), 4);
+		acc = _multiplyAddAVX2<bStrict>(_mm256_maskload_ps(&values[k], mask), vb, acc);
+	}
+	return _reduce8AVX2(acc);
+}
+
+template<bool bStrict>
+KERNELS_TARGET_AVX2
+static void _sparseDot4AVX2(const float* values, const int32_t* indices, const float* b, int bStride, int n, float* out)
+{
+	const float* b0 = &b[0*bStride];
+	const float* b1 = &b[1*bStride];
+	const float* b2 = &b[2*bStride];
+	const float* b3 = &b[3*bStride];
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+	int k = 0;
+	for( ; k + 8 <= n ; k += 8)
+	{
+		const __m256 va = _mm256_loadu_ps(&values[k]);
+		const __m256i vIndices = _mm256_loadu_si256((const __m256i*)&indices[k]);
+		acc0 = _multiplyAddAVX2<bStrict>(va, _mm256_i32gather_ps(b0, vIndices, 4), acc0);
+		acc1 = _multiplyAddAVX2<bStrict>(va, _mm256_i32gather_ps(b1, vIndices, 4), acc1);
+		acc2 = _multiplyAddAVX2<bStrict>(va, _mm256_i32gather_ps(b2, vIndices, 4), acc2);
+		acc3 = _multiplyAddAVX2<bStrict>(va, _mm256_i32gather_ps(b3, vIndices, 4), acc3);
+	}
+	if(k < n)
+	{
+		const __m256i mask = _tailMaskAVX2(n - k);
+		const __m256 vMask = _mm256_castsi256_ps(mask);
+		const __m256 va = _mm256_maskload_ps(&values[k], mask);
+		const __m256i vIndices = _mm256_maskload_epi32(&indices[k], mask);
+		acc0 = _multiplyAddAVX2<bStrict>(va, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), b0, vIndices, vMask, 4), acc0);
+		acc1 = _multiplyAddAVX2<bStrict>(va, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), b1, vIndices, vMask, 4), acc1);
+		acc2 = _multiplyAddAVX2<bStrict>(va, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), b2, vIndices, vMask, 4), acc2);
+		acc3 = _multiplyAddAVX2<bStrict>(va, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), b3, vIndices, vMask, 4), acc3);
+	}
+	out[0] = _reduce8AVX2(acc0);
+	out[1] = _reduce8AVX2(acc1);
+	out[2] = _reduce8AVX2(acc2);
+	out[3] = _reduce8AVX2(acc3);
+}
+
+KERNELS_TARGET_AVX2
+static void _f16ToFloatAVX2(float* out, const uint16_t* in, int n)
+{
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		_mm256_storeu_ps(&out[i], _loadHalfAVX2<false>(&in[i]));
+	for( ; i < n ; i++)
+		out[i] = _f16ToFloat(in[i]);
+}
+
+KERNELS_TARGET_AVX2
+static void _floatToF16AVX2(uint16_t* out, const float* in, int n)
+{
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		_mm_storeu_si128((__m128i*)&out[i], _mm256_cvtps_ph(_mm256_loadu_ps(&in[i]), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+	for( ; i < n ; i++)
+		out[i] = _floatToF16(in[i]);
+}
+
+KERNELS_TARGET_AVX2
+static void _bf16ToFloatAVX2(float* out, const uint16_t* in, int n)
+{
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		_mm256_storeu_ps(&out[i], _loadHalfAVX2<true>(&in[i]));
+	for( ; i < n ; i++)
+		out[i] = _bf16ToFloat(in[i]);
+}
+
+// Integer version of _floatToBF16()
+KERNELS_TARGET_AVX2
+static void _floatToBF16AVX2(uint16_t* out, const float* in, int n)
+{
+	const __m256i vAbsMask = _mm256_set1_epi32(0x7FFFFFFF);
+	const __m256i vInfinity = _mm256_set1_epi32(0x7F800000);
+	const __m256i vRoundingBias = _mm256_set1_epi32(0x7FFF);
+	const __m256i vOne = _mm256_set1_epi32(1);
+	const __m256i vQuietBit = _mm256_set1_epi32(0x40);
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(&in[i]));
+		const __m256i high = _mm256_srli_epi32(bits, 16);
+		const __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(vRoundingBias, _mm256_and_si256(high, vOne))), 16);
+		const __m256i bNaN = _mm256_cmpgt_epi32(_mm256_and_si256(bits, vAbsMask), vInfinity);
+		const __m256i result = _mm256_blendv_epi8(rounded, _mm256_or_si256(high, vQuietBit), bNaN);
+		// Values fit in 16 bits: pack the 2 lanes and put them back in order
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(result, result), _MM_SHUFFLE(3,1,2,0));
+		_mm_storeu_si128((__m128i*)&out[i], _mm256_castsi256_si128(packed));
+	}
+	for( ; i < n ; i++)
+		out[i] = _floatToBF16(in[i]);
+}
+
+KERNELS_TARGET_AVX2
+static void _boxMullerAVX2(float* out, const float* u1, const float* u2, int nbPairs)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 8 <= nbPairs ; i += 8)
+	{
+		const __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(&u1[i]));
+		__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+		__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F000000)));
+		const __m256 smallMask = _mm256_cmp_ps(m, _mm256_set1_ps(kSqrtHalf), _CMP_LT_OQ);
+		e = _mm256_sub_ps(e, _mm256_and_ps(smallMask, one));
+		m = _mm256_sub_ps(_mm256_blendv_ps(m, _mm256_add_ps(m, m), smallMask), one);
+
+		const __m256 z = _mm256_mul_ps(m, m);
+		__m256 y = _mm256_set1_ps(kLogP[0]);
+		for(int k=1 ; k < 9 ; k++)
+			y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(kLogP[k]));
+		y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+		y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_set1_ps(kLogQ1), e));
+		y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_set1_ps(-0.5f), z));
+		const __m256 logU1 = _mm256_add_ps(_mm256_add_ps(m, y), _mm256_mul_ps(_mm256_set1_ps(kLogQ2), e));
+		const __m256 r = _mm256_sqrt_ps(_mm256_mul_ps(_mm256_set1_ps(-2.f), logU1));
+
+		const __m256 quadrants = _mm256_mul_ps(_mm256_loadu_ps(&u2[i]), _mm256_set1_ps(4.f));
+		const __m256i roundedQuadrants = _mm256_cvttps_epi32(_mm256_add_ps(quadrants, _mm256_set1_ps(0.5f)));
+		const __m256 x = _mm256_mul_ps(_mm256_sub_ps(quadrants, _mm256_cvtepi32_ps(roundedQuadrants)), _mm256_set1_ps(kHalfPi));
+		const __m256 x2 = _mm256_mul_ps(x, x);
+		const __m256 sinX = _mm256_add_ps(x, _mm256_mul_ps(_mm256_mul_ps(x, x2),
+			_mm256_add_ps(_mm256_set1_ps(kSinP[0]), _mm256_mul_ps(x2, _mm256_add_ps(_mm256_set1_ps(kSinP[1]), _mm256_mul_ps(x2, _mm256_set1_ps(kSinP[2])))))));
+		const __m256 cosX = _mm256_add_ps(_mm256_sub_ps(one, _mm256_mul_ps(_mm256_set1_ps(0.5f), x2)), _mm256_mul_ps(_mm256_mul_ps(x2, x2),
+			_mm256_add_ps(_mm256_set1_ps(kCosP[0]), _mm256_mul_ps(x2, _mm256_add_ps(_mm256_set1_ps(kCosP[1]), _mm256_mul_ps(x2, _mm256_set1_ps(kCosP[2])))))));
+
+		const __m256 swapMask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(roundedQuadrants, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+		const __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(roundedQuadrants, _mm256_set1_epi32(2)), 30));
+		const __m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(roundedQuadrants, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+		const __m256 s = _mm256_xor_ps(_mm256_blendv_ps(sinX, cosX, swapMask), sinSign);
+		const __m256 c = _mm256_xor_ps(_mm256_blendv_ps(cosX, sinX, swapMask), cosSign);
+
+		// Interleave: unpack works within 128-bit halves, the halves are then reordered
+		const __m256 rc = _mm256_mul_ps(r, c);
+		const __m256 rs = _mm256_mul_ps(r, s);
+		const __m256 lo = _mm256_unpacklo_ps(rc, rs);	// pairs 0 1 | 4 5
+		const __m256 hi = _mm256_unpackhi_ps(rc, rs);	// pairs 2 3 | 6 7
+		_mm256_storeu_ps(&out[2*i], _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(&out[2*i+8], _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+	_boxMullerScalar(&out[2*i], &u1[i], &u2[i], nbPairs - i);
+}
+
+KERNELS_TARGET_AVX2
+static __m256 _expPolynomialVectorAVX2(__m256 x)
+{
+	const __m256 t = _mm256_min_ps(_mm256_set1_ps(kExpMax), _mm256_max_ps(_mm256_set1_ps(-kExpMax), x));
+	const __m256 fn = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(t, _mm256_set1_ps(kLog2e)), _mm256_set1_ps(0.5f)));
+	const __m256 r = _mm256_sub_ps(_mm256_sub_ps(t, _mm256_mul_ps(fn, _mm256_set1_ps(kLogQ2))), _mm256_mul_ps(fn, _mm256_set1_ps(kLogQ1)));
+	__m256 p = _mm256_set1_ps(kExpP[0]);
+	for(int k=1 ; k < 6 ; k++)
+		p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(kExpP[k]));
+	const __m256 expR = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p, _mm256_mul_ps(r, r)), r), _mm256_set1_ps(1.f));
+	const __m256 pow2n = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fn), _mm256_set1_epi32(127)), 23));
+	return _mm256_mul_ps(expR, pow2n);
+}
+
+KERNELS_TARGET_AVX2
+static void _sigmoidPolynomialAVX2(float* out, const float* in, int n)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		_mm256_storeu_ps(&out[i], _mm256_div_ps(one, _mm256_add_ps(one, _expPolynomialVectorAVX2(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&in[i]))))));
+	_sigmoidPolynomialScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX2
+static void _expPolynomialAVX2(float* out, const float* in, int n)
+{
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		_mm256_storeu_ps(&out[i], _expPolynomialVectorAVX2(_mm256_loadu_ps(&in[i])));
+	_expPolynomialScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX2
+static __m256 _tanhRationalVectorAVX2(__m256 x)
+{
+	const __m256 y = _mm256_min_ps(_mm256_set1_ps(kTanhMax), _mm256_max_ps(_mm256_set1_ps(-kTanhMax), x));
+	const __m256 y2 = _mm256_mul_ps(y, y);
+	__m256 p = _mm256_set1_ps(kTanhP[0]);
+	for(int k=1 ; k < 7 ; k++)
+		p = _mm256_add_ps(_mm256_mul_ps(p, y2), _mm256_set1_ps(kTanhP[k]));
+	__m256 q = _mm256_set1_ps(kTanhQ[0]);
+	for(int k=1 ; k < 4 ; k++)
+		q = _mm256_add_ps(_mm256_mul_ps(q, y2), _mm256_set1_ps(kTanhQ[k]));
+	return _mm256_div_ps(_mm256_mul_ps(y, p), q);
+}
+
+KERNELS_TARGET_AVX2
+static void _sigmoidRationalAVX2(float* out, const float* in, int n)
+{
+	const __m256 half = _mm256_set1_ps(0.5f);
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m256 s = _mm256_add_ps(half, _mm256_mul_ps(half, _tanhRationalVectorAVX2(_mm256_mul_ps(half, _mm256_loadu_ps(&in[i])))));
+		_mm256_storeu_ps(&out[i], _mm256_min_ps(_mm256_set1_ps(1.f), _mm256_max_ps(_mm256_setzero_ps(), s)));
+	}
+	_sigmoidRationalScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX2
+static void _tanhRationalAVX2(float* out, const float* in, int n)
+{
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+		_mm256_storeu_ps(&out[i], _mm256_min_ps(_mm256_set1_ps(1.f), _mm256_max_ps(_mm256_set1_ps(-1.f), _tanhRationalVectorAVX2(_mm256_loadu_ps(&in[i])))));
+	_tanhRationalScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX2
+static void _reluAVX2(float* out, const float* in, float negativeSlope, int n)
+{
+	const __m256 vSlope = _mm256_set1_ps(negativeSlope);
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m256 x = _mm256_loadu_ps(&in[i]);
+		_mm256_storeu_ps(&out[i], _mm256_blendv_ps(_mm256_mul_ps(vSlope, x), x, _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ)));
+	}
+	_reluScalar(&out[i], &in[i], negativeSlope, n - i);
+}
+
+KERNELS_TARGET_AVX2
+static void _mulSigmoidDerivativeAVX2(float* delta, const float* a, int n)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m256 va = _mm256_loadu_ps(&a[i]);
+		_mm256_storeu_ps(&delta[i], _mm256_mul_ps(_mm256_loadu_ps(&delta[i]), _mm256_mul_ps(va, _mm256_sub_ps(one, va))));
+	}
+	_mulSigmoidDerivativeScalar(&delta[i], &a[i], n - i);
+}
+
+KERNELS_TARGET_AVX2
+static void _mulTanhDerivativeAVX2(float* delta, const float* a, int n)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m256 va = _mm256_loadu_ps(&a[i]);
+		_mm256_storeu_ps(&delta[i], _mm256_mul_ps(_mm256_loadu_ps(&delta[i]), _mm256_sub_ps(one, _mm256_mul_ps(va, va))));
+	}
+	_mulTanhDerivativeScalar(&delta[i], &a[i], n - i);
+}
+
+KERNELS_TARGET_AVX2
+static void _mulReluDerivativeAVX2(float* delta, const float* a, float negativeSlope, int n)
+{
+	const __m256 vSlope = _mm256_set1_ps(negativeSlope);
+	int i = 0;
+	for( ; i + 8 <= n ; i += 8)
+	{
+		const __m256 d = _mm256_loadu_ps(&delta[i]);
+		_mm256_storeu_ps(&delta[i], _mm256_blendv_ps(_mm256_mul_ps(vSlope, d), d, _mm256_cmp_ps(_mm256_loadu_ps(&a[i]), _mm256_setzero_ps(), _CMP_GT_OQ)));
+	}
+	_mulReluDerivativeScalar(&delta[i], &a[i], negativeSlope, n - i);
+}
+
+// ============================== AVX-512 ==============================
+// Fast mode only: 16 lanes cannot reproduce the strict 8-lane summation order.
+
+KERNELS_TARGET_AVX512
+static __mmask16 _tailMaskAVX512(int n)
+{
+	return (__mmask16)((1u << n) - 1u);
+}
+
+KERNELS_TARGET_AVX512
+static float _dotAVX512(const float* a, const float* b, int n)
+{
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	int i = 0;
+	for( ; i + 32 <= n ; i += 32)
+	{
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i]), _mm512_loadu_ps(&b[i]), acc0);
+		acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i+16]), _mm512_loadu_ps(&b[i+16]), acc1);
+	}
+	for( ; i + 16 <= n ; i += 16)
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i]), _mm512_loadu_ps(&b[i]), acc0);
+	if(i < n)
+	{
+		const __mmask16 mask = _tailMaskAVX512(n - i);
+		acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, &a[i]), _mm512_maskz_loadu_ps(mask, &b[i]), acc1);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+KERNELS_TARGET_AVX512
+static void _dot4AVX512(const float* a, const float* b, int bStride, int n, float* out)
+{
+	const float* b0 = &b[0*bStride];
+	const float* b1 = &b[1*bStride];
+	const float* b2 = &b[2*bStride];
+	const float* b3 = &b[3*bStride];
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	__m512 acc2 = _mm512_setzero_ps();
+	__m512 acc3 = _mm512_setzero_ps();
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m512 va = _mm512_loadu_ps(&a[i]);
+		acc0 = _mm512_fmadd_ps(va, _mm512_loadu_ps(&b0[i]), acc0);
+		acc1 = _mm512_fmadd_ps(va, _mm512_loadu_ps(&b1[i]), acc1);
+		acc2 = _mm512_fmadd_ps(va, _mm512_loadu_ps(&b2[i]), acc2);
+		acc3 = _mm512_fmadd_ps(va, _mm512_loadu_ps(&b3[i]), acc3);
+	}
+	if(i < n)
+	{
+		const __mmask16 mask = _tailMaskAVX512(n - i);
+		const __m512 va = _mm512_maskz_loadu_ps(mask, &a[i]);
+		acc0 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, &b0[i]), acc0);
+		acc1 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, &b1[i]), acc1);
+		acc2 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, &b2[i]), acc2);
+		acc3 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, &b3[i]), acc3);
+	}
+	out[0] = _mm512_reduce_add_ps(acc0);
+	out[1] = _mm512_reduce_add_ps(acc1);
+	out[2] = _mm512_reduce_add_ps(acc2);
+	out[3] = _mm512_reduce_add_ps(acc3);
+}
+
+KERNELS_TARGET_AVX512
+static void _axpyAVX512(float* y, float alpha, const float* x, int n)
+{
+	const __m512 vAlpha = _mm512_set1_ps(alpha);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+		_mm512_storeu_ps(&y[i], _mm512_fmadd_ps(vAlpha, _mm512_loadu_ps(&x[i]), _mm512_loadu_ps(&y[i])));
+	if(i < n)
+	{
+		const __mmask16 mask = _tailMaskAVX512(n - i);
+		_mm512_mask_storeu_ps(&y[i], mask, _mm512_fmadd_ps(vAlpha, _mm512_maskz_loadu_ps(mask, &x[i]), _mm512_maskz_loadu_ps(mask, &y[i])));
+	}
+}
+
+KERNELS_TARGET_AVX512
+static void _u8ToFloatAVX512(float* out, const unsigned char* in, float scale, int n)
+{
+	const __m512 vScale = _mm512_set1_ps(scale);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+		_mm512_storeu_ps(&out[i], _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)&in[i]))), vScale));
+	for( ; i < n ; i++)	// masked byte loads would need AVX512BW
+		out[i] = (float)in[i] * scale;
+}
+
+// 64 products per row and instruction: vpdpbusd multiplies uint8 by int8 and adds groups of 4 into int32 lanes, without
+// intermediate saturation. The tail is a masked load, zeros adding nothing.
+KERNELS_TARGET_AVX512VNNI
+static void _dot4U8S8AVX512VNNI(const uint8_t* a, const int8_t* b, int bStride, int n, int32_t* out)
+{
+	const int8_t* b0 = &b[0*bStride];
+	const int8_t* b1 = &b[1*bStride];
+	const int8_t* b2 = &b[2*bStride];
+	const int8_t* b3 = &b[3*bStride];
+	__m512i acc0 = _mm512_setzero_si512();
+	__m512i acc1 = _mm512_setzero_si512();
+	__m512i acc2 = _mm512_setzero_si512();
+	__m512i acc3 = _mm512_setzero_si512();
+	int i = 0;
+	for( ; i + 64 <= n ; i += 64)
+	{
+		const __m512i va = _mm512_loadu_si512(&a[i]);
+		acc0 = _mm512_dpbusd_epi32(acc0, va, _mm512_loadu_si512(&b0[i]));
+		acc1 = _mm512_dpbusd_epi32(acc1, va, _mm512_loadu_si512(&b1[i]));
+		acc2 = _mm512_dpbusd_epi32(acc2, va, _mm512_loadu_si512(&b2[i]));
+		acc3 = _mm512_dpbusd_epi32(acc3, va, _mm512_loadu_si512(&b3[i]));
+	}
+	if(i < n)
+	{
+		const __mmask64 mask = (__mmask64)((~0ull) >> (64 - (n - i)));
+		const __m512i va = _mm512_maskz_loadu_epi8(mask, &a[i]);
+		acc0 = _mm512_dpbusd_epi32(acc0, va, _mm512_maskz_loadu_epi8(mask, &b0[i]));
+		acc1 = _mm512_dpbusd_epi32(acc1, va, _mm512_maskz_loadu_epi8(mask, &b1[i]));
+		acc2 = _mm512_dpbusd_epi32(acc2, va, _mm512_maskz_loadu_epi8(mask, &b2[i]));
+		acc3 = _mm512_dpbusd_epi32(acc3, va, _mm512_maskz_loadu_epi8(mask, &b3[i]));
+	}
+	out[0] = _mm512_reduce_add_epi32(acc0);
+	out[1] = _mm512_reduce_add_epi32(acc1);
+	out[2] = _mm512_reduce_add_epi32(acc2);
+	out[3] = _mm512_reduce_add_epi32(acc3);
+}
+
+template<bool bBF16>
+KERNELS_TARGET_AVX512 KERNELS_FORCE_INLINE
+static __m512 _loadHalfAVX512(const uint16_t* p)
+{
+	const __m256i h = _mm256_loadu_si256((const __m256i*)p);
+	if constexpr(bBF16)
+		return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+	else
+		return _mm512_cvtph_ps(h);
+}
+
+template<bool bBF16>
+KERNELS_TARGET_AVX512 KERNELS_FORCE_INLINE
+static __m512 _loadHalfTailAVX512(const uint16_t* p, int n)
+{
+	alignas(32) uint16_t values[16] = {};
+	memcpy(values, p, n * sizeof(uint16_t));
+	return _loadHalfAVX512<bBF16>(values);
+}
+
+template<bool bBF16>
+KERNELS_TARGET_AVX512
+static float _dotHalfAVX512(const uint16_t* a, const float* b, int n)
+{
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	int i = 0;
+	for( ; i + 32 <= n ; i += 32)
+	{
+		acc0 = _mm512_fmadd_ps(_loadHalfAVX512<bBF16>(&a[i]), _mm512_loadu_ps(&b[i]), acc0);
+		acc1 = _mm512_fmadd_ps(_loadHalfAVX512<bBF16>(&a[i+16]), _mm512_loadu_ps(&b[i+16]), acc1);
+	}
+	for( ; i + 16 <= n ; i += 16)
+		acc0 = _mm512_fmadd_ps(_loadHalfAVX512<bBF16>(&a[i]), _mm512_loadu_ps(&b[i]), acc0);
+	if(i < n)
+		acc1 = _mm512_fmadd_ps(_loadHalfTailAVX512<bBF16>(&a[i], n - i), _mm512_maskz_loadu_ps(_tailMaskAVX512(n - i), &b[i]), acc1);
+	return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+template<bool bBF16>
+KERNELS_TARGET_AVX512
+static void _dot4HalfAVX512(const uint16_t* a, const float* b, int bStride, int n, float* out)
+{
+	const float* b0 = &b[0*bStride];
+	const float* b1 = &b[1*bStride];
+	const float* b2 = &b[2*bStride];
+	const float* b3 = &b[3*bStride];
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	__m512 acc2 = _mm512_setzero_ps();
+	__m512 acc3 = _mm512_setzero_ps();
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m512 va = _loadHalfAVX512<bBF16>(&a[i]);
+		acc0 = _mm512_fmadd_ps(va, _mm512_loadu_ps(&b0[i]), acc0);
+		acc1 = _mm512_fmadd_ps(va, _mm512_loadu_ps(&b1[i]), acc1);
+		acc2 = _mm512_fmadd_ps(va, _mm512_loadu_ps(&b2[i]), acc2);
+		acc3 = _mm512_fmadd_ps(va, _mm512_loadu_ps(&b3[i]), acc3);
+	}
+	if(i < n)
+	{
+		const __mmask16 mask = _tailMaskAVX512(n - i);
+		const __m512 va = _loadHalfTailAVX512<bBF16>(&a[i], n - i);
+		acc0 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, &b0[i]), acc0);
+		acc1 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, &b1[i]), acc1);
+		acc2 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, &b2[i]), acc2);
+		acc3 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, &b3[i]), acc3);
+	}
+	out[0] = _mm512_reduce_add_ps(acc0);
+	out[1] = _mm512_reduce_add_ps(acc1);
+	out[2] = _mm512_reduce_add_ps(acc2);
+	out[3] = _mm512_reduce_add_ps(acc3);
+}
+
+KERNELS_TARGET_AVX512
+static float _sparseDotAVX512(const float* values, const int32_t* indices, const float* b, int n)
+{
+	__m512 acc = _mm512_setzero_ps();
+	int k = 0;
+	for( ; k + 16 <= n ; k += 16)
+		acc = _mm512_fmadd_ps(_mm512_loadu_ps(&values[k]), _mm512_i32gather_ps(_mm512_loadu_si512(&indices[k]), b, 4), acc);
+	if(k < n)
+	{
+		const __mmask16 mask = _tailMaskAVX512(n - k);
+		const __m512 vb = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, _mm512_maskz_loadu_epi32(mask, &indices[k]), b, 4);
+		acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, &values[k]), vb, acc);
+	}
+	return _mm512_reduce_add_ps(acc);
+}
+
+KERNELS_TARGET_AVX512
+static void _sparseDot4AVX512(const float* values, const int32_t* indices, const float* b, int bStride, int n, float* out)
+{
+	const float* b0 = &b[0*bStride];
+	const float* b1 = &b[1*bStride];
+	const float* b2 = &b[2*bStride];
+	const float* b3 = &b[3*bStride];
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	__m512 acc2 = _mm512_setzero_ps();
+	__m512 acc3 = _mm512_setzero_ps();
+	int k = 0;
+	for( ; k + 16 <= n ; k += 16)
+	{
+		const __m512 va = _mm512_loadu_ps(&values[k]);
+		const __m512i vIndices = _mm512_loadu_si512(&indices[k]);
+		acc0 = _mm512_fmadd_ps(va, _mm512_i32gather_ps(vIndices, b0, 4), acc0);
+		acc1 = _mm512_fmadd_ps(va, _mm512_i32gather_ps(vIndices, b1, 4), acc1);
+		acc2 = _mm512_fmadd_ps(va, _mm512_i32gather_ps(vIndices, b2, 4), acc2);
+		acc3 = _mm512_fmadd_ps(va, _mm512_i32gather_ps(vIndices, b3, 4), acc3);
+	}
+	if(k < n)
+	{
+		const __mmask16 mask = _tailMaskAVX512(n - k);
+		const __m512 va = _mm512_maskz_loadu_ps(mask, &values[k]);
+		const __m512i vIndices = _mm512_maskz_loadu_epi32(mask, &indices[k]);
+		acc0 = _mm512_fmadd_ps(va, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, vIndices, b0, 4), acc0);
+		acc1 = _mm512_fmadd_ps(va, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, vIndices, b1, 4), acc1);
+		acc2 = _mm512_fmadd_ps(va, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, vIndices, b2, 4), acc2);
+		acc3 = _mm512_fmadd_ps(va, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, vIndices, b3, 4), acc3);
+	}
+	out[0] = _mm512_reduce_add_ps(acc0);
+	out[1] = _mm512_reduce_add_ps(acc1);
+	out[2] = _mm512_reduce_add_ps(acc2);
+	out[3] = _mm512_reduce_add_ps(acc3);
+}
+
+KERNELS_TARGET_AVX512
+static void _f16ToFloatAVX512(float* out, const uint16_t* in, int n)
+{
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+		_mm512_storeu_ps(&out[i], _loadHalfAVX512<false>(&in[i]));
+	_f16ToFloatAVX2(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX512
+static void _floatToF16AVX512(uint16_t* out, const float* in, int n)
+{
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+		_mm256_storeu_si256((__m256i*)&out[i], _mm512_cvtps_ph(_mm512_loadu_ps(&in[i]), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+	_floatToF16AVX2(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX512
+static void _bf16ToFloatAVX512(float* out, const uint16_t* in, int n)
+{
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+		_mm512_storeu_ps(&out[i], _loadHalfAVX512<true>(&in[i]));
+	_bf16ToFloatAVX2(&out[i], &in[i], n - i);
+}
+
+// Same as _floatToBF16AVX2(). vcvtneps2bf16 (AVX-512 BF16) is not used: it flushes subnormals to zero.
+KERNELS_TARGET_AVX512
+static void _floatToBF16AVX512(uint16_t* out, const float* in, int n)
+{
+	const __m512i vAbsMask = _mm512_set1_epi32(0x7FFFFFFF);
+	const __m512i vInfinity = _mm512_set1_epi32(0x7F800000);
+	const __m512i vRoundingBias = _mm512_set1_epi32(0x7FFF);
+	const __m512i vOne = _mm512_set1_epi32(1);
+	const __m512i vQuietBit = _mm512_set1_epi32(0x40);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m512i bits = _mm512_castps_si512(_mm512_loadu_ps(&in[i]));
+		const __m512i high = _mm512_srli_epi32(bits, 16);
+		const __m512i rounded = _mm512_srli_epi32(_mm512_add_epi32(bits, _mm512_add_epi32(vRoundingBias, _mm512_and_si512(high, vOne))), 16);
+		const __mmask16 bNaN = _mm512_cmpgt_epi32_mask(_mm512_and_si512(bits, vAbsMask), vInfinity);
+		const __m512i result = _mm512_mask_or_epi32(rounded, bNaN, high, vQuietBit);
+		_mm256_storeu_si256((__m256i*)&out[i], _mm512_cvtepi32_epi16(result));
+	}
+	_floatToBF16AVX2(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX512
+static void _boxMullerAVX512(float* out, const float* u1, const float* u2, int nbPairs)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	const __m512i interleaveLo = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+	const __m512i interleaveHi = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+	int i = 0;
+	for( ; i + 16 <= nbPairs ; i += 16)
+	{
+		const __m512i bits = _mm512_castps_si512(_mm512_loadu_ps(&u1[i]));
+		__m512 e = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(126)));
+		__m512 m = _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007FFFFF)), _mm512_set1_epi32(0x3F000000)));
+		const __mmask16 smallMask = _mm512_cmp_ps_mask(m, _mm512_set1_ps(kSqrtHalf), _CMP_LT_OQ);
+		e = _mm512_sub_ps(e, _mm512_maskz_mov_ps(smallMask, one));
+		m = _mm512_sub_ps(_mm512_mask_blend_ps(smallMask, m, _mm512_add_ps(m, m)), one);
+
+		const __m512 z = _mm512_mul_ps(m, m);
+		__m512 y = _mm512_set1_ps(kLogP[0]);
+		for(int k=1 ; k < 9 ; k++)
+			y = _mm512_add_ps(_mm512_mul_ps(y, m), _mm512_set1_ps(kLogP[k]));
+		y = _mm512_mul_ps(_mm512_mul_ps(y, m), z);
+		y = _mm512_add_ps(y, _mm512_mul_ps(_mm512_set1_ps(kLogQ1), e));
+		y = _mm512_add_ps(y, _mm512_mul_ps(_mm512_set1_ps(-0.5f), z));
+		const __m512 logU1 = _mm512_add_ps(_mm512_add_ps(m, y), _mm512_mul_ps(_mm512_set1_ps(kLogQ2), e));
+		const __m512 r = _mm512_sqrt_ps(_mm512_mul_ps(_mm512_set1_ps(-2.f), logU1));
+
+		const __m512 quadrants = _mm512_mul_ps(_mm512_loadu_ps(&u2[i]), _mm512_set1_ps(4.f));
+		const __m512i roundedQuadrants = _mm512_cvttps_epi32(_mm512_add_ps(quadrants, _mm512_set1_ps(0.5f)));
+		const __m512 x = _mm512_mul_ps(_mm512_sub_ps(quadrants, _mm512_cvtepi32_ps(roundedQuadrants)), _mm512_set1_ps(kHalfPi));
+		const __m512 x2 = _mm512_mul_ps(x, x);
+		const __m512 sinX = _mm512_add_ps(x, _mm512_mul_ps(_mm512_mul_ps(x, x2),
+			_mm512_add_ps(_mm512_set1_ps(kSinP[0]), _mm512_mul_ps(x2, _mm512_add_ps(_mm512_set1_ps(kSinP[1]), _mm512_mul_ps(x2, _mm512_set1_ps(kSinP[2])))))));
+		const __m512 cosX = _mm512_add_ps(_mm512_sub_ps(one, _mm512_mul_ps(_mm512_set1_ps(0.5f), x2)), _mm512_mul_ps(_mm512_mul_ps(x2, x2),
+			_mm512_add_ps(_mm512_set1_ps(kCosP[0]), _mm512_mul_ps(x2, _mm512_add_ps(_mm512_set1_ps(kCosP[1]), _mm512_mul_ps(x2, _mm512_set1_ps(kCosP[2])))))));
+
+		const __mmask16 swapMask = _mm512_test_epi32_mask(roundedQuadrants, _mm512_set1_epi32(1));
+		const __m512i sinSign = _mm512_slli_epi32(_mm512_and_si512(roundedQuadrants, _mm512_set1_epi32(2)), 30);
+		const __m512i cosSign = _mm512_slli_epi32(_mm512_and_si512(_mm512_add_epi32(roundedQuadrants, _mm512_set1_epi32(1)), _mm512_set1_epi32(2)), 30);
+		const __m512 s = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swapMask, sinX, cosX)), sinSign));
+		const __m512 c = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swapMask, cosX, sinX)), cosSign));
+
+		const __m512 rc = _mm512_mul_ps(r, c);
+		const __m512 rs = _mm512_mul_ps(r, s);
+		_mm512_storeu_ps(&out[2*i], _mm512_permutex2var_ps(rc, interleaveLo, rs));
+		_mm512_storeu_ps(&out[2*i+16], _mm512_permutex2var_ps(rc, interleaveHi, rs));
+	}
+	_boxMullerScalar(&out[2*i], &u1[i], &u2[i], nbPairs - i);
+}
+
+KERNELS_TARGET_AVX512
+static __m512 _expPolynomialVectorAVX512(__m512 x)
+{
+	const __m512 t = _mm512_min_ps(_mm512_set1_ps(kExpMax), _mm512_max_ps(_mm512_set1_ps(-kExpMax), x));
+	const __m512 fn = _mm512_roundscale_ps(_mm512_add_ps(_mm512_mul_ps(t, _mm512_set1_ps(kLog2e)), _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	const __m512 r = _mm512_sub_ps(_mm512_sub_ps(t, _mm512_mul_ps(fn, _mm512_set1_ps(kLogQ2))), _mm512_mul_ps(fn, _mm512_set1_ps(kLogQ1)));
+	__m512 p = _mm512_set1_ps(kExpP[0]);
+	for(int k=1 ; k < 6 ; k++)
+		p = _mm512_add_ps(_mm512_mul_ps(p, r), _mm512_set1_ps(kExpP[k]));
+	const __m512 expR = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(p, _mm512_mul_ps(r, r)), r), _mm512_set1_ps(1.f));
+	const __m512 pow2n = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(fn), _mm512_set1_epi32(127)), 23));
+	return _mm512_mul_ps(expR, pow2n);
+}
+
+KERNELS_TARGET_AVX512
+static void _sigmoidPolynomialAVX512(float* out, const float* in, int n)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+		_mm512_storeu_ps(&out[i], _mm512_div_ps(one, _mm512_add_ps(one, _expPolynomialVectorAVX512(_mm512_sub_ps(_mm512_setzero_ps(), _mm512_loadu_ps(&in[i]))))));
+	_sigmoidPolynomialScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX512
+static void _expPolynomialAVX512(float* out, const float* in, int n)
+{
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+		_mm512_storeu_ps(&out[i], _expPolynomialVectorAVX512(_mm512_loadu_ps(&in[i])));
+	_expPolynomialScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX512
+static __m512 _tanhRationalVectorAVX512(__m512 x)
+{
+	const __m512 y = _mm512_min_ps(_mm512_set1_ps(kTanhMax), _mm512_max_ps(_mm512_set1_ps(-kTanhMax), x));
+	const __m512 y2 = _mm512_mul_ps(y, y);
+	__m512 p = _mm512_set1_ps(kTanhP[0]);
+	for(int k=1 ; k < 7 ; k++)
+		p = _mm512_add_ps(_mm512_mul_ps(p, y2), _mm512_set1_ps(kTanhP[k]));
+	__m512 q = _mm512_set1_ps(kTanhQ[0]);
+	for(int k=1 ; k < 4 ; k++)
+		q = _mm512_add_ps(_mm512_mul_ps(q, y2), _mm512_set1_ps(kTanhQ[k]));
+	return _mm512_div_ps(_mm512_mul_ps(y, p), q);
+}
+
+KERNELS_TARGET_AVX512
+static void _sigmoidRationalAVX512(float* out, const float* in, int n)
+{
+	const __m512 half = _mm512_set1_ps(0.5f);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m512 s = _mm512_add_ps(half, _mm512_mul_ps(half, _tanhRationalVectorAVX512(_mm512_mul_ps(half, _mm512_loadu_ps(&in[i])))));
+		_mm512_storeu_ps(&out[i], _mm512_min_ps(_mm512_set1_ps(1.f), _mm512_max_ps(_mm512_setzero_ps(), s)));
+	}
+	_sigmoidRationalScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX512
+static void _tanhRationalAVX512(float* out, const float* in, int n)
+{
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+		_mm512_storeu_ps(&out[i], _mm512_min_ps(_mm512_set1_ps(1.f), _mm512_max_ps(_mm512_set1_ps(-1.f), _tanhRationalVectorAVX512(_mm512_loadu_ps(&in[i])))));
+	_tanhRationalScalar(&out[i], &in[i], n - i);
+}
+
+KERNELS_TARGET_AVX512
+static void _reluAVX512(float* out, const float* in, float negativeSlope, int n)
+{
+	const __m512 vSlope = _mm512_set1_ps(negativeSlope);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m512 x = _mm512_loadu_ps(&in[i]);
+		const __mmask16 positiveMask = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GT_OQ);
+		_mm512_storeu_ps(&out[i], _mm512_mask_blend_ps(positiveMask, _mm512_mul_ps(vSlope, x), x));
+	}
+	_reluScalar(&out[i], &in[i], negativeSlope, n - i);
+}
+
+KERNELS_TARGET_AVX512
+static void _mulSigmoidDerivativeAVX512(float* delta, const float* a, int n)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m512 va = _mm512_loadu_ps(&a[i]);
+		_mm512_storeu_ps(&delta[i], _mm512_mul_ps(_mm512_loadu_ps(&delta[i]), _mm512_mul_ps(va, _mm512_sub_ps(one, va))));
+	}
+	_mulSigmoidDerivativeScalar(&delta[i], &a[i], n - i);
+}
+
+KERNELS_TARGET_AVX512
+static void _mulTanhDerivativeAVX512(float* delta, const float* a, int n)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m512 va = _mm512_loadu_ps(&a[i]);
+		_mm512_storeu_ps(&delta[i], _mm512_mul_ps(_mm512_loadu_ps(&delta[i]), _mm512_sub_ps(one, _mm512_mul_ps(va, va))));
+	}
+	_mulTanhDerivativeScalar(&delta[i], &a[i], n - i);
+}
+
+KERNELS_TARGET_AVX512
+static void _mulReluDerivativeAVX512(float* delta, const float* a, float negativeSlope, int n)
+{
+	const __m512 vSlope = _mm512_set1_ps(negativeSlope);
+	int i = 0;
+	for( ; i + 16 <= n ; i += 16)
+	{
+		const __m512 d = _mm512_loadu_ps(&delta[i]);
+		const __mmask16 positiveMask = _mm512_cmp_ps_mask(_mm512_loadu_ps(&a[i]), _mm512_setzero_ps(), _CMP_GT_OQ);
+		_mm512_storeu_ps(&delta[i], _mm512_mask_blend_ps(positiveMask, _mm512_mul_ps(vSlope, d), d));
+	}
+	_mulReluDerivativeScalar(&delta[i], &a[i], negativeSlope, n - i);
+}
+
+// ============================== CPU detection ==============================
+
+static void _cpuid(int leaf, int subLeaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, leaf, subLeaf);
+#else
+	__cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long _xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax = 0, edx = 0;
+	__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+// AVX-512 VNNI, with the AVX512BW masked byte loads of its kernel. Only checked once AVX-512 itself is supported.
+static bool _isAVX512VNNISupported()
+{
+	unsigned int regs[4] = {0};	// eax, ebx, ecx, edx
+	_cpuid(7, 0, regs);
+	const bool bAVX512BW	= (regs[1] & (1u << 30)) != 0;
+	const bool bAVX512VNNI	= (regs[2] & (1u << 11)) != 0;
+	return bAVX512BW && bAVX512VNNI;
+}
+
+#endif // KERNELS_X86
+
+KernelsISA getBestSupportedKernelsISA()
+{
+#ifdef KERNELS_X86
+	unsigned int regs[4] = {0};	// eax, ebx, ecx, edx
+	_cpuid(0, 0, regs);
+	const unsigned int maxLeaf = regs[0];
+
+	_cpuid(1, 0, regs);
+	const bool bSSE42	= (regs[2] & (1u << 20)) != 0;
+	const bool bFMA		= (regs[2] & (1u << 12)) != 0;
+	const bool bOSXSAVE	= (regs[2] & (1u << 27)) != 0;
+	const bool bAVX		= (regs[2] & (1u << 28)) != 0;
+	const bool bF16C	= (regs[2] & (1u << 29)) != 0;
+
+	// The OS must save the YMM (and ZMM) registers on context switches
+	const unsigned long long xcr0 = bOSXSAVE ? _xgetbv0() : 0;
+	const bool bOSSavesYMM = (xcr0 & 0x06) == 0x06;
+	const bool bOSSavesZMM = (xcr0 & 0xe6) == 0xe6;
+
+	bool bAVX2 = false;
+	bool bAVX512F = false;
+	if(maxLeaf >= 7)
+	{
+		_cpuid(7, 0, regs);
+		bAVX2		= (regs[1] & (1u << 5)) != 0;
+		bAVX512F	= (regs[1] & (1u << 16)) != 0;
+	}
+
+	// F16C comes with all AVX2 CPUs, it is only checked for safety
+	if(bAVX512F && bAVX2 && bFMA && bF16C && bOSSavesZMM)
+		return KernelsISA::AVX512;
+	if(bAVX2 && bAVX && bFMA && bF16C && bOSSavesYMM)
+		return KernelsISA::AVX2;
+	if(bSSE42)
+		return KernelsISA::SSE42;
+#endif
+	return KernelsISA::Scalar;
+}
+
+// Sigmoid, tanh and exp of gKernels.sigmoidMode for gKernels.isa. Approximations give the same results in both modes.
+static void _selectSigmoidKernels()
+{
+	gKernels.exp = gKernels.sigmoidMode == SigmoidMode::Exact ? _expExact : _expPolynomialScalar;
+#ifdef KERNELS_X86
+	if(gKernels.sigmoidMode != SigmoidMode::Exact)
+	{
+		if(gKernels.isa == KernelsISA::AVX512)
+			gKernels.exp = _expPolynomialAVX512;
+		else if(gKernels.isa == KernelsISA::AVX2)
+			gKernels.exp = _expPolynomialAVX2;
+		else if(gKernels.isa == KernelsISA::SSE42)
+			gKernels.exp = _expPolynomialSSE42;
+	}
+#endif
+
+	gKernels.tanh = gKernels.sigmoidMode == SigmoidMode::Exact ? _tanhExact : _tanhRationalScalar;
+#ifdef KERNELS_X86
+	if(gKernels.sigmoidMode != SigmoidMode::Exact)
+	{
+		if(gKernels.isa == KernelsISA::AVX512)
+			gKernels.tanh = _tanhRationalAVX512;
+		else if(gKernels.isa == KernelsISA::AVX2)
+			gKernels.tanh = _tanhRationalAVX2;
+		else if(gKernels.isa == KernelsISA::SSE42)
+			gKernels.tanh = _tanhRationalSSE42;
+	}
+#endif
+
+	switch(gKernels.sigmoidMode)
+	{
+	case SigmoidMode::Exact:
+		gKernels.sigmoid = _sigmoidExact;
+		break;
+	case SigmoidMode::Rational:
+		gKernels.sigmoid = _sigmoidRationalScalar;
+#ifdef KERNELS_X86
+		if(gKernels.isa == KernelsISA::AVX512)
+			gKernels.sigmoid = _sigmoidRationalAVX512;
+		else if(gKernels.isa == KernelsISA::AVX2)
+			gKernels.sigmoid = _sigmoidRationalAVX2;
+		else if(gKernels.isa == KernelsISA::SSE42)
+			gKernels.sigmoid = _sigmoidRationalSSE42;
+#endif
+		break;
+	default:
+		gKernels.sigmoid = _sigmoidPolynomialScalar;
+#ifdef KERNELS_X86
+		if(gKernels.isa == KernelsISA::AVX512)
+			gKernels.sigmoid = _sigmoidPolynomialAVX512;
+		else if(gKernels.isa == KernelsISA::AVX2)
+			gKernels.sigmoid = _sigmoidPolynomialAVX2;
+		else if(gKernels.isa == KernelsISA::SSE42)
+			gKernels.sigmoid = _sigmoidPolynomialSSE42;
+#endif
+		break;
+	}
+}
+
+bool initKernels(KernelsMode mode, KernelsISA isa)
+{
+	if(isa > getBestSupportedKernelsISA())
+		return false;
+
+	// AVX-512 cannot honor the strict 8-lane summation order
+	if(mode == KernelsMode::Strict && isa == KernelsISA::AVX512)
+		isa = KernelsISA::AVX2;
+
+	gKernels.isa = isa;
+	gKernels.mode = mode;
+	gKernels.bVNNI = false;
+	switch(isa)
+	{
+#ifdef KERNELS_X86
+	case KernelsISA::AVX512:
+		gKernels.dot	= _dotAVX512;
+		gKernels.dot4	= _dot4AVX512;
+		gKernels.axpy	= _axpyAVX512;
+		gKernels.u8ToFloat	= _u8ToFloatAVX512;
+		gKernels.bVNNI		= _isAVX512VNNISupported();
+		gKernels.dot4U8S8	= gKernels.bVNNI ? _dot4U8S8AVX512VNNI : _dot4U8S8AVX2;
+		gKernels.dotF16		= _dotHalfAVX512<false>;
+		gKernels.dotBF16	= _dotHalfAVX512<true>;
+		gKernels.dot4F16	= _dot4HalfAVX512<false>;
+		gKernels.dot4BF16	= _dot4HalfAVX512<true>;
+		gKernels.sparseDot	= _sparseDotAVX512;
+		gKernels.sparseDot4	= _sparseDot4AVX512;
+		gKernels.floatToF16		= _floatToF16AVX512;
+		gKernels.floatToBF16	= _floatToBF16AVX512;
+		gKernels.f16ToFloat		= _f16ToFloatAVX512;
+		gKernels.bf16ToFloat	= _bf16ToFloatAVX512;
+		gKernels.boxMuller	= _boxMullerAVX512;
+		gKernels.relu	= _reluAVX512;
+		gKernels.mulSigmoidDerivative	= _mulSigmoidDerivativeAVX512;
+		gKernels.mulTanhDerivative		= _mulTanhDerivativeAVX512;
+		gKernels.mulReluDerivative		= _mulReluDerivativeAVX512;
+		break;
+	case KernelsISA::AVX2:
+		gKernels.dot	= mode == KernelsMode::Strict ? _dotAVX2Strict	: _dotAVX2;
+		gKernels.dot4	= mode == KernelsMode::Strict ? _dot4AVX2Strict	: _dot4AVX2;
+		gKernels.axpy	= mode == KernelsMode::Strict ? _axpyAVX2Strict	: _axpyAVX2;
+		gKernels.u8ToFloat	= _u8ToFloatAVX2;
+		gKernels.dot4U8S8	= _dot4U8S8AVX2;
+		gKernels.dotF16		= mode == KernelsMode::Strict ? _dotHalfAVX2<false, true>	: _dotHalfAVX2<false, false>;
+		gKernels.dotBF16	= mode == KernelsMode::Strict ? _dotHalfAVX2<true, true>	: _dotHalfAVX2<true, false>;
+		gKernels.dot4F16	= mode == KernelsMode::Strict ? _dot4HalfAVX2<false, true>	: _dot4HalfAVX2<false, false>;
+		gKernels.dot4BF16	= mode == KernelsMode::Strict ? _dot4HalfAVX2<true, true>	: _dot4HalfAVX2<true, false>;
+		gKernels.sparseDot	= mode == KernelsMode::Strict ? _sparseDotAVX2<true>		: _sparseDotAVX2<false>;
+		gKernels.sparseDot4	= mode == KernelsMode::Strict ? _sparseDot4AVX2<true>	: _sparseDot4AVX2<false>;
+		gKernels.floatToF16		= _floatToF16AVX2;
+		gKernels.floatToBF16	= _floatToBF16AVX2;
+		gKernels.f16ToFloat		= _f16ToFloatAVX2;
+		gKernels.bf16ToFloat	= _bf16ToFloatAVX2;
+		gKernels.boxMuller	= _boxMullerAVX2;
+		gKernels.relu	= _reluAVX2;
+		gKernels.mulSigmoidDerivative	= _mulSigmoidDerivativeAVX2;
+		gKernels.mulTanhDerivative		= _mulTanhDerivativeAVX2;
+		gKernels.mulReluDerivative		= _mulReluDerivativeAVX2;
+		break;
+	case KernelsISA::SSE42:
+		gKernels.dot	= _dotSSE42;
+		gKernels.dot4	= _dot4SSE42;
+		gKernels.axpy	= _axpySSE42;
+		gKernels.u8ToFloat	= _u8ToFloatSSE42;
+		gKernels.dot4U8S8	= _dot4U8S8SSE42;
+		gKernels.dotF16		= _dotHalfScalar<_f16ToFloat>;	// F16C is not part of SSE4.2
+		gKernels.dotBF16	= _dotHalfScalar<_bf16ToFloat>;
+		gKernels.dot4F16	= _dot4HalfScalar<_f16ToFloat>;
+		gKernels.dot4BF16	= _dot4HalfScalar<_bf16ToFloat>;
+		gKernels.sparseDot	= _sparseDotScalar;	// no gather before AVX2
+		gKernels.sparseDot4	= _sparseDot4Scalar;
+		gKernels.floatToF16		= _floatToF16Scalar;
+		gKernels.floatToBF16	= _floatToBF16Scalar;
+		gKernels.f16ToFloat		= _f16ToFloatScalar;
+		gKernels.bf16ToFloat	= _bf16ToFloatScalar;
+		gKernels.boxMuller	= _boxMullerSSE42;
+		gKernels.relu	= _reluSSE42;
+		gKernels.mulSigmoidDerivative	= _mulSigmoidDerivativeSSE42;
+		gKernels.mulTanhDerivative		= _mulTanhDerivativeSSE42;
+		gKernels.mulReluDerivative		= _mulReluDerivativeSSE42;
+		break;
+#endif
+	default:
+		gKernels.isa	= KernelsISA::Scalar;
+		gKernels.dot	= _dotScalar;
+		gKernels.dot4	= _dot4Scalar;
+		gKernels.axpy	= _axpyScalar;
+		gKernels.u8ToFloat	= _u8ToFloatScalar;
+		gKernels.dot4U8S8	= _dot4U8S8Scalar;
+		gKernels.dotF16		= _dotHalfScalar<_f16ToFloat>;
+		gKernels.dotBF16	= _dotHalfScalar<_bf16ToFloat>;
+		gKernels.dot4F16	= _dot4HalfScalar<_f16ToFloat>;
+		gKernels.dot4BF16	= _dot4HalfScalar<_bf16ToFloat>;
+		gKernels.sparseDot	= _sparseDotScalar;
+		gKernels.sparseDot4	= _sparseDot4Scalar;
+		gKernels.floatToF16		= _floatToF16Scalar;
+		gKernels.floatToBF16	= _floatToBF16Scalar;
+		gKernels.f16ToFloat		= _f16ToFloatScalar;
+		gKernels.bf16ToFloat	= _bf16ToFloatScalar;
+		gKernels.boxMuller	= _boxMullerScalar;
+		gKernels.relu	= _reluScalar;
+		gKernels.mulSigmoidDerivative	= _mulSigmoidDerivativeScalar;
+		gKernels.mulTanhDerivative		= _mulTanhDerivativeScalar;
+		gKernels.mulReluDerivative		= _mulReluDerivativeScalar;
+		break;
+	}
+	_selectSigmoidKernels();
+	return true;
+}
+
+void setSigmoidMode(SigmoidMode mode)
+{
+	gKernels.sigmoidMode = mode;
+	_selectSigmoidKernels();
+}
+
+const char* getKernelsISAName(KernelsISA isa)
+{
+	switch(isa)
+	{
+	case KernelsISA::SSE42:		return "SSE4.2";
+	case KernelsISA::AVX2:		return "AVX2";
+	case KernelsISA::AVX512:	return "AVX-512";
+	default:					return "scalar";
+	}
+}
+
+const char* getSigmoidModeName(SigmoidMode mode)
+{
+	switch(mode)
+	{
+	case SigmoidMode::Exact:		return "exact";
+	case SigmoidMode::Rational:		return "rational";
+	default:						return "polynomial";
+	}
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+// Vectorized math kernels used by the hot loops of Layer.
+// The implementation is selected at startup from cpuid: AVX-512 (+FMA), AVX2 (+FMA, F16C), SSE4.2 or scalar fallback.
+//
+// In strict mode, every implementation accumulates dot products in 8 lanes (lane i sums elements i, i+8, i+16...),
+// uses separate multiply and add (no FMA) and reduces the lanes in the same order, so that results are
+// bit-for-bit identical between the scalar and SIMD paths. AVX-512 falls back to the AVX2 kernels in this mode.
+
+#if defined(_M_X64) || defined(__x86_64__)
+	#define KERNELS_X86 1
+#endif
+
+// GCC/Clang need per-function target attributes to emit instructions above the baseline ISA, MSVC does not.
+// Code inlined into such a function is compiled, and auto-vectorized, for its ISA.
+#if defined(KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+	#define KERNELS_TARGET_SSE42	__attribute__((target("sse4.2")))
+	#define KERNELS_TARGET_AVX2		__attribute__((target("avx2,fma,f16c")))
+	#define KERNELS_TARGET_AVX512	__attribute__((target("avx512f,avx2,fma,f16c")))
+	#define KERNELS_TARGET_AVX512VNNI	__attribute__((target("avx512f,avx512bw,avx512vnni,avx2,fma,f16c")))
+#else
+	#define KERNELS_TARGET_SSE42
+	#define KERNELS_TARGET_AVX2
+	#define KERNELS_TARGET_AVX512
+	#define KERNELS_TARGET_AVX512VNNI
+#endif
+
+#if defined(_MSC_VER)
+	#define KERNELS_FORCE_INLINE	__forceinline
+#else
+	#define KERNELS_FORCE_INLINE	inline __attribute__((always_inline))
+#endif
+
+enum class KernelsISA
+{
+	Scalar,
+	SSE42,
+	AVX2,
+	AVX512,
+};
+
+enum class KernelsMode
+{
+	Fast,	// FMA and widest vectors available
+	Strict,	// Bit-for-bit identical results on all paths, for validation
+};
+
+// Evaluation of the sigmoid 1 / (1 + exp(-x)). Max absolute errors against the sigmoid computed in double precision,
+// measured on all floats of [-100;100]. benchmarkSigmoidModes() checks them on a sample and times each mode.
+enum class SigmoidMode
+{
+	Exact,		// expf() of the C library, not vectorized. Max error 8.9e-8, mostly the rounding of 1 / (1 + e)
+	Polynomial,	// exp by range reduction to 2^n * polynomial (Cephes expf), ~5x faster than Exact. Max error 8.9e-8
+	Rational,	// 0.5 + 0.5 tanh(x/2), tanh by a rational function (Eigen), no exponential. Max error 2.3e-7
+};
+
+struct Kernels
+{
+	KernelsISA	isa = KernelsISA::Scalar;
+	KernelsMode	mode = KernelsMode::Fast;
+	SigmoidMode	sigmoidMode = SigmoidMode::Polynomial;
+	bool		bVNNI = false;	// dot4U8S8 uses AVX-512 VNNI
+
+	// Returns sum(a[i] * b[i]), i in [0;n[
+	float	(*dot)(const float* a, const float* b, int n) = nullptr;
+
+	// Dot product of a with 4 rows of b: out[j] = sum(a[i] * b[j*bStride + i]), j in [0;4[
+	void	(*dot4)(const float* a, const float* b, int bStride, int n, float* out) = nullptr;
+
+	// y[i] += alpha * x[i], i in [0;n[
+	void	(*axpy)(float* y, float alpha, const float* x, int n) = nullptr;
+
+	// out[i] = (float)in[i] * scale, i in [0;n[. Same results on all paths: the conversion is exact, followed by one rounded multiply.
+	void	(*u8ToFloat)(float* out, const unsigned char* in, float scale, int n) = nullptr;
+
+	// Integer dot product of uint8 a with 4 rows of int8 b: out[j] = sum(a[i] * b[j*bStride + i]), i in [0;n[, j in [0;4[.
+	// Exact int32 sums, so identical on all paths: vpdpbusd with AVX-512 VNNI, else products widened to int16 and summed
+	// by pairs (pmaddwd). pmaddubsw is not used: its int16 pair sums saturate with uint8 inputs and full-range int8 weights.
+	void	(*dot4U8S8)(const uint8_t* a, const int8_t* b, int bStride, int n, int32_t* out) = nullptr;
+
+	// dot and dot4 with a stored as 16-bit floats: IEEE half precision (fp16) or bfloat16 (bf16, the upper half of a float32).
+	// Values of a are converted to float32 on the fly, which is exact, then summed in float32 with the lanes and strict
+	// mode of dot and dot4: results are those of dot on the converted values. Scalar and SSE4.2 convert in software.
+	float	(*dotF16)(const uint16_t* a, const float* b, int n) = nullptr;
+	float	(*dotBF16)(const uint16_t* a, const float* b, int n) = nullptr;
+	void	(*dot4F16)(const uint16_t* a, const float* b, int bStride, int n, float* out) = nullptr;
+	void	(*dot4BF16)(const uint16_t* a, const float* b, int bStride, int n, float* out) = nullptr;
+
+	// Sparse dot product of the non-zero weights of a CSR row with dense inputs: sum(values[k] * b[indices[k]]), k in [0;n[.
+	// Lanes and strict mode of dot, over k. Inputs are gathered (vgatherdps) with AVX2 and AVX-512, one by one otherwise.
+	float	(*sparseDot)(const float* values, const int32_t* indices, const float* b, int n) = nullptr;
+
+	// sparseDot of the same row with 4 rows of b: out[j] = sum(values[k] * b[j*bStride + indices[k]]), j in [0;4[
+	void	(*sparseDot4)(const float* values, const int32_t* indices, const float* b, int bStride, int n, float* out) = nullptr;
+
+	// Conversions of n values between float32 and fp16 or bf16. Rounding to nearest even, overflows give infinity, NaN stay
+	// NaN (made quiet): the software conversions match F16C, so results are identical on all paths.
+	void	(*floatToF16)(uint16_t* out, const float* in, int n) = nullptr;
+	void	(*floatToBF16)(uint16_t* out, const float* in, int n) = nullptr;
+	void	(*f16ToFloat)(float* out, const uint16_t* in, int n) = nullptr;
+	void	(*bf16ToFloat)(float* out, const uint16_t* in, int n) = nullptr;
+
+	// Box-Muller transform: out[2i] = sqrt(-2 ln(u1[i])) * cos(2 pi u2[i]), out[2i+1] = sqrt(-2 ln(u1[i])) * sin(2 pi u2[i]),
+	// i in [0;nbPairs[, with u1 in ]0;1] and u2 in [0;1[. log, sin and cos are branch-free polynomials (Cephes), max error ~1e-6.
+	// All paths run the same operations in the same order, without FMA: results are bit-for-bit identical in both modes.
+	void	(*boxMuller)(float* out, const float* u1, const float* u2, int nbPairs) = nullptr;
+
+	// out[i] = 1 / (1 + exp(-in[i])), i in [0;n[, evaluated as selected by sigmoidMode. out may be in.
+	// Approximations run the same operations on all paths, without FMA: results are bit-for-bit identical in both modes.
+	void	(*sigmoid)(float* out, const float* in, int n) = nullptr;
+
+	// out[i] = exp(in[i]), i in [0;n[. expf() in SigmoidMode::Exact, else the polynomial of SigmoidMode::Polynomial
+	// (max relative error 8.0e-8, results underflow to 0 below -88), identical on all paths. out may be in.
+	void	(*exp)(float* out, const float* in, int n) = nullptr;
+
+	// out[i] = tanh(in[i]), i in [0;n[. tanhf() in SigmoidMode::Exact, else the rational function of SigmoidMode::Rational
+	// (max error 2.4e-7), identical on all paths. out may be in.
+	void	(*tanh)(float* out, const float* in, int n) = nullptr;
+
+	// out[i] = in[i] > 0 ? in[i] : negativeSlope * in[i]: ReLU with negativeSlope = 0, leaky ReLU otherwise. out may be in.
+	void	(*relu)(float* out, const float* in, float negativeSlope, int n) = nullptr;
+
+	// Back propagation through an activation f: delta[i] *= f'(z[i]), with f' computed from the activations a[i] = f(z[i]),
+	// so that z does not need to be kept. sigmoid' = a (1 - a), tanh' = 1 - a^2, (leaky) ReLU' = a > 0 ? 1 : negativeSlope.
+	void	(*mulSigmoidDerivative)(float* delta, const float* a, int n) = nullptr;
+	void	(*mulTanhDerivative)(float* delta, const float* a, int n) = nullptr;
+	void	(*mulReluDerivative)(float* delta, const float* a, float negativeSlope, int n) = nullptr;
+};
+
+extern Kernels gKernels;
+
+KernelsISA	getBestSupportedKernelsISA();
+bool		initKernels(KernelsMode mode, KernelsISA isa = getBestSupportedKernelsISA());	// returns false if isa is not supported by the CPU
+const char*	getKernelsISAName(KernelsISA isa);
+void		setSigmoidMode(SigmoidMode mode);	// keeps the ISA and mode of initKernels()
+const char*	getSigmoidModeName(SigmoidMode mode);
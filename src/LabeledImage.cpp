@@ -1,4 +1,10 @@
 #include "LabeledImage.h"
+#include "Kernels.h"
+#include "Gzip.h"
+#include <climits>
+
+static const size_t kImagesHeaderSize = 16;
+static const size_t kLabelsHeaderSize = 8;
 
 static unsigned int _readU32(const unsigned char*& curDataPtr)
 {
@@ -18,102 +24,272 @@ static unsigned int _readU32(const unsigned char*& curDataPtr)
 	return u.u32;
 }
 
-static void _readFileData(const char* strFileName, std::vector<unsigned char>& buffer)
+// ===== IMAGES FILE FORMAT =====
+//[offset] [type]          [value]          [description]
+//0000     32 bit integer  0x00000803(2051) magic number
+//0004     32 bit integer  60000            number of images
+//0008     32 bit integer  28               number of rows
+//0012     32 bit integer  28               number of columns
+//0016     unsigned byte   ??               pixel
+//0017     unsigned byte   ??               pixel
+//........
+//xxxx     unsigned byte   ??               pixel
+// "Pixels are organized row-wise. Pixel values are 0 to 255. 0 means background (white), 255 means foreground (black)."
+static bool _checkImagesHeader(const char* strFileName, const unsigned char* header, int& outNbImages)
 {
-	FILE* f = fopen(strFileName, "rb");
-	assert(f);
-
-	fseek(f, 0, SEEK_END);
-	const long fileSize = ftell(f);
-	fseek(f, 0, SEEK_SET);
+	const unsigned char* curDataPtr = header;
+	const unsigned int magic	= _readU32(curDataPtr);
+	const unsigned int nbImages	= _readU32(curDataPtr);
+	const unsigned int nbRows	= _readU32(curDataPtr);
+	const unsigned int nbCols	= _readU32(curDataPtr);
+	if(magic != 0x00000803)
+	{
+		printf("Error: %s is not an IDX images file (magic number: 0x%08X)\n", strFileName, magic);
+		return false;
+	}
+	if(nbRows != IMG_SY || nbCols != IMG_SX)
+	{
+		printf("Error: %s holds %ux%u images, %dx%d expected\n", strFileName, nbCols, nbRows, IMG_SX, IMG_SY);
+		return false;
+	}
+	if(nbImages > INT_MAX / (IMG_SX*IMG_SY))
+	{
+		printf("Error: %s claims %u images, more than can be loaded\n", strFileName, nbImages);
+		return false;
+	}
+	outNbImages = (int)nbImages;
+	return true;
+}
 
-	buffer.resize(fileSize);
-	fread(buffer.data(), 1, fileSize, f);
-	
-	fclose(f);
+// ===== LABELS FILE FORMAT =====
+//[offset] [type]          [value]          [description]
+//0000     32 bit integer  0x00000801(2049) magic number (MSB first)
+//0004     32 bit integer  10000            number of items
+//0008     unsigned byte   ??               label
+//0009     unsigned byte   ??               label
+//........
+//xxxx     unsigned byte   ??               label
+static bool _checkLabelsHeader(const char* strFileName, const unsigned char* header, int nbImages)
+{
+	const unsigned char* curDataPtr = header;
+	const unsigned int magic	= _readU32(curDataPtr);
+	const unsigned int nbItems	= _readU32(curDataPtr);
+	if(magic != 0x00000801)
+	{
+		printf("Error: %s is not an IDX labels file (magic number: 0x%08X)\n", strFileName, magic);
+		return false;
+	}
+	if((int)nbItems != nbImages)
+	{
+		printf("Error: %s holds %u labels for %d images\n", strFileName, nbItems, nbImages);
+		return false;
+	}
+	return true;
 }
 
-static void _readImages(const char* strFileName, std::vector<LabeledImage>& labeledImages)
+static bool _checkLabels(const char* strFileName, const unsigned char* labels, int nbLabels)
 {
-	std::vector<unsigned char> buffer;
-	_readFileData(strFileName, buffer);
-	const unsigned char* curDataPtr = buffer.data();
-	
-	// ===== IMAGES FILE FORMAT =====
-	//[offset] [type]          [value]          [description]
-	//0000     32 bit integer  0x00000803(2051) magic number
-	//0004     32 bit integer  60000            number of images
-	//0008     32 bit integer  28               number of rows
-	//0012     32 bit integer  28               number of columns
-	//0016     unsigned byte   ??               pixel
-	//0017     unsigned byte   ??               pixel
-	//........
-	//xxxx     unsigned byte   ??               pixel
-	unsigned int magic		= _readU32(curDataPtr);
-	unsigned int nbImages	= _readU32(curDataPtr);
-	unsigned int nbRows		= _readU32(curDataPtr);	assert(nbRows == IMG_SY);
-	unsigned int nbCols		= _readU32(curDataPtr);	assert(nbCols == IMG_SX);
-
-	labeledImages.resize(nbImages);
-
-	// "Pixels are organized row-wise. Pixel values are 0 to 255. 0 means background (white), 255 means foreground (black)."
-	for(unsigned int idxCurImage=0 ; idxCurImage < nbImages ; idxCurImage++)
-	{
-		LabeledImage& img = labeledImages[idxCurImage];
-		for(int y=0 ; y < IMG_SY ; y++)
+	for(int idxCurItem=0 ; idxCurItem < nbLabels ; idxCurItem++)
+	{
+		if(labels[idxCurItem] > 9)
 		{
-			for(int x=0 ; x < IMG_SX ; x++)
-			{
-				img.data[x + y*IMG_SX] = *curDataPtr;
-				curDataPtr++;
-			}
+			printf("Error: %s: invalid label %d for image %d\n", strFileName, labels[idxCurItem], idxCurItem);
+			return false;
 		}
+	}
+	return true;
+}
 
-		img.updateFloatDataFromData();
+static bool _readImages(const char* strFileName, MappedFile& file, int& outNbImages)
+{
+	if(!file.open(strFileName))
+	{
+		printf("Error: can't open %s\n", strFileName);
+		return false;
 	}
+	if(file.getSize() < kImagesHeaderSize)
+	{
+		printf("Error: %s is too small for an IDX images file\n", strFileName);
+		return false;
+	}
+
+	int nbImages = 0;
+	if(!_checkImagesHeader(strFileName, file.getData(), nbImages))
+		return false;
+	if(file.getSize() < kImagesHeaderSize + (size_t)nbImages * IMG_SX*IMG_SY)
+	{
+		printf("Error: %s is truncated\n", strFileName);
+		return false;
+	}
+
+	outNbImages = nbImages;
+	return true;
 }
 
-void LabeledImage::updateFloatDataFromData()
+static bool _readLabels(const char* strFileName, MappedFile& file, int nbImages)
 {
-	for(int y=0 ; y < IMG_SY ; y++)
+	if(!file.open(strFileName))
 	{
-		for(int x=0 ; x < IMG_SX ; x++)
-		{
-			floatData[x + y*IMG_SX] = ((float)data[x + y*IMG_SX]) / 255.f;
-		}
+		printf("Error: can't open %s\n", strFileName);
+		return false;
+	}
+	if(file.getSize() < kLabelsHeaderSize)
+	{
+		printf("Error: %s is too small for an IDX labels file\n", strFileName);
+		return false;
 	}
+
+	if(!_checkLabelsHeader(strFileName, file.getData(), nbImages))
+		return false;
+	if(file.getSize() < kLabelsHeaderSize + (size_t)nbImages)
+	{
+		printf("Error: %s is truncated\n", strFileName);
+		return false;
+	}
+	return _checkLabels(strFileName, file.getData() + kLabelsHeaderSize, nbImages);
 }
 
-static void _readLabels(const char* strFileName, std::vector<LabeledImage>& labeledImages)
+// Streams a gzipped IDX file: the header is validated as soon as it is decompressed, then the payload is copied chunk by chunk
+// into outPayload (on the calling thread, while the next chunks are inflated). checkHeader() returns the payload size.
+// Bytes after the payload are ignored, as with the raw files. The payload size is not trusted before its bytes arrive:
+// outPayload grows with them, from a capped reservation, so that a corrupt header makes a truncated file, not a huge allocation.
+static bool _gunzipIdxFile(const char* strFileName, size_t headerSize, const std::function<bool(const unsigned char* header, size_t& outPayloadSize)>& checkHeader,
+						   AlignedVector<unsigned char>& outPayload)
 {
-	// ===== LABELS FILE FORMAT =====
-	//[offset] [type]          [value]          [description]
-	//0000     32 bit integer  0x00000801(2049) magic number (MSB first)
-	//0004     32 bit integer  10000            number of items
-	//0008     unsigned byte   ??               label
-	//0009     unsigned byte   ??               label
-	//........
-	//xxxx     unsigned byte   ??               label
+	unsigned char header[kImagesHeaderSize];
+	assert(headerSize <= sizeof(header));
+	size_t headerFill = 0;
+	size_t payloadSize = 0;
+	size_t payloadFill = 0;
+	bool bInvalidHeader = false;
 
-	std::vector<unsigned char> buffer;
-	_readFileData(strFileName, buffer);
-	const unsigned char* curDataPtr = buffer.data();
+	const bool bOk = gunzipFile(strFileName, [&](const unsigned char* data, size_t size)
+	{
+		if(headerFill < headerSize)
+		{
+			const size_t nbHeaderBytes = std::min(size, headerSize - headerFill);
+			memcpy(&header[headerFill], data, nbHeaderBytes);
+			headerFill += nbHeaderBytes;
+			data += nbHeaderBytes;
+			size -= nbHeaderBytes;
+			if(headerFill < headerSize)
+				return true;
 
-	unsigned int magic		= _readU32(curDataPtr);
-	unsigned int nbItems	= _readU32(curDataPtr);
-	assert(nbItems == labeledImages.size());
+			if(!checkHeader(header, payloadSize))
+			{
+				bInvalidHeader = true;
+				return false;
+			}
+			const size_t kMaxPayloadReservation = 64*1024*1024;	// more than the 47 MB of the MNIST training images
+			outPayload.clear();
+			outPayload.reserve(std::min(payloadSize, kMaxPayloadReservation));
+		}
+
+		const size_t nbPayloadBytes = std::min(size, payloadSize - payloadFill);
+		outPayload.insert(outPayload.end(), data, data + nbPayloadBytes);
+		payloadFill += nbPayloadBytes;
+		return true;
+	});
 
-	for(unsigned idxCurItem=0 ; idxCurItem < nbItems ; idxCurItem++)
+	if(bInvalidHeader)
+		return false;
+	if(!bOk)
+	{
+		printf("Error: can't read or decompress %s\n", strFileName);
+		return false;
+	}
+	if(headerFill < headerSize || payloadFill < payloadSize)
 	{
-		labeledImages[idxCurItem].label = *curDataPtr++;
+		printf("Error: %s is truncated\n", strFileName);
+		return false;
 	}
+	return true;
+}
+
+static bool _readImagesGz(const char* strFileName, AlignedVector<unsigned char>& outPixels, int& outNbImages)
+{
+	return _gunzipIdxFile(strFileName, kImagesHeaderSize, [&](const unsigned char* header, size_t& outPayloadSize)
+	{
+		if(!_checkImagesHeader(strFileName, header, outNbImages))
+			return false;
+		outPayloadSize = (size_t)outNbImages * IMG_SX*IMG_SY;
+		return true;
+	}, outPixels);
+}
+
+static bool _readLabelsGz(const char* strFileName, AlignedVector<unsigned char>& outLabels, int nbImages)
+{
+	const bool bOk = _gunzipIdxFile(strFileName, kLabelsHeaderSize, [&](const unsigned char* header, size_t& outPayloadSize)
+	{
+		if(!_checkLabelsHeader(strFileName, header, nbImages))
+			return false;
+		outPayloadSize = (size_t)nbImages;
+		return true;
+	}, outLabels);
+	return bOk && _checkLabels(strFileName, outLabels.data(), nbImages);
+}
+
+static bool _isGzFileName(const char* strFileName)
+{
+	const size_t length = strlen(strFileName);
+	return length >= 3 && strcmp(&strFileName[length - 3], ".gz") == 0;
+}
+
+void LabeledImage::convertToFloat(float* outData) const
+{
+	gKernels.u8ToFloat(outData, data, kPixelScale, IMG_SX*IMG_SY);
 }
 
-void readLabeledImages(const char* strImagesFileName, const char* strLabelsFileName, std::vector<LabeledImage>& labeledImages)
+bool LabeledImageSet::load(const char* strImagesFileName, const char* strLabelsFileName)
 {
+	clear();
+
+	int nbFileImages = 0;
 	printf("Reading images from %s ...\n", strImagesFileName);
-	_readImages(strImagesFileName, labeledImages);
+	const bool bGzImages = _isGzFileName(strImagesFileName);
+	if(bGzImages ? !_readImagesGz(strImagesFileName, m_ownedPixels, nbFileImages) : !_readImages(strImagesFileName, m_imagesFile, nbFileImages))
+	{
+		clear();
+		return false;
+	}
 
 	printf("Reading labels from %s ...\n", strLabelsFileName);
-	_readLabels(strLabelsFileName, labeledImages);
+	const bool bGzLabels = _isGzFileName(strLabelsFileName);
+	if(bGzLabels ? !_readLabelsGz(strLabelsFileName, m_ownedLabels, nbFileImages) : !_readLabels(strLabelsFileName, m_labelsFile, nbFileImages))
+	{
+		clear();
+		return false;
+	}
+
+	nbImages = nbFileImages;
+	pixels = bGzImages ? m_ownedPixels.data() : m_imagesFile.getData() + kImagesHeaderSize;
+	labels = bGzLabels ? m_ownedLabels.data() : m_labelsFile.getData() + kLabelsHeaderSize;
+	return true;
+}
+
+void LabeledImageSet::clear()
+{
+	nbImages = 0;
+	pixels = nullptr;
+	labels = nullptr;
+	m_imagesFile.close();
+	m_labelsFile.close();
+	AlignedVector<unsigned char>().swap(m_ownedPixels);
+	AlignedVector<unsigned char>().swap(m_ownedLabels);
+}
+
+void LabeledImageSet::gatherFloat(const int* imageIndices, int nbGatheredImages, float* outData, int outStride) const
+{
+	for(int i=0 ; i < nbGatheredImages ; i++)
+	{
+		assert(imageIndices[i] >= 0 && imageIndices[i] < nbImages);
+		gKernels.u8ToFloat(&outData[(size_t)i * outStride], getPixels(imageIndices[i]), kPixelScale, kImageSize);
+	}
+}
+
+void LabeledImageSet::gatherFloat(int idxFirstImage, int nbGatheredImages, float* outData, int outStride) const
+{
+	assert(idxFirstImage >= 0 && idxFirstImage + nbGatheredImages <= nbImages);
+	for(int i=0 ; i < nbGatheredImages ; i++)
+		gKernels.u8ToFloat(&outData[(size_t)i * outStride], getPixels(idxFirstImage + i), kPixelScale, kImageSize);
 }
@@ -1,19 +1,57 @@
 #pragma once
 
+#include "MappedFile.h"
+
 #define IMG_SX	28
 #define IMG_SY	28
 
+// Normalized pixel value = pixel * kPixelScale, in [0;1]
+const float kPixelScale = 1.f / 255.f;
+
+// View on an image and its label. Pixels are not owned: they point into a LabeledImageSet or any caller buffer.
+// Pixel values are 0 (background) to 255 (foreground), and are converted to normalized floats when gathered into a batch.
 struct LabeledImage
 {
-	unsigned char	data[IMG_SX*IMG_SY];
-	float			floatData[IMG_SX*IMG_SY];
-	char			label;
+	const unsigned char*	data = nullptr;	// IMG_SX*IMG_SY pixels, row-wise
+	unsigned char			label = 0;
 
 	void save(const char* strFileName) const
 	{
 		debugSavePGM(data, IMG_SX, IMG_SY, strFileName);
 	}
-	void updateFloatDataFromData();
+
+	// outData receives IMG_SX*IMG_SY values in [0;1]
+	void convertToFloat(float* outData) const;
 };
 
-void readLabeledImages(const char* strImagesFileName, const char* strLabelsFileName, std::vector<LabeledImage>& labeledImages);
+// Dataset in structure-of-arrays layout: the uint8 pixels of all images in one contiguous array, the labels in another.
+// Both arrays point directly into the memory mapped IDX files, so a dataset takes 785 bytes per image and no float copy:
+// pixels are converted to normalized floats by the batch gather functions, with a SIMD kernel.
+// Gzipped IDX files (.gz) are stream-decompressed into owned arrays with the same layout.
+struct LabeledImageSet
+{
+	static const int		kImageSize = IMG_SX*IMG_SY;
+
+	int						nbImages = 0;
+	const unsigned char*	pixels = nullptr;	// [nbImages x kImageSize]
+	const unsigned char*	labels = nullptr;	// [nbImages]
+
+	// Maps the IDX files, or decompresses them if their name ends with ".gz". Returns false if a file is missing or invalid.
+	bool	load(const char* strImagesFileName, const char* strLabelsFileName);
+	void	clear();
+
+	int				size() const	{ return nbImages; }
+	bool			empty() const	{ return nbImages == 0; }
+	LabeledImage	operator[](int idxImage) const	{ return LabeledImage{getPixels(idxImage), labels[idxImage]}; }
+	const unsigned char*	getPixels(int idxImage) const	{ return &pixels[(size_t)idxImage * kImageSize]; }
+
+	// Writes normalized pixels of the given images as rows of outStride floats. Padding after kImageSize values is left untouched.
+	void	gatherFloat(const int* imageIndices, int nbGatheredImages, float* outData, int outStride) const;
+	void	gatherFloat(int idxFirstImage, int nbGatheredImages, float* outData, int outStride) const;
+
+private:
+	MappedFile	m_imagesFile;
+	MappedFile	m_labelsFile;
+	AlignedVector<unsigned char>	m_ownedPixels;	// only used for .gz files
+	AlignedVector<unsigned char>	m_ownedLabels;
+};
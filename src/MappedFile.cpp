@@ -0,0 +1,102 @@
+#include "MappedFile.h"
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if(this != &other)
+	{
+		close();
+		std::swap(m_pData, other.m_pData);
+		std::swap(m_size, other.m_size);
+#ifdef _WIN32
+		std::swap(m_hFile, other.m_hFile);
+		std::swap(m_hMapping, other.m_hMapping);
+#endif
+	}
+	return *this;
+}
+
+bool MappedFile::open(const char* strFileName)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(strFileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize = {};
+	if(!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(!hMapping)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	void* pData = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if(!pData)
+	{
+		CloseHandle(hMapping);
+		CloseHandle(hFile);
+		return false;
+	}
+
+	m_hFile = hFile;
+	m_hMapping = hMapping;
+	m_pData = (const unsigned char*)pData;
+	m_size = (size_t)fileSize.QuadPart;
+#else
+	const int fd = ::open(strFileName, O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	struct stat fileStat = {};
+	if(fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* pData = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);	// the mapping keeps its own reference to the file
+	if(pData == MAP_FAILED)
+		return false;
+
+	m_pData = (const unsigned char*)pData;
+	m_size = (size_t)fileStat.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(!m_pData)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_pData);
+	CloseHandle((HANDLE)m_hMapping);
+	CloseHandle((HANDLE)m_hFile);
+	m_hMapping = nullptr;
+	m_hFile = nullptr;
+#else
+	munmap((void*)m_pData, m_size);
+#endif
+	m_pData = nullptr;
+	m_size = 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// Read-only memory mapping of a whole file. Pages are loaded by the OS on first access and shared with its file cache,
+// so mapping a large file is almost instant and its content is never duplicated in the process memory.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile()	{ close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept					{ *this = std::move(other); }
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	bool	open(const char* strFileName);	// returns false if the file can't be opened or mapped
+	void	close();
+
+	bool					isOpen() const		{ return m_pData != nullptr; }
+	const unsigned char*	getData() const		{ return m_pData; }
+	size_t					getSize() const		{ return m_size; }
+
+private:
+	const unsigned char*	m_pData = nullptr;
+	size_t					m_size = 0;
+#ifdef _WIN32
+	void*					m_hFile = nullptr;
+	void*					m_hMapping = nullptr;
+#endif
+};
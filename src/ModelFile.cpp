@@ -0,0 +1,192 @@
+#include "ModelFile.h"
+#include "NeuralNetwork.h"
+#include "Gzip.h"
+#ifdef _WIN32
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
+static uint32_t _computeHeaderCrc(const ModelFileHeader& header, const ModelFileLayer* layers)
+{
+	ModelFileHeader headerWithoutCrc = header;
+	headerWithoutCrc.headerCrc = 0;
+	const uint32_t crc = updateCrc32(0, &headerWithoutCrc, sizeof(headerWithoutCrc));
+	return updateCrc32(crc, layers, header.nbLayers * sizeof(ModelFileLayer));
+}
+
+void getModelFileLayers(const NeuralNetwork& nn, std::vector<ModelFileLayer>& outLayers)
+{
+	outLayers.assign(nn.layers.size(), ModelFileLayer());
+	for(size_t idxLayer=0 ; idxLayer < nn.layers.size() ; idxLayer++)
+	{
+		const Layer& layer = nn.layers[idxLayer];
+		ModelFileLayer& fileLayer = outLayers[idxLayer];
+		fileLayer.nbInputs = layer.nbInputs;
+		fileLayer.nbOutputs = layer.nbOutputs;
+		fileLayer.weightsStride = layer.weightsStride;
+		fileLayer.outputsStride = layer.outputsStride;
+		fileLayer.activation = (uint32_t)layer.activation;
+		fileLayer.parametersOffset = layer.parametersOffset;
+	}
+}
+
+static bool _flushFileToDisk(FILE* f)
+{
+	if(fflush(f) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(f)) == 0;
+#else
+	return fsync(fileno(f)) == 0;
+#endif
+}
+
+// Calls func(data, size) on the bytes of the parameters section: float32 parameters as is, else converted by chunks
+// into a fixed buffer, so that writing a 16-bit file does not allocate. Stops and returns false when func does.
+template<typename Func>
+static bool _forEachParametersChunk(const float* parameters, size_t nbParameters, WeightsFormat format, const Func& func)
+{
+	if(format == WeightsFormat::Float32)
+		return func(parameters, nbParameters * sizeof(float));
+
+	const size_t kChunkSize = 4096;
+	uint16_t chunk[kChunkSize];
+	for(size_t idxStart=0 ; idxStart < nbParameters ; idxStart += kChunkSize)
+	{
+		const size_t chunkSize = std::min(kChunkSize, nbParameters - idxStart);
+		convertFromFloat(format, chunk, &parameters[idxStart], chunkSize);
+		if(!func(chunk, chunkSize * sizeof(uint16_t)))
+			return false;
+	}
+	return true;
+}
+
+bool writeModelFile(const char* strFileName, const std::vector<ModelFileLayer>& layers, const float* parameters, size_t nbParameters, WeightsFormat format, bool bFlushToDisk)
+{
+	ModelFileHeader header = {};
+	memcpy(header.magic, kModelFileMagic, sizeof(header.magic));
+	header.version = kModelFileVersion;
+	header.nbLayers = (uint32_t)layers.size();
+	const size_t descriptorsEnd = sizeof(ModelFileHeader) + layers.size() * sizeof(ModelFileLayer);
+	header.parametersOffset = (descriptorsEnd + kModelFileAlignment - 1) & ~(uint64_t)(kModelFileAlignment - 1);
+	header.nbParameters = nbParameters;
+	header.parametersFormat = (uint32_t)format;
+
+	// 16-bit values are converted twice, for the CRC then for the file, rather than held in a copy of the parameters
+	uint32_t parametersCrc = 0;
+	_forEachParametersChunk(parameters, nbParameters, format, [&](const void* data, size_t size)
+	{
+		parametersCrc = updateCrc32(parametersCrc, data, size);
+		return true;
+	});
+	header.parametersCrc = parametersCrc;
+	header.headerCrc = _computeHeaderCrc(header, layers.data());
+
+	FILE* f = fopen(strFileName, "wb");
+	if(!f)
+	{
+		fprintf(stderr, "Failed to create model file: %s\n", strFileName);
+		return false;
+	}
+
+	static const unsigned char s_padding[kModelFileAlignment] = {};
+	const size_t paddingSize = header.parametersOffset - descriptorsEnd;
+	bool bSuccess = fwrite(&header, sizeof(header), 1, f) == 1;
+	bSuccess = bSuccess && fwrite(layers.data(), sizeof(ModelFileLayer), layers.size(), f) == layers.size();
+	bSuccess = bSuccess && fwrite(s_padding, 1, paddingSize, f) == paddingSize;
+	bSuccess = bSuccess && _forEachParametersChunk(parameters, nbParameters, format, [&](const void* data, size_t size)
+	{
+		return fwrite(data, 1, size, f) == size;
+	});
+	bSuccess = bSuccess && (!bFlushToDisk || _flushFileToDisk(f));
+	bSuccess = (fclose(f) == 0) && bSuccess;
+	if(!bSuccess)
+		fprintf(stderr, "Failed to write model file: %s\n", strFileName);
+	return bSuccess;
+}
+
+bool isModelFile(const unsigned char* data, size_t size)
+{
+	return size >= sizeof(kModelFileMagic) && memcmp(data, kModelFileMagic, sizeof(kModelFileMagic)) == 0;
+}
+
+bool parseModelFile(const unsigned char* data, size_t size, bool bVerifyParametersCrc, ModelFileView& outView, const char* strFileName)
+{
+	outView = ModelFileView();
+	if(!isModelFile(data, size))
+	{
+		fprintf(stderr, "Not a model file: %s\n", strFileName);
+		return false;
+	}
+	if(size < sizeof(ModelFileHeader))
+	{
+		fprintf(stderr, "Truncated model file: %s\n", strFileName);
+		return false;
+	}
+
+	const ModelFileHeader& header = *(const ModelFileHeader*)data;
+	if(header.version != 1 && header.version != kModelFileVersion)
+	{
+		fprintf(stderr, "Unsupported model file version %u (expected %u): %s\n", header.version, kModelFileVersion, strFileName);
+		return false;
+	}
+	if(header.parametersFormat > (uint32_t)WeightsFormat::BFloat16 || (header.version == 1 && header.parametersFormat != (uint32_t)WeightsFormat::Float32))
+	{
+		fprintf(stderr, "Unsupported parameters format %u in model file: %s\n", header.parametersFormat, strFileName);
+		return false;
+	}
+	const size_t valueSize = getWeightsFormatValueSize((WeightsFormat)header.parametersFormat);
+
+	// Sizes are checked against the file size before anything is read at these offsets
+	const uint64_t descriptorsEnd = sizeof(ModelFileHeader) + (uint64_t)header.nbLayers * sizeof(ModelFileLayer);
+	if(header.nbLayers == 0 || descriptorsEnd > header.parametersOffset || header.parametersOffset % kModelFileAlignment != 0
+		|| header.parametersOffset > size || header.nbParameters > (size - header.parametersOffset) / valueSize)
+	{
+		fprintf(stderr, "Truncated or invalid model file: %s\n", strFileName);
+		return false;
+	}
+
+	const ModelFileLayer* layers = (const ModelFileLayer*)(data + sizeof(ModelFileHeader));
+	if(_computeHeaderCrc(header, layers) != header.headerCrc)
+	{
+		fprintf(stderr, "Corrupted model file header (CRC mismatch): %s\n", strFileName);
+		return false;
+	}
+
+	uint64_t nbParameters = 0;
+	for(uint32_t idxLayer=0 ; idxLayer < header.nbLayers ; idxLayer++)
+	{
+		const ModelFileLayer& layer = layers[idxLayer];
+		const bool bValidSizes = layer.nbInputs > 0 && layer.nbInputs < (1 << 30) && layer.nbOutputs > 0 && layer.nbOutputs < (1 << 30)
+			&& (idxLayer == 0 || layer.nbInputs == layers[idxLayer-1].nbOutputs)
+			&& layer.weightsStride == padToCacheLine(layer.nbInputs) && layer.outputsStride == padToCacheLine(layer.nbOutputs);
+		const bool bValidActivation = layer.activation <= (uint32_t)Activation::Softmax
+			&& (layer.activation != (uint32_t)Activation::Softmax || idxLayer == header.nbLayers-1);
+		if(!bValidSizes || !bValidActivation || layer.parametersOffset != nbParameters)
+		{
+			fprintf(stderr, "Invalid layer %u in model file: %s\n", idxLayer, strFileName);
+			return false;
+		}
+		nbParameters += Layer::getNbParameters(layer.nbInputs, layer.nbOutputs);
+		if(nbParameters > header.nbParameters)
+			break;
+	}
+	if(nbParameters != header.nbParameters)
+	{
+		fprintf(stderr, "Invalid parameters section size in model file: %s\n", strFileName);
+		return false;
+	}
+
+	const unsigned char* parameters = data + header.parametersOffset;
+	if(bVerifyParametersCrc && updateCrc32(0, parameters, nbParameters * valueSize) != header.parametersCrc)
+	{
+		fprintf(stderr, "Corrupted model file parameters (CRC mismatch): %s\n", strFileName);
+		return false;
+	}
+
+	outView.pHeader = &header;
+	outView.layers = layers;
+	outView.parameters = parameters;
+	return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+// Versioned model file, written by NeuralNetwork::saveToFile(). Values are stored in the native byte order, little endian
+// on all supported targets. The file is laid out so that a read-only memory mapping of it can be used in place:
+//
+//   ModelFileHeader | ModelFileLayer x nbLayers | zero padding | parameters section
+//
+// The parameters section starts at a multiple of 64 bytes and holds NeuralNetwork::parameters as is: for each layer,
+// [weights (nbOutputs x weightsStride) | biases (outputsStride)], padding values 0. Layer blocks and weight rows are
+// multiples of a cache line, so every tensor is 64-byte aligned in the file and in a mapping of it.
+// Since version 2, parameters may be stored as fp16 or bf16 values (parametersFormat), with the same layout.
+
+const char		kModelFileMagic[8] = {'N', 'N', 'M', 'O', 'D', 'E', 'L', '\x1A'};
+const uint32_t	kModelFileVersion = 2;	// version 1 files, float32 only, are still read
+const size_t	kModelFileAlignment = 64;
+
+struct ModelFileHeader
+{
+	char		magic[8];			// kModelFileMagic
+	uint32_t	version;			// 1 or kModelFileVersion, other versions are rejected
+	uint32_t	nbLayers;
+	uint64_t	parametersOffset;	// in bytes from the start of the file, multiple of kModelFileAlignment
+	uint64_t	nbParameters;		// number of values of the parameters section
+	uint32_t	parametersCrc;		// CRC-32 of the parameters section
+	uint32_t	headerCrc;			// CRC-32 of the header, with headerCrc = 0, followed by the layer descriptors
+	uint32_t	parametersFormat;	// WeightsFormat enum value of the parameters, 0 (float32) in version 1 files
+	uint8_t		reserved[20];		// 0
+};
+static_assert(sizeof(ModelFileHeader) == 64, "ModelFileHeader is part of the file format");
+
+struct ModelFileLayer
+{
+	int32_t		nbInputs;
+	int32_t		nbOutputs;
+	int32_t		weightsStride;		// padToCacheLine(nbInputs)
+	int32_t		outputsStride;		// padToCacheLine(nbOutputs)
+	uint32_t	activation;			// Activation enum value
+	uint32_t	reserved;			// 0
+	uint64_t	parametersOffset;	// in floats from the start of the parameters section, as Layer::parametersOffset
+};
+static_assert(sizeof(ModelFileLayer) == 32, "ModelFileLayer is part of the file format");
+
+// Validated content of a model file in memory. Pointers are into the checked buffer.
+struct ModelFileView
+{
+	const ModelFileHeader*	pHeader = nullptr;
+	const ModelFileLayer*	layers = nullptr;		// pHeader->nbLayers descriptors
+	const void*				parameters = nullptr;	// pHeader->nbParameters values, in pHeader->parametersFormat
+};
+
+struct NeuralNetwork;
+enum class WeightsFormat;
+
+// Layer descriptors of nn, for writeModelFile()
+void	getModelFileLayers(const NeuralNetwork& nn, std::vector<ModelFileLayer>& outLayers);
+
+// Writes a model file. layers must describe parameters with the layout above. Parameters are converted to format on the fly.
+// bFlushToDisk only returns once the content has reached the disk (fsync), so that it survives a power loss.
+bool	writeModelFile(const char* strFileName, const std::vector<ModelFileLayer>& layers, const float* parameters, size_t nbParameters, WeightsFormat format, bool bFlushToDisk = false);
+
+// Returns true if data starts with kModelFileMagic. Files without it are legacy ones (see NeuralNetwork::initFromFile()).
+bool	isModelFile(const unsigned char* data, size_t size);
+
+// Checks the magic, version, header CRC, and that layers chain together with the layout above inside the buffer.
+// bVerifyParametersCrc also checks the CRC of the parameters section, which reads all of it.
+// Errors are printed with strFileName. data must be 64-byte aligned for the parameters to be usable in place.
+bool	parseModelFile(const unsigned char* data, size_t size, bool bVerifyParametersCrc, ModelFileView& outView, const char* strFileName);
@@ -1,272 +1,1186 @@
 #include "NeuralNetwork.h"
+#include "Kernels.h"
+#include "ThreadPool.h"
+#include "BatchPipeline.h"
+#include "Random.h"
+#include "ModelFile.h"
+#include <chrono>
+#include <cfloat>
 
-#define _USE_SIGMOID	// sigmoid or ReLU?
+static const char* s_activationNames[] = {"sigmoid", "tanh", "relu", "leakyrelu", "softmax"};
+static const char* s_weightsFormatNames[] = {"f32", "f16", "bf16"};
 
-static float activationFunc(float x)
+const char* getActivationName(Activation activation)
 {
-#ifdef _USE_SIGMOID
-	return 1.f / (1.f + expf(-x));	// logistic function
-#else
-	return x > 0.f ? x : 0.f;	// ReLU
-#endif
+	return s_activationNames[(int)activation];
 }
 
-static float dActivationFunc(float x)
+bool parseActivation(const char* strName, Activation& outActivation)
 {
-#ifdef _USE_SIGMOID
-	// from https://en.wikipedia.org/wiki/Logistic_function
-	const float fx = activationFunc(x);
-	return fx * (1.f-fx);
-#else
-	assert(false && "not implemented");
-#endif
+	for(int i=0 ; i < (int)std::size(s_activationNames) ; i++)
+	{
+		if(!strcmp(strName, s_activationNames[i]))
+		{
+			outActivation = (Activation)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* getWeightsFormatName(WeightsFormat format)
+{
+	return s_weightsFormatNames[(int)format];
+}
+
+bool parseWeightsFormat(const char* strName, WeightsFormat& outFormat)
+{
+	for(int i=0 ; i < (int)std::size(s_weightsFormatNames) ; i++)
+	{
+		if(!strcmp(strName, s_weightsFormatNames[i]))
+		{
+			outFormat = (WeightsFormat)i;
+			return true;
+		}
+	}
+	return false;
 }
 
-//template<int N>
-//void softMax(const float* inData, float* outData)
-//{
-//	double expData[N];
-//	double sumExpData = 0.;
-//	for(int i=0 ; i < N ; i++)
-//	{
-//		expData[i] = exp((double)inData[i]);
-//		sumExpData += expData[i];
-//	}
-//
-//	for(int i=0 ; i < N ; i++)
-//		outData[i] = (float)(expData[i] / sumExpData);
-//}
+size_t getWeightsFormatValueSize(WeightsFormat format)
+{
+	return format == WeightsFormat::Float32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+void convertFromFloat(WeightsFormat format, uint16_t* outValues, const float* values, size_t n)
+{
+	assert(format != WeightsFormat::Float32);
+	(format == WeightsFormat::Float16 ? gKernels.floatToF16 : gKernels.floatToBF16)(outValues, values, (int)n);
+}
+
+void convertToFloat(WeightsFormat format, float* outValues, const uint16_t* values, size_t n)
+{
+	assert(format != WeightsFormat::Float32);
+	(format == WeightsFormat::Float16 ? gKernels.f16ToFloat : gKernels.bf16ToFloat)(outValues, values, (int)n);
+}
+
+// Numerically stable: exponentials of z - max(z) are in ]0;1], so they neither overflow nor all underflow
+static void _softmax(float* outValues, const float* z, int n)
+{
+	float maxZ = z[0];
+	for(int i=1 ; i < n ; i++)
+		maxZ = std::max(maxZ, z[i]);
+	for(int i=0 ; i < n ; i++)
+		outValues[i] = z[i] - maxZ;
+
+	gKernels.exp(outValues, outValues, n);
+	float sumExp = 0.f;
+	for(int i=0 ; i < n ; i++)
+		sumExp += outValues[i];
+	const float invSumExp = 1.f / sumExp;	// >= 1 as exp(0) is one of the terms
+	for(int i=0 ; i < n ; i++)
+		outValues[i] *= invSumExp;
+}
+
+void applyActivation(Activation activation, float* outValues, const float* z, int n)
+{
+	switch(activation)
+	{
+		case Activation::Softmax:	_softmax(outValues, z, n); break;
+		case Activation::Tanh:		gKernels.tanh(outValues, z, n); break;
+		case Activation::ReLU:		gKernels.relu(outValues, z, 0.f, n); break;
+		case Activation::LeakyReLU:	gKernels.relu(outValues, z, kLeakyReLUSlope, n); break;
+		default:					gKernels.sigmoid(outValues, z, n); break;
+	}
+}
+
+// Computed from the activations, so that the backward pass needs neither z nor any exponential
+void Layer::multiplyByActivationDerivative(float* delta, const float* a, int n) const
+{
+	switch(activation)
+	{
+		case Activation::Tanh:		gKernels.mulTanhDerivative(delta, a, n); break;
+		case Activation::ReLU:		gKernels.mulReluDerivative(delta, a, 0.f, n); break;
+		case Activation::LeakyReLU:	gKernels.mulReluDerivative(delta, a, kLeakyReLUSlope, n); break;
+		case Activation::Softmax:	assert(false && "softmax is only differentiated together with the cross-entropy cost"); break;
+		default:					gKernels.mulSigmoidDerivative(delta, a, n); break;
+	}
+}
+
+// Cache-blocked GEMM: Out[nbRows x nbCols] = In[nbRows x n] * W[nbCols x n]^T, rows of In and W being contiguous.
+// - columns are processed by blocks whose W rows stay in L1 while all rows of In stream through
+// - rows of In are processed by tiles of 4, so that each W load is shared by 4 rows
+// epilogue(idxRow, idxCol, value) is called once per output value (e.g. to fuse bias add and activation).
+// W is float32 or 16-bit, read with the dot and dot4 kernels of its format.
+template<typename Weight, typename Epilogue>
+static void _gemmABt(const float* inData, int inStride, int nbRows, const Weight* w, int wStride, int nbCols, int n,
+	float (*dot)(const Weight*, const float*, int), void (*dot4)(const Weight*, const float*, int, int, float*), Epilogue epilogue)
+{
+	const int kColBlockBytes = 16*1024;
+	const int colBlockSize = std::max(1, kColBlockBytes / (wStride * (int)sizeof(Weight)));
+	for(int idxColBlock = 0 ; idxColBlock < nbCols ; idxColBlock += colBlockSize)
+	{
+		const int idxColBlockEnd = std::min(idxColBlock + colBlockSize, nbCols);
+
+		int idxRow = 0;
+		for( ; idxRow + 4 <= nbRows ; idxRow += 4)
+		{
+			for(int idxCol = idxColBlock ; idxCol < idxColBlockEnd ; idxCol++)
+			{
+				float tile[4];
+				dot4(&w[idxCol * wStride], &inData[idxRow * inStride], inStride, n, tile);
+				for(int i=0 ; i < 4 ; i++)
+					epilogue(idxRow+i, idxCol, tile[i]);
+			}
+		}
+
+		// Remaining rows (nbRows not multiple of 4)
+		for( ; idxRow < nbRows ; idxRow++)
+		{
+			for(int idxCol = idxColBlock ; idxCol < idxColBlockEnd ; idxCol++)
+				epilogue(idxRow, idxCol, dot(&w[idxCol * wStride], &inData[idxRow * inStride], n));
+		}
+	}
+}
 
-void Layer::feedForward(const float* inData, int nbInputValues, bool bDebugPrint, const char* message)
+// Same as _gemmABt() with the CSR weights of a pruned layer: each row of W is read once per tile of 4 rows of In
+template<typename Epilogue>
+static void _sparseGemmABt(const float* inData, int inStride, int nbRows, const SparseWeights& w, int nbCols, Epilogue epilogue)
+{
+	int idxRow = 0;
+	for( ; idxRow + 4 <= nbRows ; idxRow += 4)
+	{
+		for(int idxCol=0 ; idxCol < nbCols ; idxCol++)
+		{
+			const int idxStart = w.rowStarts[idxCol];
+			float tile[4];
+			gKernels.sparseDot4(&w.values[idxStart], &w.columns[idxStart], &inData[idxRow * inStride], inStride, w.getRowSize(idxCol), tile);
+			for(int i=0 ; i < 4 ; i++)
+				epilogue(idxRow+i, idxCol, tile[i]);
+		}
+	}
+	for( ; idxRow < nbRows ; idxRow++)
+	{
+		for(int idxCol=0 ; idxCol < nbCols ; idxCol++)
+		{
+			const int idxStart = w.rowStarts[idxCol];
+			epilogue(idxRow, idxCol, gKernels.sparseDot(&w.values[idxStart], &w.columns[idxStart], &inData[idxRow * inStride], w.getRowSize(idxCol)));
+		}
+	}
+}
+
+void Layer::feedForward(const float* inData, int nbInputValues, float* outNeuronValues) const
 {
 	assert(nbInputs == nbInputValues);
 
-	const int neuronSize = nbInputs + 1;	// number of weights + 1 for the bias
 	const int nbNeurons = nbOutputs;
-	for(int idxNeuron = 0 ; idxNeuron < nbNeurons ; idxNeuron++)
+	if(isSparse())
 	{
-		const int neuronOffset = idxNeuron * neuronSize;
-		float z = 0.f;
-		for(int idxInput=0 ; idxInput < nbInputs ; idxInput++)
-			z += weightsAndBias[neuronOffset + idxInput] * inData[idxInput];
-		z += weightsAndBias[neuronOffset + neuronSize - 1];	// bias
+		for(int idxNeuron = 0 ; idxNeuron < nbNeurons ; idxNeuron++)
+		{
+			const int idxStart = sparseWeights.rowStarts[idxNeuron];
+			outNeuronValues[idxNeuron] = gKernels.sparseDot(&sparseWeights.values[idxStart], &sparseWeights.columns[idxStart], inData,
+				sparseWeights.getRowSize(idxNeuron)) + biases[idxNeuron];
+		}
+	}
+	else if(weightsFormat == WeightsFormat::Float32)
+	{
+		for(int idxNeuron = 0 ; idxNeuron < nbNeurons ; idxNeuron++)
+			outNeuronValues[idxNeuron] = gKernels.dot(getNeuronWeights(idxNeuron), inData, weightsStride) + biases[idxNeuron];
+	}
+	else
+	{
+		const auto dotHalf = weightsFormat == WeightsFormat::Float16 ? gKernels.dotF16 : gKernels.dotBF16;
+		for(int idxNeuron = 0 ; idxNeuron < nbNeurons ; idxNeuron++)
+			outNeuronValues[idxNeuron] = dotHalf(&halfWeights[(size_t)idxNeuron * weightsStride], inData, weightsStride) + biases[idxNeuron];
+	}
+	applyActivation(outNeuronValues, outNeuronValues, nbNeurons);
+}
+
+void Layer::feedForwardBatch(const float* inData, int nbImages, int nbInputValues, LayerWorkspace& ws) const
+{
+	assert(nbInputs == nbInputValues);
+
+	const int nbNeurons = nbOutputs;
+	if((int)ws.batchNeuronValues.size() < nbImages*outputsStride)
+		ws.batchNeuronValues.resize(nbImages*outputsStride, 0.f);
 
-		zValues[idxNeuron] = z;
-		const float output = activationFunc(z);
-		neuronValues[idxNeuron] = output;
+	// Z[nbImages x nbNeurons] = In[nbImages x nbInputs] * W^T, with fused bias add, then vectorized activation of each row in place.
+	// Only activations are kept: the backward pass derives activation'(z) from them.
+	auto addBias = [&](int idxImage, int idxNeuron, float z)
+	{
+		ws.batchNeuronValues[idxImage * outputsStride + idxNeuron] = z + biases[idxNeuron];
+	};
+	if(isSparse())
+		_sparseGemmABt(inData, weightsStride, nbImages, sparseWeights, nbNeurons, addBias);
+	else switch(weightsFormat)
+	{
+	case WeightsFormat::Float16:
+		_gemmABt(inData, weightsStride, nbImages, halfWeights, weightsStride, nbNeurons, weightsStride, gKernels.dotF16, gKernels.dot4F16, addBias);
+		break;
+	case WeightsFormat::BFloat16:
+		_gemmABt(inData, weightsStride, nbImages, halfWeights, weightsStride, nbNeurons, weightsStride, gKernels.dotBF16, gKernels.dot4BF16, addBias);
+		break;
+	default:
+		_gemmABt(inData, weightsStride, nbImages, weights, weightsStride, nbNeurons, weightsStride, gKernels.dot, gKernels.dot4, addBias);
+		break;
+	}
+	for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+	{
+		float* values = &ws.batchNeuronValues[idxImage * outputsStride];
+		applyActivation(values, values, nbNeurons);	// padding stays 0
 	}
-	if(bDebugPrint)
-		debugPrintNeuronValues(message);
 }
 
-void Layer::resetBackpropCostGradient()
+void Layer::initRandom(uint64_t seed, ThreadPool* pThreadPool)
 {
-	const size_t size = backpropSumOfWeightsAndBiasCostPartialDerivative.size() * sizeof(backpropSumOfWeightsAndBiasCostPartialDerivative[0]);
-	memset(backpropSumOfWeightsAndBiasCostPartialDerivative.data(), 0, size);
+	float scale = 1.f;
+	if(activation == Activation::Tanh || activation == Activation::Softmax)
+		scale = sqrtf(1.f / (float)nbInputs);
+	else if(activation == Activation::ReLU || activation == Activation::LeakyReLU)
+		scale = sqrtf(2.f / (float)nbInputs);
+
+	auto scaleValues = [scale](float* values, int n)
+	{
+		if(scale != 1.f)
+		{
+			for(int i=0 ; i < n ; i++)
+				values[i] *= scale;
+		}
+	};
+
+	// Values are numbered row by row: weights of neuron i are [i*nbInputs; (i+1)*nbInputs[, then come the biases
+	const uint64_t key = randomStreamKey(seed, 0);
+	auto initNeurons = [&](int idxFirstNeuron, int idxEndNeuron)
+	{
+		for(int idxNeuron=idxFirstNeuron ; idxNeuron < idxEndNeuron ; idxNeuron++)
+		{
+			randomNormalFill(getNeuronWeights(idxNeuron), nbInputs, key, (uint64_t)idxNeuron * nbInputs);
+			scaleValues(getNeuronWeights(idxNeuron), nbInputs);
+		}
+	};
+
+	const int nbTasks = pThreadPool ? std::min(nbOutputs, pThreadPool->getNbThreads() * 4) : 1;
+	if(nbTasks <= 1)
+		initNeurons(0, nbOutputs);
+	else
+		pThreadPool->parallelFor(nbTasks, [&](int idxTask){ initNeurons(nbOutputs * idxTask / nbTasks, nbOutputs * (idxTask+1) / nbTasks); });
+
+	randomNormalFill(biases, nbOutputs, key, (uint64_t)nbOutputs * nbInputs);
+	scaleValues(biases, nbOutputs);
+	bTransposedWeightsDirty = true;
 }
 
-void Layer::computeBackpropagationValues(const Layer& nextLayer, const float* prevLayerActivations, int nbPrevLayerActivations)
+void Layer::updateTransposedWeights()
 {
-	assert(nextLayer.nbInputs == nbOutputs);
-	assert(nbPrevLayerActivations == nbInputs);
+	if(!bTransposedWeightsDirty)
+		return;
 
-	const int neuronSize = nbInputs + 1;	// number of weights + 1 for the bias
-	const int nbNeurons = nbOutputs;
-	const int nextLayerNeuronSize = nextLayer.nbOutputs + 1;	// number of weights + 1 for the bias
+	if(transposedWeights.size() != (size_t)nbInputs * outputsStride)
+		transposedWeights.assign((size_t)nbInputs * outputsStride, 0.f);
+
+	// Transpose by square tiles, so that both source rows and destination rows stay in cache
+	const int kTileSize = 8;
+	for(int idxNeuronTile=0 ; idxNeuronTile < nbOutputs ; idxNeuronTile += kTileSize)
+	{
+		const int idxNeuronTileEnd = std::min(idxNeuronTile + kTileSize, nbOutputs);
+		for(int idxInputTile=0 ; idxInputTile < nbInputs ; idxInputTile += kTileSize)
+		{
+			const int idxInputTileEnd = std::min(idxInputTile + kTileSize, nbInputs);
+			for(int idxNeuron=idxNeuronTile ; idxNeuron < idxNeuronTileEnd ; idxNeuron++)
+			{
+				for(int idxInput=idxInputTile ; idxInput < idxInputTileEnd ; idxInput++)
+					transposedWeights[idxInput * outputsStride + idxNeuron] = weights[idxNeuron * weightsStride + idxInput];
+			}
+		}
+	}
+	bTransposedWeightsDirty = false;
+}
+
+void Layer::updateHalfWeights()
+{
+	if(weightsFormat != WeightsFormat::Float32)
+		convertFromFloat(weightsFormat, halfWeights, weights, getNbWeights());
+}
+
+void Layer::pruneWeights(float sparsity)
+{
+	if(sparsity <= 0.f)
+	{
+		sparseWeights = SparseWeights();
+		return;
+	}
+
+	// Indices of the weights in weights[], padding excluded, the nbPruned first ones being those of smallest magnitude
+	std::vector<int32_t> weightIndices;
+	weightIndices.reserve((size_t)nbOutputs * nbInputs);
+	for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
+	{
+		for(int idxInput=0 ; idxInput < nbInputs ; idxInput++)
+			weightIndices.push_back(idxNeuron * weightsStride + idxInput);
+	}
+	const size_t nbPruned = std::min(weightIndices.size(), (size_t)llround((double)sparsity * weightIndices.size()));
+	std::nth_element(weightIndices.begin(), weightIndices.begin() + nbPruned, weightIndices.end(), [&](int32_t a, int32_t b)
+	{
+		const float absA = fabsf(weights[a]);
+		const float absB = fabsf(weights[b]);
+		return absA < absB || (absA == absB && a < b);
+	});
+	for(size_t i=0 ; i < nbPruned ; i++)
+		weights[weightIndices[i]] = 0.f;
+	bTransposedWeightsDirty = true;
+
+	sparseWeights.rowStarts.resize(nbOutputs + 1);
+	sparseWeights.columns.clear();
+	sparseWeights.values.clear();
 	for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
 	{
-		float delta = 0.f;
-		for(int idxNextLayerOutput=0 ; idxNextLayerOutput < nextLayer.nbOutputs ; idxNextLayerOutput++)
+		sparseWeights.rowStarts[idxNeuron] = sparseWeights.getNbNonZeros();
+		const float* neuronWeights = getNeuronWeights(idxNeuron);
+		for(int idxInput=0 ; idxInput < nbInputs ; idxInput++)
 		{
-			const int nextLayerNeuronOffset = idxNextLayerOutput * nextLayerNeuronSize;
-			const float nextLayerWeight = nextLayer.weightsAndBias[nextLayerNeuronOffset + idxNeuron];	// idxNeuron is in [0;nextLayer.nbInputs-1]
-			const float nextLayerDelta = nextLayer.backpropDelta[idxNextLayerOutput];	// TODO: can probably avoid re-reading same value every time?
-			delta += nextLayerDelta * nextLayerWeight;
+			if(neuronWeights[idxInput] != 0.f)
+			{
+				sparseWeights.columns.push_back(idxInput);
+				sparseWeights.values.push_back(neuronWeights[idxInput]);
+			}
 		}
+	}
+	sparseWeights.rowStarts[nbOutputs] = sparseWeights.getNbNonZeros();
+}
 
-		const float sigmaPrime = dActivationFunc(zValues[idxNeuron]);
-		delta *= sigmaPrime;
-		backpropDelta[idxNeuron] = delta;
+void Layer::updateSparseWeights()
+{
+	if(!isSparse())
+		return;
 
-		const int neuronOffset = idxNeuron * neuronSize;
+	// Columns of a row are increasing: a single walk of the row finds the kept weights
+	for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
+	{
+		float* neuronWeights = getNeuronWeights(idxNeuron);
+		int k = sparseWeights.rowStarts[idxNeuron];
+		const int kEnd = sparseWeights.rowStarts[idxNeuron+1];
 		for(int idxInput=0 ; idxInput < nbInputs ; idxInput++)
 		{
-			const float prevLayerActivation = prevLayerActivations[idxInput];
-			backpropSumOfWeightsAndBiasCostPartialDerivative[neuronOffset + idxInput] += delta * prevLayerActivation;
+			if(k < kEnd && sparseWeights.columns[k] == idxInput)
+				sparseWeights.values[k++] = neuronWeights[idxInput];
+			else
+				neuronWeights[idxInput] = 0.f;
 		}
-		backpropSumOfWeightsAndBiasCostPartialDerivative[neuronOffset + neuronSize - 1] += delta;
 	}
 }
 
-void Layer::computeBackpropagationValuesForLastLayer(float* expectedOutput, int nbExpectedOutputValues, const float* prevLayerActivations, int nbPrevLayerActivations)
+void Layer::addScaledCostGradientUnsynchronized(LayerWorkspace& ws, float alpha)
+{
+	const float* weightsGradient = ws.backpropSumOfWeightsCostPartialDerivative;
+	gKernels.axpy(biases, alpha, ws.backpropSumOfBiasesCostPartialDerivative, nbOutputs);
+
+	// Pruned layer: only the kept weights move, in weights, in the sparseWeights read by the forward passes and in the
+	// transposed copy, so that pruned weights stay 0 for the other threads. O(nbNonZeros).
+	if(isSparse())
+	{
+		for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
+		{
+			float* neuronWeights = getNeuronWeights(idxNeuron);
+			const float* neuronGradient = &weightsGradient[idxNeuron * weightsStride];
+			for(int k=sparseWeights.rowStarts[idxNeuron] ; k < sparseWeights.rowStarts[idxNeuron+1] ; k++)
+			{
+				const int idxInput = sparseWeights.columns[k];
+				const float delta = alpha * neuronGradient[idxInput];
+				neuronWeights[idxInput] += delta;
+				sparseWeights.values[k] = neuronWeights[idxInput];
+				transposedWeights[idxInput * outputsStride + idxNeuron] += delta;
+			}
+		}
+		return;
+	}
+
+	gKernels.axpy(weights, alpha, weightsGradient, (int)getNbWeights());
+
+	// Apply the same update to the transposed copy, so that other threads keep reading (almost) fresh weights.
+	// The gradients of an input are gathered once, then added to its contiguous row of the copy.
+	if(ws.inputGradient.size() != (size_t)outputsStride)
+		ws.inputGradient.assign(outputsStride, 0.f);
+	for(int idxInput=0 ; idxInput < nbInputs ; idxInput++)
+	{
+		for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
+			ws.inputGradient[idxNeuron] = weightsGradient[idxNeuron * weightsStride + idxInput];
+		gKernels.axpy(&transposedWeights[idxInput * outputsStride], alpha, ws.inputGradient.data(), nbOutputs);
+	}
+	updateHalfWeights();	// read by the forward passes instead of weights
+}
+
+void Layer::computeBatchBackpropagationValues(const Layer& nextLayer, const LayerWorkspace& nextLayerWs, const float* prevLayerActivations, int nbImages, int nbPrevLayerActivations, LayerWorkspace& ws) const
 {
-	assert(nbExpectedOutputValues == nbOutputs);
 	assert(nbPrevLayerActivations == nbInputs);
 
-	const int neuronSize = nbInputs + 1;	// number of weights + 1 for the bias
+	computeBatchBackpropagationDelta(nextLayer, nextLayerWs, nbImages, ws);
+	accumulateBatchCostGradient(prevLayerActivations, nbImages, ws);
+}
+
+void Layer::computeBatchBackpropagationDelta(const Layer& nextLayer, const LayerWorkspace& nextLayerWs, int nbImages, LayerWorkspace& ws) const
+{
+	assert(nextLayer.nbInputs == nbOutputs);
+
 	const int nbNeurons = nbOutputs;
-	for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
+	if((int)ws.batchBackpropDelta.size() < nbImages*outputsStride)
+		ws.batchBackpropDelta.resize(nbImages*outputsStride, 0.f);
+
+	// Delta[nbImages x nbNeurons] = (NextDelta[nbImages x nextLayer.nbOutputs] * NextW[nextLayer.nbOutputs x nbNeurons]) .* activation'(Z),
+	// activation'(Z) being computed from the activations.
+	// NextW is read through its transposed copy, so that this is a GEMM over contiguous rows like the forward pass.
+	_gemmABt(nextLayerWs.batchBackpropDelta.data(), nextLayer.outputsStride, nbImages, nextLayer.getInputTransposedWeights(0), nextLayer.outputsStride, nbNeurons, nextLayer.outputsStride,
+		gKernels.dot, gKernels.dot4, [&](int idxImage, int idxNeuron, float delta)
+		{
+			ws.batchBackpropDelta[idxImage * outputsStride + idxNeuron] = delta;
+		});
+	for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+		multiplyByActivationDerivative(&ws.batchBackpropDelta[idxImage * outputsStride], &ws.batchNeuronValues[idxImage * outputsStride], nbNeurons);
+}
+
+void Layer::computeBatchBackpropagationValuesForLastLayer(const float* expectedOutputs, int nbImages, const float* prevLayerActivations, int nbPrevLayerActivations, LayerWorkspace& ws) const
+{
+	assert(nbPrevLayerActivations == nbInputs);
+
+	const int nbNeurons = nbOutputs;
+	if((int)ws.batchBackpropDelta.size() < nbImages*outputsStride)
+		ws.batchBackpropDelta.resize(nbImages*outputsStride, 0.f);
+
+	if(activation == Activation::Softmax)
 	{
-		const int neuronOffset = idxNeuron * neuronSize;
-		const float dCostRelativeToActivation = 2.f * (neuronValues[idxNeuron] - expectedOutput[idxNeuron]);
-		const float delta = dCostRelativeToActivation * dActivationFunc(zValues[idxNeuron]);
-		backpropDelta[idxNeuron] = delta;
-		for(int idxInput=0 ; idxInput < nbInputs ; idxInput++)
+		// Cross-entropy cost -sum(y * ln(p)) through the softmax: dCost/dz = p - y, the Jacobian of the softmax cancels out
+		for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
 		{
-			const float prevLayerActivation = prevLayerActivations[idxInput];
-			backpropSumOfWeightsAndBiasCostPartialDerivative[neuronOffset + idxInput] += delta * prevLayerActivation;
+			for(int idxNeuron=0 ; idxNeuron < nbNeurons ; idxNeuron++)
+			{
+				const int i = idxImage * outputsStride + idxNeuron;
+				ws.batchBackpropDelta[i] = ws.batchNeuronValues[i] - expectedOutputs[i];
+			}
 		}
-		backpropSumOfWeightsAndBiasCostPartialDerivative[neuronOffset + neuronSize - 1] += delta;
 	}
+	else
+	{
+		// Squared error cost sum((a - y)^2): dCost/dz = 2 * (a - y) * activation'(z)
+		for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+		{
+			for(int idxNeuron=0 ; idxNeuron < nbNeurons ; idxNeuron++)
+			{
+				const int i = idxImage * outputsStride + idxNeuron;
+				ws.batchBackpropDelta[i] = 2.f * (ws.batchNeuronValues[i] - expectedOutputs[i]);	// dCost/dActivation
+			}
+			multiplyByActivationDerivative(&ws.batchBackpropDelta[idxImage * outputsStride], &ws.batchNeuronValues[idxImage * outputsStride], nbNeurons);
+		}
+	}
+
+	accumulateBatchCostGradient(prevLayerActivations, nbImages, ws);
+}
+
+void Layer::accumulateBatchCostGradient(const float* prevLayerActivations, int nbImages, LayerWorkspace& ws) const
+{
+	const int nbNeurons = nbOutputs;
+
+	// Weights gradient GEMM: dCost/dW[nbNeurons x nbInputs] += Delta^T[nbNeurons x nbImages] * In[nbImages x nbInputs]
+	// Inputs and neurons are processed by blocks, so that the gradient block being updated stays in L1 while all images stream through.
+	const int kInputBlockSize = 256;
+	const int kNeuronBlockSize = 16;
+	for(int idxInputBlock=0 ; idxInputBlock < weightsStride ; idxInputBlock += kInputBlockSize)
+	{
+		const int inputBlockSize = std::min(kInputBlockSize, weightsStride - idxInputBlock);
+		for(int idxNeuronBlock=0 ; idxNeuronBlock < nbNeurons ; idxNeuronBlock += kNeuronBlockSize)
+		{
+			const int idxNeuronBlockEnd = std::min(idxNeuronBlock + kNeuronBlockSize, nbNeurons);
+			for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+			{
+				const float* imgDelta = &ws.batchBackpropDelta[idxImage * outputsStride];
+				const float* imgActivations = &prevLayerActivations[idxImage * weightsStride + idxInputBlock];
+				for(int idxNeuron=idxNeuronBlock ; idxNeuron < idxNeuronBlockEnd ; idxNeuron++)
+				{
+					float* gradient = &ws.backpropSumOfWeightsCostPartialDerivative[idxNeuron * weightsStride + idxInputBlock];
+					gKernels.axpy(gradient, imgDelta[idxNeuron], imgActivations, inputBlockSize);
+				}
+			}
+		}
+	}
+
+	// Bias gradient: sum of deltas over the batch
+	for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+		gKernels.axpy(ws.backpropSumOfBiasesCostPartialDerivative, 1.f, &ws.batchBackpropDelta[idxImage * outputsStride], nbNeurons);
+}
+
+void LayerWorkspace::init(const Layer& layer, float* layerCostGradient)
+{
+	batchNeuronValues.clear();
+	batchBackpropDelta.clear();
+	inputGradient.clear();
+	backpropSumOfWeightsCostPartialDerivative = layerCostGradient;
+	backpropSumOfBiasesCostPartialDerivative = layerCostGradient + layer.getNbWeights();
+}
+
+void NetworkWorkspace::init(const NeuralNetwork& nn)
+{
+	// Mapped networks are read-only: no cost gradient
+	costGradient.assign(nn.isMapped() ? 0 : nn.getNbParameters(), 0.f);
+	layers.resize(nn.getNbLayers());
+	for(int idxLayer=0 ; idxLayer < nn.getNbLayers() ; idxLayer++)
+	{
+		const Layer& layer = nn.layers[idxLayer];
+		layers[idxLayer].init(layer, costGradient.empty() ? nullptr : &costGradient[layer.parametersOffset]);
+	}
+	batchInputValues.clear();
+	batchExpectedOutputValues.clear();
 }
 
-void NeuralNetwork::initRandom()
+NeuralNetwork& NeuralNetwork::operator=(const NeuralNetwork& other)
+{
+	if(this == &other)
+		return *this;
+
+	// A copy of a mapped network owns its parameters
+	layers = other.layers;
+	mappedFile.close();
+	parameters.assign(other.getParameters(), other.getParameters() + other.getNbParameters());
+	halfParameters = other.halfParameters;
+	bindParameters(parameters.data());
+	return *this;
+}
+
+bool NeuralNetwork::init(const std::vector<int>& layerSizes, const std::vector<Activation>& activations)
+{
+	if(!initLayers(layerSizes, activations))
+		return false;
+
+	parameters.assign(getNbParameters(), 0.f);
+	bindParameters(parameters.data());
+	return true;
+}
+
+// Validates the topology and sets the layer sizes and offsets, without binding any parameters
+bool NeuralNetwork::initLayers(const std::vector<int>& layerSizes, const std::vector<Activation>& activations)
+{
+	if(layerSizes.size() < 2 || *std::min_element(layerSizes.begin(), layerSizes.end()) <= 0)
+	{
+		fprintf(stderr, "Invalid neural network layer sizes\n");
+		return false;
+	}
+	if(!activations.empty() && activations.size() != layerSizes.size() - 1)
+	{
+		fprintf(stderr, "Invalid neural network activations: %d layers, %d activations\n", (int)layerSizes.size() - 1, (int)activations.size());
+		return false;
+	}
+	if(!activations.empty() && std::find(activations.begin(), activations.end() - 1, Activation::Softmax) != activations.end() - 1)
+	{
+		fprintf(stderr, "Invalid neural network activations: softmax is only supported by the last layer\n");
+		return false;
+	}
+
+	// Layer blocks are multiples of a cache line: each one starts aligned in the buffer
+	const int nbLayers = (int)layerSizes.size() - 1;
+	mappedFile.close();
+	layers.assign(nbLayers, Layer());
+	AlignedVector<uint16_t>().swap(halfParameters);
+	size_t nbParameters = 0;
+	for(int idxLayer=0 ; idxLayer < nbLayers ; idxLayer++)
+	{
+		Layer& layer = layers[idxLayer];
+		layer.resize(layerSizes[idxLayer], layerSizes[idxLayer+1]);
+		layer.activation = activations.empty() ? Activation::Sigmoid : activations[idxLayer];
+		layer.parametersOffset = nbParameters;
+		nbParameters += layer.getNbParameters();
+	}
+	return true;
+}
+
+// networkParameters holds getNbParameters() values: owned parameters, or the parameters section of mappedFile
+void NeuralNetwork::bindParameters(float* networkParameters)
+{
+	for(Layer& layer : layers)
+		layer.bindParameters(networkParameters + layer.parametersOffset);
+	bindHalfParameters();
+
+	workspace.init(*this);
+	threadWorkspaces.clear();
+}
+
+void NeuralNetwork::bindHalfParameters()
+{
+	for(Layer& layer : layers)
+		layer.halfWeights = halfParameters.empty() ? nullptr : &halfParameters[layer.parametersOffset];
+}
+
+void NeuralNetwork::setWeightsFormat(WeightsFormat format)
+{
+	for(Layer& layer : layers)
+		layer.weightsFormat = format;
+	if(format == WeightsFormat::Float32)
+		AlignedVector<uint16_t>().swap(halfParameters);
+	else
+		halfParameters.assign(getNbParameters(), 0);
+	bindHalfParameters();
+	updateHalfParameters();
+}
+
+// Biases and padding are converted too: the whole span is converted at once
+void NeuralNetwork::updateHalfParameters()
+{
+	if(!halfParameters.empty())
+		convertFromFloat(getWeightsFormat(), halfParameters.data(), getParameters(), getNbParameters());
+}
+
+void NeuralNetwork::updateDerivedWeights()
+{
+	for(Layer& layer : layers)
+		layer.updateSparseWeights();
+	updateHalfParameters();
+}
+
+void NeuralNetwork::pruneWeights(int idxLayer, float sparsity)
+{
+	assert(!isMapped());
+	layers[idxLayer].pruneWeights(sparsity);
+	updateHalfParameters();
+}
+
+bool NeuralNetwork::initRandom(const std::vector<int>& layerSizes, uint64_t seed, ThreadPool* pThreadPool)
+{
+	return initRandom(layerSizes, std::vector<Activation>(), seed, pThreadPool);
+}
+
+bool NeuralNetwork::initRandom(const std::vector<int>& layerSizes, const std::vector<Activation>& activations, uint64_t seed, ThreadPool* pThreadPool)
 {
 	// https://www.youtube.com/watch?v=aircAruvnKk&t=262s
-	// Architecture:
+	// Default architecture:
 	// - layer 0: 28*28 = 784 outputs, 16 outputs
 	// - layer 1: 16 inputs, 16 outputs
 	// - layer 2: 16 inputs, 10 outputs
-	
-	layers[0].initRandom(IMG_SX*IMG_SY, 16);
-	layers[1].initRandom(16, 16);
-	layers[2].initRandom(16, 10);
+	if(!init(layerSizes, activations))
+		return false;
 
-	//layers[0].initRandom(IMG_SX*IMG_SY, 32);
-	//layers[1].initRandom(32, 32);
-	//layers[2].initRandom(32, 10);
+	for(int idxLayer=0 ; idxLayer < getNbLayers() ; idxLayer++)
+		layers[idxLayer].initRandom(randomStreamKey(seed, idxLayer), pThreadPool);
+	return true;
+}
+
+// Topology of a parsed model file, as init() arguments
+static void _getModelFileTopology(const ModelFileView& view, std::vector<int>& outLayerSizes, std::vector<Activation>& outActivations)
+{
+	const uint32_t nbLayers = view.pHeader->nbLayers;
+	outLayerSizes.assign(1, view.layers[0].nbInputs);
+	outActivations.clear();
+	for(uint32_t idxLayer=0 ; idxLayer < nbLayers ; idxLayer++)
+	{
+		outLayerSizes.push_back(view.layers[idxLayer].nbOutputs);
+		outActivations.push_back((Activation)view.layers[idxLayer].activation);
+	}
 }
 
 bool NeuralNetwork::initFromFile(const char* fileName)
 {
-	FILE* f = fopen(fileName, "rb");
-	if(!f)
+	MappedFile file;
+	if(!file.open(fileName))
 	{
 		fprintf(stderr, "Failed to init neural network from file: %s\n", fileName);
 		return false;
 	}
-	for(Layer& layer : layers)
-		layer.readFromFile(f);
-	fclose(f);
+	if(!isModelFile(file.getData(), file.getSize()))
+		return initFromLegacyFile(fileName);
+
+	ModelFileView view;
+	if(!parseModelFile(file.getData(), file.getSize(), true, view, fileName))
+		return false;
+
+	// parseModelFile() checked that the file has the layout of init(): the parameters section is copied as a whole
+	std::vector<int> layerSizes;
+	std::vector<Activation> activations;
+	_getModelFileTopology(view, layerSizes, activations);
+	if(!init(layerSizes, activations))
+		return false;
+	assert(parameters.size() == view.pHeader->nbParameters);
+	const WeightsFormat format = (WeightsFormat)view.pHeader->parametersFormat;
+	if(format == WeightsFormat::Float32)
+		memcpy(parameters.data(), view.parameters, parameters.size() * sizeof(float));
+	else
+	{
+		convertToFloat(format, parameters.data(), (const uint16_t*)view.parameters, parameters.size());
+		setWeightsFormat(format);
+	}
 	return true;
 }
 
-bool NeuralNetwork::saveToFile(const char* fileName)
+bool NeuralNetwork::mapFromFile(const char* fileName, bool bVerifyCrc)
 {
-	FILE* f = fopen(fileName, "wb");
+	MappedFile file;
+	if(!file.open(fileName))
+	{
+		fprintf(stderr, "Failed to map neural network from file: %s\n", fileName);
+		return false;
+	}
+	if(!isModelFile(file.getData(), file.getSize()))
+	{
+		fprintf(stderr, "Legacy neural network files can't be mapped, import them with initFromFile(): %s\n", fileName);
+		return false;
+	}
+
+	ModelFileView view;
+	if(!parseModelFile(file.getData(), file.getSize(), bVerifyCrc, view, fileName))
+		return false;
+	if(view.pHeader->parametersFormat != (uint32_t)WeightsFormat::Float32)
+	{
+		fprintf(stderr, "16-bit model files can't be mapped, load them with initFromFile(): %s\n", fileName);
+		return false;
+	}
+	assert((uintptr_t)view.parameters % kModelFileAlignment == 0);	// mappings are page aligned
+
+	std::vector<int> layerSizes;
+	std::vector<Activation> activations;
+	_getModelFileTopology(view, layerSizes, activations);
+	if(!initLayers(layerSizes, activations))
+		return false;
+
+	// Layers point into the read-only mapping: writing weights would fault, training functions assert !isMapped()
+	AlignedVector<float>().swap(parameters);
+	mappedFile = std::move(file);
+	bindParameters(const_cast<float*>((const float*)view.parameters));
+	return true;
+}
+
+bool NeuralNetwork::initFromLegacyFile(const char* fileName)
+{
+	FILE* f = fopen(fileName, "rb");
 	if(!f)
 	{
-		fprintf(stderr, "Failed to save neural network to file: %s\n", fileName);
+		fprintf(stderr, "Failed to init neural network from file: %s\n", fileName);
 		return false;
 	}
+	Defer(fclose(f));
+
+	// The file has no layer count: walk the layer headers first, to allocate the parameters of all layers at once
+	std::vector<int> layerSizes;
+	int layerSize[2] = {};
+	while(fread(layerSize, sizeof(layerSize), 1, f) == 1)
+	{
+		if(layerSize[0] <= 0 || layerSize[1] <= 0 || (!layerSizes.empty() && layerSize[0] != layerSizes.back()))
+		{
+			fprintf(stderr, "Invalid layer sizes in neural network file: %s\n", fileName);
+			return false;
+		}
+		if(layerSizes.empty())
+			layerSizes.push_back(layerSize[0]);
+		layerSizes.push_back(layerSize[1]);
+		fseek(f, (long)layerSize[1] * (layerSize[0] + 1) * (long)sizeof(float), SEEK_CUR);
+	}
+
+	if(!init(layerSizes))
+		return false;
+
+	rewind(f);
 	for(Layer& layer : layers)
-		layer.saveToFile(f);
-	fclose(f);
+	{
+		if(!layer.readFromLegacyFile(f))
+		{
+			fprintf(stderr, "Truncated neural network file: %s\n", fileName);
+			return false;
+		}
+	}
 	return true;
 }
 
-void NeuralNetwork::feedForward(const LabeledImage& img, bool bDebugPrint)
+bool NeuralNetwork::checkImageTopology(const char* fileName) const
+{
+	const int nbInputs = layers.empty() ? 0 : layers[0].nbInputs;
+	const int nbOutputs = layers.empty() ? 0 : getLastLayer().nbOutputs;
+	if(nbInputs == IMG_SX*IMG_SY && nbOutputs == 10)
+		return true;
+
+	fprintf(stderr, "%s has %d inputs and %d outputs, not %d and 10: it can't classify images\n", fileName, nbInputs, nbOutputs, IMG_SX*IMG_SY);
+	return false;
+}
+
+bool NeuralNetwork::saveToFile(const char* fileName) const
+{
+	std::vector<ModelFileLayer> fileLayers;
+	getModelFileLayers(*this, fileLayers);
+	return writeModelFile(fileName, fileLayers, getParameters(), getNbParameters(), getWeightsFormat());
+}
+
+void InferenceWorkspace::init(const NeuralNetwork& nn)
 {
+	inputValues.assign(nn.layers[0].weightsStride, 0.f);
+	neuronValues.resize(nn.getNbLayers());
+	for(int idxLayer=0 ; idxLayer < nn.getNbLayers() ; idxLayer++)
+		neuronValues[idxLayer].assign(nn.layers[idxLayer].outputsStride, 0.f);
+}
+
+void InferenceWorkspace::debugPrintNeuronValues() const
+{
+	for(int idxLayer=0 ; idxLayer < (int)neuronValues.size() ; idxLayer++)
+	{
+		printf("Neuron values layer %d:\n", idxLayer);
+		for(int i=0 ; i < (int)neuronValues[idxLayer].size() ; i++)
+			printf("[%d]: %.6f\n", i, neuronValues[idxLayer][i]);
+	}
+}
+
+int NeuralNetwork::predict(const LabeledImage& img, InferenceWorkspace& ws) const
+{
+	assert((int)ws.inputValues.size() == layers[0].weightsStride);	// ws.init() not called for this network
+	img.convertToFloat(ws.inputValues.data());
+	return predict(ws.inputValues.data(), ws);
+}
+
+int NeuralNetwork::predict(const float* inData, InferenceWorkspace& ws) const
+{
+	assert((int)ws.neuronValues.size() == getNbLayers());	// ws.init() not called for this network
+	for(int idxLayer=0 ; idxLayer < getNbLayers() ; idxLayer++)
+		assert((int)ws.neuronValues[idxLayer].size() == layers[idxLayer].outputsStride);	// ws.init() not called for this network
+
 	// layers[0] <- img
-	layers[0].feedForward(img.floatData, IMG_SX*IMG_SY, bDebugPrint, "layer 0");
+	static_assert((IMG_SX*IMG_SY) % kNbFloatsPerCacheLine == 0, "image data is used as a padded input row");
+	layers[0].feedForward(inData, IMG_SX*IMG_SY, ws.neuronValues[0].data());
 
-	// layers[1] <- layers[0]
-	layers[1].feedForward(layers[0], bDebugPrint, "layer 1");
+	// layers[idxLayer] <- layers[idxLayer-1]
+	for(int idxLayer=1 ; idxLayer < getNbLayers() ; idxLayer++)
+		layers[idxLayer].feedForward(ws.neuronValues[idxLayer-1].data(), layers[idxLayer-1].nbOutputs, ws.neuronValues[idxLayer].data());
 
-	// layers[2] <- layers[1]
-	layers[2].feedForward(layers[1], bDebugPrint, "layer 2");
+	const Layer& lastLayer = getLastLayer();
+	const float* outputs = ws.neuronValues.back().data();
+	int answer = 0;
+	for(int i=1 ; i < lastLayer.nbOutputs ; i++)
+		answer = outputs[i] > outputs[answer] ? i : answer;
+	return answer;
 }
 
-void NeuralNetwork::backPropagateImages(const std::vector<const LabeledImage*>& images, std::vector<std::vector<float>>& outCostGradient)
+void NeuralNetwork::feedForwardBatch(const LabeledImageSet& images, int idxFirstImage, int nbImages)
 {
-	resetBackpropCostGradient();
+	const int inputStride = layers[0].weightsStride;
+	workspace.batchInputValues.resize(nbImages * inputStride, 0.f);
+	images.gatherFloat(idxFirstImage, nbImages, workspace.batchInputValues.data(), inputStride);
 
-	for(const LabeledImage* pImage : images)
+	feedForwardBatchInputValues(workspace.batchInputValues.data(), nbImages, workspace);
+}
+
+void NeuralNetwork::feedForwardBatch(const LabeledImageSet& images, const std::vector<int>& imageIndices)
+{
+	gatherBatchInputValues(images, imageIndices.data(), (int)imageIndices.size(), workspace);
+	feedForwardBatchInputValues(workspace.batchInputValues.data(), (int)imageIndices.size(), workspace);
+}
+
+void NeuralNetwork::gatherBatchInputValues(const LabeledImageSet& images, const int* imageIndices, int nbImages, NetworkWorkspace& ws) const
+{
+	const int inputStride = layers[0].weightsStride;
+	ws.batchInputValues.resize(nbImages * inputStride, 0.f);
+	images.gatherFloat(imageIndices, nbImages, ws.batchInputValues.data(), inputStride);
+}
+
+void NeuralNetwork::feedForwardBatchInputValues(const float* inputValues, int nbImages, NetworkWorkspace& ws) const
+{
+	layers[0].feedForwardBatch(inputValues, nbImages, IMG_SX*IMG_SY, ws.layers[0]);
+	for(int idxLayer=1 ; idxLayer < getNbLayers() ; idxLayer++)
+		layers[idxLayer].feedForwardBatch(ws.layers[idxLayer-1].batchNeuronValues.data(), nbImages, layers[idxLayer-1].nbOutputs, ws.layers[idxLayer]);
+}
+
+// Index of the highest output neuron for image idxImage of last feedForwardBatch() call
+int NeuralNetwork::getBatchAnswer(int idxImage) const
+{
+	const Layer& lastLayer = getLastLayer();
+	const float* outputs = &workspace.layers.back().batchNeuronValues[idxImage * lastLayer.outputsStride];
+	int answer = 0;
+	for(int i=1 ; i < lastLayer.nbOutputs ; i++)
+		answer = outputs[i] > outputs[answer] ? i : answer;
+	return answer;
+}
+
+// Accumulates the cost partial derivatives of images into ws
+void NeuralNetwork::backPropagateBatch(const LabeledImageSet& images, const int* imageIndices, int nbImages, NetworkWorkspace& ws) const
+{
+	gatherBatchInputValues(images, imageIndices, nbImages, ws);
+
+	const Layer& lastLayer = getLastLayer();
+	ws.batchExpectedOutputValues.assign(nbImages * lastLayer.outputsStride, 0.f);
+	for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+		ws.batchExpectedOutputValues[idxImage * lastLayer.outputsStride + images.labels[imageIndices[idxImage]]] = 1.f;
+
+	backPropagateBatchValues(ws.batchInputValues.data(), ws.batchExpectedOutputValues.data(), nbImages, ws);
+}
+
+// Same with inputs and expected outputs already gathered, as rows of layers[0].weightsStride and lastLayer.outputsStride values
+void NeuralNetwork::backPropagateBatchValues(const float* inputValues, const float* expectedOutputValues, int nbImages, NetworkWorkspace& ws) const
+{
+	feedForwardBatchInputValues(inputValues, nbImages, ws);
+
+	// Activations feeding layer idxLayer: the inputs for the first layer
+	auto getPrevLayerActivations = [&](int idxLayer) -> const float*
 	{
-		const LabeledImage& img = *pImage;
+		return idxLayer == 0 ? inputValues : ws.layers[idxLayer-1].batchNeuronValues.data();
+	};
 
-		//feedForward(img, true);
-		feedForward(img, false);
+	const int idxLastLayer = getNbLayers()-1;
+	const Layer& lastLayer = layers[idxLastLayer];
+	lastLayer.computeBatchBackpropagationValuesForLastLayer(expectedOutputValues, nbImages, getPrevLayerActivations(idxLastLayer), lastLayer.nbInputs, ws.layers[idxLastLayer]);
 
-		float expectedOutput[10] = {0};
-		expectedOutput[img.label] = 1.f;
+	// Compute layer idxLayer with next layer (idxLayer+1) as input
+	for(int idxLayer = idxLastLayer-1 ; idxLayer >= 0 ; idxLayer--)
+		layers[idxLayer].computeBatchBackpropagationValues(layers[idxLayer+1], ws.layers[idxLayer+1], getPrevLayerActivations(idxLayer), nbImages, layers[idxLayer].nbInputs, ws.layers[idxLayer]);
+}
 
-		Layer& lastLayer = layers[_countof(layers)-1];
-		Layer& prevToLastLayer = layers[_countof(layers)-2];
-		lastLayer.computeBackpropagationValuesForLastLayer(expectedOutput, _countof(expectedOutput), prevToLastLayer.neuronValues.data(), (int)prevToLastLayer.neuronValues.size());
+template<typename BackPropagateSliceFunc>
+const NetworkWorkspace& NeuralNetwork::computeBatchCostGradientSum(int nbImages, ThreadPool* pThreadPool, const BackPropagateSliceFunc& backPropagateSlice)
+{
+	assert(!isMapped());
+	updateTransposedWeights();
 
-		// Compute layer idxLayer with next layer (idxLayer+1) as input
-		for(int idxLayer = _countof(layers)-2 ; idxLayer >= 0 ; idxLayer--)
-		{
-			const Layer& nextLayer = layers[idxLayer+1];
-			const float* prevLayerActivations = nullptr;
-			int nbPrevLayerActivations = 0;
-			if(idxLayer == 0)
-			{
-				prevLayerActivations = img.floatData;
-				nbPrevLayerActivations = IMG_SX*IMG_SY;
-			}
-			else
-			{
-				prevLayerActivations = layers[idxLayer-1].neuronValues.data();
-				nbPrevLayerActivations = (int)layers[idxLayer-1].neuronValues.size();
-			}
+	const int nbThreads = pThreadPool ? std::min(pThreadPool->getNbThreads(), nbImages) : 1;
+	if(nbThreads <= 1)
+	{
+		workspace.resetBackpropCostGradient();
+		backPropagateSlice(0, nbImages, workspace);
+		return workspace;
+	}
 
-			Layer& curLayer = layers[idxLayer];
-			curLayer.computeBackpropagationValues(nextLayer, prevLayerActivations, nbPrevLayerActivations);
-		}
+	// Data parallelism: each thread back-propagates a slice of the batch into its own workspace
+	const int nbPrevThreadWorkspaces = (int)threadWorkspaces.size();
+	if(nbPrevThreadWorkspaces < nbThreads)
+	{
+		threadWorkspaces.resize(nbThreads);
+		for(int i=nbPrevThreadWorkspaces ; i < nbThreads ; i++)
+			threadWorkspaces[i].init(*this);
 	}
 
-	// Now that we computed backpropSumOfWeightsAndBiasCostPartialDerivative[], divide by number of images in batch to compute the cost gradient
-	if(images.size() > 1)
+	pThreadPool->parallelFor(nbThreads, [&](int idxSlice)
+	{
+		const int idxSliceStart = nbImages * idxSlice / nbThreads;
+		const int idxSliceEnd = nbImages * (idxSlice+1) / nbThreads;
+		NetworkWorkspace& ws = threadWorkspaces[idxSlice];
+		ws.resetBackpropCostGradient();
+		backPropagateSlice(idxSliceStart, idxSliceEnd, ws);
+	});
+
+	reduceThreadCostGradients(nbThreads, *pThreadPool);
+	return threadWorkspaces[0];
+}
+
+void NeuralNetwork::backPropagateImages(const LabeledImageSet& images, const std::vector<int>& imageIndices, std::vector<std::vector<float>>& outCostGradient, ThreadPool* pThreadPool)
+{
+	const NetworkWorkspace& gradientWs = computeBatchCostGradientSum((int)imageIndices.size(), pThreadPool, [&](int idxStart, int idxEnd, NetworkWorkspace& ws)
 	{
-		const float fInvBatchSize = 1.f / ((float)images.size());
-		outCostGradient.reserve(_countof(layers));
-		for(const Layer& layer : layers)
+		backPropagateBatch(images, &imageIndices[idxStart], idxEnd - idxStart, ws);
+	});
+
+	// Now that we computed backpropSumOf*CostPartialDerivative[], divide by number of images in batch to compute the cost gradient
+	if(imageIndices.size() > 1)
+	{
+		const float fInvBatchSize = 1.f / ((float)imageIndices.size());
+		outCostGradient.reserve(getNbLayers());
+		for(int idxLayer=0 ; idxLayer < getNbLayers() ; idxLayer++)
 		{
+			const Layer& layer = layers[idxLayer];
+			const LayerWorkspace& layerWs = gradientWs.layers[idxLayer];
 			outCostGradient.push_back({});
 			std::vector<float>& layerWeightsAndBiasCostPartialDerivative = outCostGradient.back();
-			layerWeightsAndBiasCostPartialDerivative = layer.backpropSumOfWeightsAndBiasCostPartialDerivative;
+			layerWeightsAndBiasCostPartialDerivative.assign(layerWs.backpropSumOfWeightsCostPartialDerivative, layerWs.backpropSumOfWeightsCostPartialDerivative + layer.getNbWeights());
+			layerWeightsAndBiasCostPartialDerivative.insert(layerWeightsAndBiasCostPartialDerivative.end(), layerWs.backpropSumOfBiasesCostPartialDerivative, layerWs.backpropSumOfBiasesCostPartialDerivative + layer.nbOutputs);
 			for(float& f : layerWeightsAndBiasCostPartialDerivative)
 				f *= fInvBatchSize;
 		}
 	}
 }
 
-void NeuralNetwork::addToWeightAndBiases(const std::vector<std::vector<float>> weightAndBiasesCorrectionPerLayer)
+void NeuralNetwork::trainStep(const LabeledImageSet& images, const std::vector<int>& imageIndices, float learningRate, ThreadPool* pThreadPool)
+{
+	const int nbImages = (int)imageIndices.size();
+	if(nbImages == 0)
+		return;
+
+	const NetworkWorkspace& gradientWs = computeBatchCostGradientSum(nbImages, pThreadPool, [&](int idxStart, int idxEnd, NetworkWorkspace& ws)
+	{
+		backPropagateBatch(images, &imageIndices[idxStart], idxEnd - idxStart, ws);
+	});
+
+	// weights += -learningRate * costGradient, costGradient being the sum of partial derivatives divided by the batch size
+	addScaledCostGradient(gradientWs, -learningRate / (float)nbImages);
+}
+
+void NeuralNetwork::trainStep(const TrainingBatch& batch, float learningRate, ThreadPool* pThreadPool)
+{
+	if(batch.nbImages == 0)
+		return;
+
+	// Threads read their slice of the batch in place: no gather nor copy
+	const int inputStride = layers[0].weightsStride;
+	const int outputsStride = getLastLayer().outputsStride;
+	const NetworkWorkspace& gradientWs = computeBatchCostGradientSum(batch.nbImages, pThreadPool, [&](int idxStart, int idxEnd, NetworkWorkspace& ws)
+	{
+		backPropagateBatchValues(&batch.inputValues[(size_t)idxStart * inputStride], &batch.expectedOutputValues[(size_t)idxStart * outputsStride], idxEnd - idxStart, ws);
+	});
+
+	addScaledCostGradient(gradientWs, -learningRate / (float)batch.nbImages);
+}
+
+// parameters += alpha * cost gradient, all layers at once: gradient and parameters have the same flat layout.
+// Padding of the gradient is always 0, so the padding of the parameters stays 0 too.
+void NeuralNetwork::addScaledCostGradient(const NetworkWorkspace& gradientWs, float alpha)
+{
+	gKernels.axpy(parameters.data(), alpha, gradientWs.costGradient.data(), (int)parameters.size());
+	for(Layer& layer : layers)
+		layer.bTransposedWeightsDirty = true;
+	updateDerivedWeights();
+}
+
+// dst[range] += src[range], range being the idxChunk-th of nbChunks slices of the array.
+// Slices are rounded to cache lines, so that threads never write the same line.
+static void _addChunk(AlignedVector<float>& dst, const AlignedVector<float>& src, int idxChunk, int nbChunks)
+{
+	const int size = (int)dst.size();
+	const int idxStart = std::min(size, padToCacheLine((int)((int64_t)size * idxChunk / nbChunks)));
+	const int idxEnd = std::min(size, padToCacheLine((int)((int64_t)size * (idxChunk+1) / nbChunks)));
+	gKernels.axpy(&dst[idxStart], 1.f, &src[idxStart], idxEnd - idxStart);
+}
+
+// Sums the cost gradients of threadWorkspaces[0..nbWorkspaces-1] into threadWorkspaces[0]
+void NeuralNetwork::reduceThreadCostGradients(int nbWorkspaces, ThreadPool& threadPool)
+{
+	// Tree reduction: at each level, workspace i accumulates workspace i+stride, for i multiple of 2*stride.
+	// Each pair is also split in chunks, so that all threads stay busy on the last levels, where few pairs remain.
+	for(int stride=1 ; stride < nbWorkspaces ; stride *= 2)
+	{
+		const int nbPairs = (nbWorkspaces - stride - 1) / (2*stride) + 1;
+		const int nbChunks = std::max(1, threadPool.getNbThreads() / nbPairs);
+		threadPool.parallelFor(nbPairs * nbChunks, [&](int idxTask)
+		{
+			const int idxPair = idxTask / nbChunks;
+			const int idxChunk = idxTask % nbChunks;
+			NetworkWorkspace& dstWs = threadWorkspaces[idxPair * 2*stride];
+			const NetworkWorkspace& srcWs = threadWorkspaces[idxPair * 2*stride + stride];
+			_addChunk(dstWs.costGradient, srcWs.costGradient, idxChunk, nbChunks);
+		});
+	}
+}
+
+void NeuralNetwork::addToWeightAndBiases(const std::vector<std::vector<float>>& weightAndBiasesCorrectionPerLayer)
 {
-	for(int idxLayer=0 ; idxLayer < _countof(layers) ; idxLayer++)
+	assert(!isMapped());
+	for(int idxLayer=0 ; idxLayer < getNbLayers() ; idxLayer++)
 	{
 		Layer& layer = layers[idxLayer];
 		const std::vector<float>& weightAndBiasesCorrection = weightAndBiasesCorrectionPerLayer[idxLayer];
+		const int nbWeights = (int)layer.getNbWeights();
+
+		assert((int)weightAndBiasesCorrection.size() == nbWeights + layer.nbOutputs);
+		for(int i=0 ; i < nbWeights ; i++)
+			layer.weights[i] += weightAndBiasesCorrection[i];
+		for(int i=0 ; i < layer.nbOutputs ; i++)
+			layer.biases[i] += weightAndBiasesCorrection[nbWeights + i];
+		layer.bTransposedWeightsDirty = true;
+	}
+	updateDerivedWeights();
+}
+
+void NeuralNetwork::trainHogwild(const LabeledImageSet& images, int nbBatchesPerThread, int batchSize, float learningRate, ThreadPool& threadPool, HogwildStats* pOutStats)
+{
+	assert(!isMapped());
+	updateTransposedWeights();
+
+	const int nbThreads = threadPool.getNbThreads();
+	const int nbPrevThreadWorkspaces = (int)threadWorkspaces.size();
+	if(nbPrevThreadWorkspaces < nbThreads)
+	{
+		threadWorkspaces.resize(nbThreads);
+		for(int i=nbPrevThreadWorkspaces ; i < nbThreads ; i++)
+			threadWorkspaces[i].init(*this);
+	}
 
-		assert(weightAndBiasesCorrection.size() == layer.weightsAndBias.size());
-		for(int i=0 ; i < (int)layer.weightsAndBias.size() ; i++)
-			layer.weightsAndBias[i] += weightAndBiasesCorrection[i];
+	if(pOutStats)
+	{
+		pOutStats->nbImagesPerThread.assign(nbThreads, 0);
+		pOutStats->durationMsPerThread.assign(nbThreads, 0.);
 	}
+
+	// Base seed drawn from the global generator, so that consecutive calls sample different batches
+	const int baseSeed = randInt(0, 0x7FFFFFFF);
+	const float alpha = -learningRate / (float)batchSize;
+	threadPool.parallelFor(nbThreads, [&](int idxThread)
+	{
+		const auto startTime = std::chrono::steady_clock::now();
+
+		NetworkWorkspace& ws = threadWorkspaces[idxThread];
+		EpochSampler sampler(images.size(), (uint64_t)baseSeed, idxThread, nbThreads);	// each thread walks its own slice of the epochs
+		std::vector<int> batch(batchSize);
+		for(int idxBatch=0 ; idxBatch < nbBatchesPerThread ; idxBatch++)
+		{
+			sampler.nextBatch(batch.data(), batchSize);
+
+			ws.resetBackpropCostGradient();
+			backPropagateBatch(images, batch.data(), batchSize, ws);
+
+			// Shared weights are updated in place while other threads use them: this is the Hogwild trade-off
+			for(int idxLayer=0 ; idxLayer < getNbLayers() ; idxLayer++)
+				layers[idxLayer].addScaledCostGradientUnsynchronized(ws.layers[idxLayer], alpha);
+		}
+
+		if(pOutStats)
+		{
+			pOutStats->nbImagesPerThread[idxThread] = nbBatchesPerThread * batchSize;
+			pOutStats->durationMsPerThread[idxThread] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+		}
+	});
+
+	// Sparse, 16-bit and transposed copies may have missed some concurrent updates: rebuild them from the weights
+	updateDerivedWeights();
+	for(Layer& layer : layers)
+		layer.bTransposedWeightsDirty = true;
+	updateTransposedWeights();
 }
 
-float NeuralNetwork::computeCost(const std::vector<LabeledImage>& images)
+float NeuralNetwork::computeCost(const LabeledImageSet& images)
 {
 	double totalCost = 0.;
 
-	Layer& lastLayer = layers[_countof(layers)-1];
-	for(const LabeledImage& img : images)
+	const Layer& lastLayer = getLastLayer();
+	const LayerWorkspace& lastLayerWs = workspace.layers.back();
+	for(int idxBatchStart=0 ; idxBatchStart < (int)images.size() ; idxBatchStart += kEvaluationBatchSize)
 	{
-		feedForward(img, false);
-		float imgCost = 0.f;
-		for(int i=0 ; i < (int)lastLayer.neuronValues.size() ; i++)
+		const int nbImages = std::min(kEvaluationBatchSize, (int)images.size() - idxBatchStart);
+		feedForwardBatch(images, idxBatchStart, nbImages);
+
+		for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
 		{
-			const float diff = lastLayer.neuronValues[i] - (img.label == i ? 1.f : 0.f);
-			imgCost += diff*diff;
+			const int label = images.labels[idxBatchStart + idxImage];
+			const float* outputs = &lastLayerWs.batchNeuronValues[idxImage * lastLayer.outputsStride];
+			if(lastLayer.activation == Activation::Softmax)
+			{
+				totalCost -= log((double)std::max(outputs[label], FLT_MIN));	// cross-entropy of the one-hot label
+				continue;
+			}
+
+			float imgCost = 0.f;
+			for(int i=0 ; i < lastLayer.nbOutputs ; i++)
+			{
+				const float diff = outputs[i] - (label == i ? 1.f : 0.f);
+				imgCost += diff*diff;
+			}
+			totalCost += (double)imgCost;
 		}
-		totalCost += (double)imgCost;
 	}
 
 	totalCost /= (double)images.size();
 	return (float)totalCost;
 }
 
+int NeuralNetwork::computeNbGoodAnswers(const LabeledImageSet& images)
+{
+	int nbGoodAnswers = 0;
+	for(int idxBatchStart=0 ; idxBatchStart < (int)images.size() ; idxBatchStart += kEvaluationBatchSize)
+	{
+		const int nbImages = std::min(kEvaluationBatchSize, (int)images.size() - idxBatchStart);
+		feedForwardBatch(images, idxBatchStart, nbImages);
+
+		for(int idxImage=0 ; idxImage < nbImages ; idxImage++)
+		{
+			if(getBatchAnswer(idxImage) == images.labels[idxBatchStart + idxImage])
+				nbGoodAnswers++;
+		}
+	}
+	return nbGoodAnswers;
+}
+
 #if 0
 // Compute partial derivative of cost relative to each weight and bias
 void NeuralNetwork::computeLabeledImageCostDerivative(const LabeledImage& img, std::vector<float> outDCostPerWeightAndBias[2])
@@ -281,18 +1195,18 @@ void NeuralNetwork::computeLabeledImageCostDerivative(const LabeledImage& img, s
 	* L = layer 1, j = neuron index in layer 1
 	* 
 	* z(L,j) = sum_j(Weight(L,j)*Activation(L-1,j)) + bias(L,j)
-	* Activation(L,j) = activationFunc(z(L,j))
+	* Activation(L,j) = sigmoid(z(L,j))
 	* 
 	* Cost = sum_j( (Activation(L,j) - y(j))^2 )
 	* dCost/dActivation(L,j) = 2*(Activation(L,j) - y(j))
 	* 
 	* Chain rule:
 	* dCost/dWeight(L,j) = dz(L,j)/dWeight(L,j)       *    dActivation(L,j)/dz(L,j)    *    dCost/dActivation(L,j)
-	*                    = sum_k(Activation(L-1,k))   *    dActivationFunc(z(L,j))     *    2*(Activation(L,j) - y(j))
+	*                    = sum_k(Activation(L-1,k))   *    sigmoid'(z(L,j))            *    2*(Activation(L,j) - y(j))
 	* 
 	* Per https://www.youtube.com/watch?v=tIeHLnjs5U8&t=6m1s
 	* dCost/dBias(L,j) = dz(L,j)/dBias(L,j)    *    dActivation(L,j)/dz(L,j)    *    dCost/dActivation(L,j)
-	*                  = 1                     *    dActivationFunc(z(L,j))     *    2*(Activation(L,j) - y(j))
+	*                  = 1                     *    sigmoid'(z(L,j))            *    2*(Activation(L,j) - y(j))
 	* 
 	* === Compute Cost partial derivatives for weights and bias in layer 0 ===
 	* 
@@ -1,95 +1,381 @@
 #pragma once
 
+#include "MappedFile.h"
+
 struct LabeledImage;
+class ThreadPool;
+
+// Rows of weights and activations are padded to a multiple of a cache line (16 floats = 64 bytes),
+// so that every row starts aligned and kernels only do full-width vector loads. Padding values are always 0.
+const int kNbFloatsPerCacheLine = 16;
+constexpr int padToCacheLine(int nbFloats)
+{
+	return (nbFloats + kNbFloatsPerCacheLine - 1) & ~(kNbFloatsPerCacheLine - 1);
+}
+
+// Activation function of the neurons of a layer, applied to z = weights . inputs + bias
+enum class Activation
+{
+	Sigmoid,	// 1 / (1 + exp(-z)), evaluated as selected by gKernels.sigmoidMode
+	Tanh,
+	ReLU,		// max(0, z)
+	LeakyReLU,	// z > 0 ? z : kLeakyReLUSlope * z
+	Softmax,	// exp(z) / sum(exp(z)) over the layer. Last layer only, trained with the cross-entropy cost
+};
+
+const float kLeakyReLUSlope = 0.01f;
+
+const char*	getActivationName(Activation activation);
+bool		parseActivation(const char* strName, Activation& outActivation);	// strName: one of the getActivationName() names
+void		applyActivation(Activation activation, float* outValues, const float* z, int n);	// outValues may be z
+
+// Storage of the weights read by the forward passes. 16-bit formats halve their memory traffic: the dot product kernels
+// convert them to float32 on the fly and accumulate in float32 (see gKernels.dotF16).
+enum class WeightsFormat
+{
+	Float32,
+	Float16,	// IEEE half precision: 11-bit significand, values up to 65504
+	BFloat16,	// upper half of a float32: 8-bit significand, range of a float32
+};
+
+const char*	getWeightsFormatName(WeightsFormat format);
+bool		parseWeightsFormat(const char* strName, WeightsFormat& outFormat);	// strName: one of the getWeightsFormatName() names
+size_t		getWeightsFormatValueSize(WeightsFormat format);	// in bytes
+
+// Conversions of n values between float32 and a 16-bit format
+void		convertFromFloat(WeightsFormat format, uint16_t* outValues, const float* values, size_t n);
+void		convertToFloat(WeightsFormat format, float* outValues, const uint16_t* values, size_t n);
+
+struct Layer;
+
+// Temporary values of the batched passes of one Layer.
+// Layer itself is only read by batched passes, so that several threads can each run a pass with their own workspace.
+struct LayerWorkspace
+{
+	// Neuron outputs written during last feedForwardBatch() call, stored as [nbImages x outputsStride] matrices
+	AlignedVector<float>	batchNeuronValues;
+
+	// Written during last back propagation
+	// - Sum of partial derivatives of Cost function for last backprop'ed images. Same layout as weights and biases,
+	//   views into the flat NetworkWorkspace::costGradient.
+	float*					backpropSumOfWeightsCostPartialDerivative = nullptr;
+	float*					backpropSumOfBiasesCostPartialDerivative = nullptr;
+
+	// - Delta values issued from chain rule. Used to scale previous neurons influence. [nbImages x outputsStride]
+	AlignedVector<float>	batchBackpropDelta;
+
+	// Weights gradient of one input across the neurons, [outputsStride]: Hogwild updates of the transposed weights
+	AlignedVector<float>	inputGradient;
+
+	void	init(const Layer& layer, float* layerCostGradient);	// layerCostGradient: layer.getNbParameters() values
+};
+
+// Compressed sparse row (CSR) copy of the weights of a pruned layer: the kept weights of neuron n are
+// values[rowStarts[n]] to values[rowStarts[n+1]-1], at inputs columns[] (increasing in each row).
+struct SparseWeights
+{
+	AlignedVector<int32_t>	rowStarts;	// [nbOutputs + 1], empty when the layer is dense
+	AlignedVector<int32_t>	columns;	// [nbNonZeros]
+	AlignedVector<float>	values;		// [nbNonZeros]
+
+	int		getNbNonZeros() const	{ return (int)values.size(); }
+	int		getRowSize(int idxRow) const	{ return rowStarts[idxRow+1] - rowStarts[idxRow]; }
+};
 
 struct Layer
 {
 	int					nbInputs=0;
 	int					nbOutputs=0;	// Note: nbOutputs == nbNeurons
-	std::vector<float>	weightsAndBias;
+	int					weightsStride=0;	// padToCacheLine(nbInputs)
+	int					outputsStride=0;	// padToCacheLine(nbOutputs)
+	Activation			activation = Activation::Sigmoid;
 
-	// Temporary values: neuron outputs written during last feedForward() call
-	std::vector<float>	neuronValues;	// size == nbOutputs == nbNeurons
-	std::vector<float>	zValues;		// size == nbOutputs == nbNeurons
+	// Views into the flat NeuralNetwork::parameters, where the layer block starts at parametersOffset
+	size_t				parametersOffset=0;
+	float*				weights = nullptr;	// [nbOutputs x weightsStride]
+	float*				biases = nullptr;	// [outputsStride], padding stays 0
 
-	// Temporary values: written during last back propagation
-	// - List of sum of partial derivatives of Cost function for last backprop'ed image. Same size as weightAndBias.
-	//   => [dCost(img)/dWeight0, dCost(img)/dWeight1 ..., dCost(img)/dBias]
-	std::vector<float>	backpropSumOfWeightsAndBiasCostPartialDerivative;
+	// Transposed copy of weights, [nbInputs x outputsStride], so that the back propagation of the previous layer
+	// reads contiguous memory. Allocated and refreshed lazily by updateTransposedWeights() after weights changed,
+	// so that networks only used for inference never hold it.
+	AlignedVector<float>	transposedWeights;
+	bool					bTransposedWeightsDirty = true;
 
-	// - List of Delta values issued from chain rule. Used to scale previous neurons influence. Size = number of neurons = nbOutputs.
-	std::vector<float>	backpropDelta;
+	// 16-bit copy of weights, read by the forward passes instead of them unless weightsFormat is Float32.
+	// View into NeuralNetwork::halfParameters, [nbOutputs x weightsStride], refreshed by updateHalfWeights().
+	WeightsFormat			weightsFormat = WeightsFormat::Float32;
+	uint16_t*				halfWeights = nullptr;
 
-	void initRandom(int nbInputValues, int nbOutputValues)
-	{
-		nbInputs = nbInputValues;
-		nbOutputs = nbOutputValues;
-		weightsAndBias.resize((nbInputs+1)*nbOutputs);
-		for(float& f : weightsAndBias)
-			f = randNormal();
-		resizeTemporaryArraysOnInit();
-	}
+	// Kept weights of a pruned layer (see pruneWeights()), read by the forward passes instead of weights and halfWeights.
+	// The sparsity pattern is fixed: updateSparseWeights() resets pruned weights to 0 after each update, so training a
+	// pruned network fine-tunes the kept weights only.
+	SparseWeights			sparseWeights;
 
-	void saveToFile(FILE* f)
+	float	getWeight(int idxNeuron, int idxInput) const	{ return weights[idxNeuron * weightsStride + idxInput]; }
+	float*	getNeuronWeights(int idxNeuron)					{ return &weights[idxNeuron * weightsStride]; }
+	const float*	getNeuronWeights(int idxNeuron) const	{ return &weights[idxNeuron * weightsStride]; }
+	bool			isSparse() const	{ return !sparseWeights.rowStarts.empty(); }
+	const float*	getInputTransposedWeights(int idxInput) const
 	{
-		fwrite(&nbInputs, sizeof(nbInputs), 1, f);
-		fwrite(&nbOutputs, sizeof(nbOutputs), 1, f);
-		fwrite(weightsAndBias.data(), sizeof(weightsAndBias[0]), weightsAndBias.size(), f);
+		assert(!bTransposedWeightsDirty);
+		return &transposedWeights[idxInput * outputsStride];
 	}
 
-	void readFromFile(FILE* f)
+	// Parameters block of a layer: [weights (nbOutputs x weightsStride) | biases (outputsStride)], both parts aligned on a cache line
+	static size_t	getNbParameters(int nbInputValues, int nbOutputValues)	{ return (size_t)nbOutputValues * padToCacheLine(nbInputValues) + padToCacheLine(nbOutputValues); }
+	size_t			getNbParameters() const	{ return getNbParameters(nbInputs, nbOutputs); }
+	size_t			getNbWeights() const	{ return (size_t)nbOutputs * weightsStride; }
+
+	// Sets the layer sizes. Weights and biases are then bound with bindParameters().
+	void	resize(int nbInputValues, int nbOutputValues)
 	{
-		fread(&nbInputs, sizeof(nbInputs), 1, f);
-		fread(&nbOutputs, sizeof(nbOutputs), 1, f);
-		weightsAndBias.resize((nbInputs+1)*nbOutputs);
-		fread(weightsAndBias.data(), sizeof(weightsAndBias[0]), weightsAndBias.size(), f);
-		resizeTemporaryArraysOnInit();
+		nbInputs = nbInputValues;
+		nbOutputs = nbOutputValues;
+		weightsStride = padToCacheLine(nbInputs);
+		outputsStride = padToCacheLine(nbOutputs);
+		transposedWeights.clear();
+		bTransposedWeightsDirty = true;
 	}
 
-	void debugPrintNeuronValues(const char* message)
+	void	bindParameters(float* layerParameters)
 	{
-		printf("Neuron values %s:\n", message);
-		for(int i=0 ; i < (int)neuronValues.size() ; i++)
-			printf("[%d]: %.6f\n", i, neuronValues[i]);
+		weights = layerParameters;
+		biases = layerParameters + getNbWeights();
 	}
 
-	void feedForward(const float* inData, int nbInputValues, bool bDebugPrint, const char* message);
-	void feedForward(const Layer& prevLayer, bool bDebugPrint, const char* message)
+	void updateTransposedWeights();
+	void updateHalfWeights();	// converts weights into halfWeights, if weightsFormat is not Float32
+
+	// Magnitude pruning: zeroes the fraction sparsity of the weights with the smallest absolute values, ties broken by
+	// index, then builds sparseWeights from the others. Biases are kept. sparsity <= 0 makes the layer dense again.
+	void pruneWeights(float sparsity);
+	void updateSparseWeights();	// resets pruned weights to 0 and copies the kept ones into sparseWeights, if the layer is sparse
+
+	// weights/biases += alpha * ws cost gradient, transposed copy included, without any synchronization.
+	// Used by Hogwild training, where other threads read and update the same weights concurrently:
+	// an update may be partially lost or interleaved with another one, which SGD tolerates.
+	// The copies read by the forward passes are updated too: the kept weights of sparseWeights, or halfWeights.
+	void addScaledCostGradientUnsynchronized(LayerWorkspace& ws, float alpha);
+
+	// Weights and biases drawn from a normal distribution. Value i of the layer is a pure function of (seed, i),
+	// so the result is the same whether rows are generated by one thread or split across pThreadPool. Padding is left untouched.
+	// The standard deviation depends on the activation: 1 for sigmoid, 1/sqrt(nbInputs) for tanh and softmax (LeCun) and
+	// sqrt(2/nbInputs) for (leaky) ReLU (He), so that z keeps a unit variance through the layers instead of saturating or exploding.
+	void initRandom(uint64_t seed, ThreadPool* pThreadPool = nullptr);
+
+	// outValues = activation(z), n values. outValues may be z.
+	void applyActivation(float* outValues, const float* z, int n) const	{ ::applyActivation(activation, outValues, z, n); }
+
+	// delta *= activation'(z), computed from the activations a = activation(z) of the n neurons
+	void multiplyByActivationDerivative(float* delta, const float* a, int n) const;
+
+	// Legacy file layout: nbInputs, nbOutputs, then for each neuron its nbInputs weights followed by its bias.
+	// The layer must already have the sizes of the file: they are read before, to allocate the parameters of all layers at once
+	bool readFromLegacyFile(FILE* f)
 	{
-		feedForward(prevLayer.neuronValues.data(), (int)prevLayer.neuronValues.size(), bDebugPrint, message);
+		int nbInputValues = 0, nbOutputValues = 0;
+		if(fread(&nbInputValues, sizeof(nbInputValues), 1, f) != 1 || fread(&nbOutputValues, sizeof(nbOutputValues), 1, f) != 1)
+			return false;
+		if(nbInputValues != nbInputs || nbOutputValues != nbOutputs)
+			return false;
+		for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
+		{
+			if(fread(getNeuronWeights(idxNeuron), sizeof(float), nbInputs, f) != (size_t)nbInputs || fread(&biases[idxNeuron], sizeof(float), 1, f) != 1)
+				return false;
+		}
+		bTransposedWeightsDirty = true;
+		return true;
 	}
 
-	void resetBackpropCostGradient();
-	void computeBackpropagationValues(const Layer& nextLayer, const float* prevLayerActivations, int nbPrevLayerActivations);
-	void computeBackpropagationValuesForLastLayer(float* expectedOutput, int nbExpectedOutputValues, const float* prevLayerActivations, int nbPrevLayerActivations);
+	// inData must hold weightsStride values, zero padded after nbInputValues. outNeuronValues receives nbOutputs values.
+	void feedForward(const float* inData, int nbInputValues, float* outNeuronValues) const;
+
+	// Batched version: inData is a [nbImages x weightsStride] matrix, outputs are written to ws.batchNeuronValues
+	void feedForwardBatch(const float* inData, int nbImages, int nbInputValues, LayerWorkspace& ws) const;
+
+	// Batched back propagation: expectedOutputs is [nbImages x outputsStride], prevLayerActivations is [nbImages x weightsStride].
+	// Partial derivatives are accumulated into ws.backpropSumOf*CostPartialDerivative.
+	void computeBatchBackpropagationValues(const Layer& nextLayer, const LayerWorkspace& nextLayerWs, const float* prevLayerActivations, int nbImages, int nbPrevLayerActivations, LayerWorkspace& ws) const;
+	void computeBatchBackpropagationValuesForLastLayer(const float* expectedOutputs, int nbImages, const float* prevLayerActivations, int nbPrevLayerActivations, LayerWorkspace& ws) const;
+
+	// First step of computeBatchBackpropagationValues(): only writes ws.batchBackpropDelta
+	void computeBatchBackpropagationDelta(const Layer& nextLayer, const LayerWorkspace& nextLayerWs, int nbImages, LayerWorkspace& ws) const;
 
 private:
-	void resizeTemporaryArraysOnInit()
-	{
-		neuronValues.resize(nbOutputs);
-		zValues.resize(nbOutputs);
-		backpropSumOfWeightsAndBiasCostPartialDerivative.resize(weightsAndBias.size());
-		backpropDelta.resize(nbOutputs);
-	}
+	void accumulateBatchCostGradient(const float* prevLayerActivations, int nbImages, LayerWorkspace& ws) const;
+};
+
+struct NeuralNetwork;
+
+// Temporary values of the batched passes of a whole NeuralNetwork
+struct NetworkWorkspace
+{
+	std::vector<LayerWorkspace>	layers;
+
+	// Cost gradient of all layers, same layout as NeuralNetwork::parameters: reset, reduced and applied as a single span
+	AlignedVector<float>	costGradient;
+
+	// Input images gathered during last feedForwardBatch() call, [nbImages x layers[0].weightsStride]
+	AlignedVector<float>	batchInputValues;
+
+	// One-hot expected outputs built during last back propagation, [nbImages x outputsStride]
+	AlignedVector<float>	batchExpectedOutputValues;
+
+	NetworkWorkspace() = default;
+	NetworkWorkspace(NetworkWorkspace&&) = default;	// layer views stay valid: buffers are moved, not reallocated
+	NetworkWorkspace& operator=(NetworkWorkspace&&) = default;
+	NetworkWorkspace(const NetworkWorkspace&) = delete;
+	NetworkWorkspace& operator=(const NetworkWorkspace&) = delete;
+
+	void	init(const NeuralNetwork& nn);
+	void	resetBackpropCostGradient()	{ memset(costGradient.data(), 0, costGradient.size() * sizeof(float)); }
+};
+
+// Temporary values of a single image inference, owned by the caller.
+// NeuralNetwork::predict() is const and only writes here, so any number of threads can run inference on the same network,
+// each with its own workspace. Once initialized, a workspace is reused without any allocation.
+struct InferenceWorkspace
+{
+	// Normalized input pixels of predict(const LabeledImage&), size == layers[0].weightsStride
+	AlignedVector<float>	inputValues;
+
+	// Neuron outputs of each layer written during last predict() call, size == outputsStride (padding stays 0)
+	std::vector<AlignedVector<float>>	neuronValues;
+
+	void	init(const NeuralNetwork& nn);
+	void	debugPrintNeuronValues() const;
+};
+
+struct TrainingBatch;
+
+struct HogwildStats
+{
+	std::vector<int>	nbImagesPerThread;
+	std::vector<double>	durationMsPerThread;
 };
 
 struct NeuralNetwork
 {
-	Layer layers[3];
+	std::vector<Layer>		layers;
+
+	// Weights and biases of all layers in one contiguous aligned buffer, layer after layer (see Layer::getNbParameters()).
+	// The whole model is updated, reduced or saved as a single span. Layers hold views into it.
+	// Empty when the network is mapped from a file: layers then point into mappedFile instead.
+	AlignedVector<float>	parameters;
 
-	void	initRandom();
+	// 16-bit copy of parameters, same layout, read by the forward passes when weights are stored as fp16 or bf16
+	// (see setWeightsFormat()). Empty with Float32 weights.
+	AlignedVector<uint16_t>	halfParameters;
+
+	// Read-only mapping of the model file of mapFromFile()
+	MappedFile				mappedFile;
+
+	// Workspace of the single-threaded batched functions (feedForwardBatch(), computeCost()...)
+	NetworkWorkspace				workspace;
+
+	// Per-thread workspaces of the multithreaded back propagation, with their own cost gradient accumulators
+	std::vector<NetworkWorkspace>	threadWorkspaces;
+
+	// Number of images evaluated at once by computeCost() and computeNbGoodAnswers()
+	static constexpr int	kEvaluationBatchSize = 256;
+
+	NeuralNetwork() = default;
+	NeuralNetwork(const NeuralNetwork& other)	{ *this = other; }
+	NeuralNetwork& operator=(const NeuralNetwork& other);
+
+	int				getNbLayers() const		{ return (int)layers.size(); }
+	const Layer&	getLastLayer() const	{ return layers.back(); }
+	bool			isMapped() const		{ return mappedFile.isOpen(); }
+	WeightsFormat	getWeightsFormat() const	{ return layers.empty() ? WeightsFormat::Float32 : layers[0].weightsFormat; }
+
+	// Weights and biases of all layers, from parameters or from the mapped file
+	const float*	getParameters() const	{ return layers.empty() ? nullptr : layers[0].weights; }
+	size_t			getNbParameters() const	{ return layers.empty() ? 0 : layers.back().parametersOffset + layers.back().getNbParameters(); }
+
+	// layerSizes lists the number of values from the inputs to the outputs: {784, 16, 16, 10} makes 3 layers.
+	// activations has one entry per layer, all layers use the sigmoid when it is empty.
+	// init() zeroes all parameters, initRandom() draws them from a normal distribution (see Layer::initRandom()).
+	bool	init(const std::vector<int>& layerSizes, const std::vector<Activation>& activations = {});
+	bool	initRandom(const std::vector<int>& layerSizes = {IMG_SX*IMG_SY, 16, 16, 10}, uint64_t seed = 0, ThreadPool* pThreadPool = nullptr);
+	bool	initRandom(const std::vector<int>& layerSizes, const std::vector<Activation>& activations, uint64_t seed = 0, ThreadPool* pThreadPool = nullptr);
+
+	// Model files (see ModelFile.h) hold the topology, activations and parameters, checked by CRC.
+	// initFromFile() copies the parameters, so the network can be trained. It also imports legacy files, which have
+	// no header: their layers are read as sigmoid ones.
+	// mapFromFile() uses the parameters section of the memory mapped file in place, without any copy: the network is
+	// read-only, for inference (predict(), feedForwardBatch(), computeCost()...). Copying it makes a trainable network.
+	// bVerifyCrc reads the whole parameters section once, instead of only the pages used later.
+	// saveToFile() writes the parameters in the weights format of the network. 16-bit files are half the size: initFromFile()
+	// converts them to float32 and sets their weights format, mapFromFile() rejects them.
 	bool	initFromFile(const char* fileName);
-	bool	saveToFile(const char* fileName);
+	bool	mapFromFile(const char* fileName, bool bVerifyCrc = true);
+	bool	saveToFile(const char* fileName) const;
+
+	// Files can hold any topology, but predict() and the other passes on LabeledImages need IMG_SX*IMG_SY inputs and
+	// 10 outputs. Prints an error naming fileName and returns false otherwise, or if the network is empty (load failed).
+	bool	checkImageTopology(const char* fileName) const;
 
-	void	resetBackpropCostGradient()
+	void	updateTransposedWeights()
 	{
 		for(Layer& layer : layers)
-			layer.resetBackpropCostGradient();
+			layer.updateTransposedWeights();
 	}
 
-	void	feedForward(const LabeledImage& img, bool bDebugPrint);
-	void	backPropagateImages(const std::vector<const LabeledImage*>& images, std::vector<std::vector<float>>& outCostGradient);
-	void	addToWeightAndBiases(const std::vector<std::vector<float>> weightAndBiasesCorrectionPerLayer);
-	float	computeCost(const std::vector<LabeledImage>& images);
+	// Prunes the weights of layers[idxLayer] (see Layer::pruneWeights()), whose forward passes then use the CSR kernels
+	// gKernels.sparseDot and sparseDot4. Pruned weights are saved as 0, but files hold dense weights: a loaded network
+	// is dense until pruned again, which finds the same pattern.
+	void	pruneWeights(int idxLayer, float sparsity);
+
+	// Forward passes of inference and training read the weights in this format. parameters stay the float32 master copy,
+	// which training updates: most SGD steps are below the resolution of 16-bit weights and would be lost. The 16-bit
+	// copy is refreshed after each update, or by updateHalfParameters() after parameters were written directly.
+	void	setWeightsFormat(WeightsFormat format);
+	void	updateHalfParameters();
+
+	// Single image inference: inData holds layers[0].weightsStride values, zero padded. Returns the index of the highest output neuron.
+	int		predict(const float* inData, InferenceWorkspace& ws) const;
+	int		predict(const LabeledImage& img, InferenceWorkspace& ws) const;	// pixels are converted into ws.inputValues
+
+	void	feedForwardBatch(const LabeledImageSet& images, int idxFirstImage, int nbImages);
+	void	feedForwardBatch(const LabeledImageSet& images, const std::vector<int>& imageIndices);
+	int		getBatchAnswer(int idxImage) const;
+
+	// Cost gradient of each layer is stored as [weights (nbOutputs x weightsStride) | biases (nbOutputs)].
+	// With a thread pool, the batch is split across threads (data parallelism), each accumulating into its own workspace,
+	// then per-thread gradients are summed with a tree reduction.
+	void	backPropagateImages(const LabeledImageSet& images, const std::vector<int>& imageIndices, std::vector<std::vector<float>>& outCostGradient, ThreadPool* pThreadPool = nullptr);
+	void	addToWeightAndBiases(const std::vector<std::vector<float>>& weightAndBiasesCorrectionPerLayer);
+
+	// One SGD step: back-propagates images then applies weights += -learningRate * costGradient in place.
+	// Gradients are accumulated in the persistent workspaces and the update is fused with the scaling,
+	// so once workspaces have grown to the batch size, a step does not allocate anything.
+	void	trainStep(const LabeledImageSet& images, const std::vector<int>& imageIndices, float learningRate, ThreadPool* pThreadPool = nullptr);
+	void	trainStep(const TrainingBatch& batch, float learningRate, ThreadPool* pThreadPool = nullptr);	// batch prepared by a BatchPipeline
+
+	// Asynchronous SGD (Hogwild): each thread samples its own batches from images, back-propagates them
+	// and applies its update to the shared weights right away, without locks nor waiting for other threads.
+	// Threads sample disjoint slices of shuffled epochs (EpochSampler partitions), so no image is drawn twice per epoch.
+	void	trainHogwild(const LabeledImageSet& images, int nbBatchesPerThread, int batchSize, float learningRate, ThreadPool& threadPool, HogwildStats* pOutStats = nullptr);
+	float	computeCost(const LabeledImageSet& images);	// mean per image: squared error, or cross-entropy with a softmax last layer
+	int		computeNbGoodAnswers(const LabeledImageSet& images);
 	//void	computeLabeledImageCostDerivative(const LabeledImage& img, std::vector<float> outDCostPerWeightAndBias[2]);
+
+private:
+	bool	initLayers(const std::vector<int>& layerSizes, const std::vector<Activation>& activations);
+	void	bindParameters(float* networkParameters);
+	void	bindHalfParameters();
+	void	updateDerivedWeights();	// after an update of parameters: sparse copies (pruned weights back to 0) then 16-bit copy
+	bool	initFromLegacyFile(const char* fileName);
+
+	void	gatherBatchInputValues(const LabeledImageSet& images, const int* imageIndices, int nbImages, NetworkWorkspace& ws) const;
+	void	feedForwardBatchInputValues(const float* inputValues, int nbImages, NetworkWorkspace& ws) const;
+	void	backPropagateBatch(const LabeledImageSet& images, const int* imageIndices, int nbImages, NetworkWorkspace& ws) const;
+	void	backPropagateBatchValues(const float* inputValues, const float* expectedOutputValues, int nbImages, NetworkWorkspace& ws) const;
+
+	// Back-propagates nbImages images, single-threaded or split across pThreadPool: backPropagateSlice(idxStart, idxEnd, ws)
+	// accumulates the partial derivatives of images [idxStart;idxEnd[ into ws. Returns the workspace holding the sums.
+	template<typename BackPropagateSliceFunc>
+	const NetworkWorkspace&	computeBatchCostGradientSum(int nbImages, ThreadPool* pThreadPool, const BackPropagateSliceFunc& backPropagateSlice);
+	void	reduceThreadCostGradients(int nbWorkspaces, ThreadPool& threadPool);
+	void	addScaledCostGradient(const NetworkWorkspace& gradientWs, float alpha);
 };
@@ -0,0 +1,393 @@
+#include "QuantizedNetwork.h"
+#include "Kernels.h"
+#include "Gzip.h"
+
+static const char		kQuantizedFileMagic[8] = {'N', 'N', 'Q', 'U', 'A', 'N', 'T', '\x1A'};
+static const uint32_t	kQuantizedFileVersion = 2;	// version 1 CRCs did not cover the header
+
+// File header, followed by contentSize bytes of layers
+struct QuantizedFileHeader
+{
+	char		magic[8];		// kQuantizedFileMagic
+	uint32_t	version;		// kQuantizedFileVersion
+	uint32_t	nbLayers;
+	uint64_t	contentSize;
+	uint32_t	contentCrc;		// CRC-32 of the header, with contentCrc = 0, followed by the content
+	uint32_t	reserved;		// 0
+};
+static_assert(sizeof(QuantizedFileHeader) == 32, "QuantizedFileHeader is part of the file format");
+
+// Header of a layer in the file, followed by its arrays: weights, weightScales, zeroPointCorrections, biases, outputInvScales
+struct QuantizedFileLayer
+{
+	int32_t		nbInputs;
+	int32_t		nbOutputs;
+	uint32_t	activation;
+	int32_t		inputZeroPoint;
+	uint32_t	nbOutputInvScales;	// nbOutputs, 0 for the last layer
+	uint32_t	reserved;			// 0
+};
+static_assert(sizeof(QuantizedFileLayer) == 24, "QuantizedFileLayer is part of the file format");
+
+static int _roundToInt(float value)
+{
+	return (int)lrintf(value);
+}
+
+void QuantizedWorkspace::init(const QuantizedNetwork& qnn)
+{
+	int maxOutputsStride = 0;
+	inputValues.resize(qnn.getNbLayers());
+	for(int idxLayer=0 ; idxLayer < qnn.getNbLayers() ; idxLayer++)
+	{
+		const QuantizedLayer& layer = qnn.layers[idxLayer];
+		inputValues[idxLayer].assign(idxLayer > 0 ? layer.inputsStride : 0, 0);	// layer 0 reads the image pixels
+		maxOutputsStride = std::max(maxOutputsStride, layer.outputsStride);
+	}
+	sums.assign(maxOutputsStride, 0);
+	neuronValues.assign(maxOutputsStride, 0.f);
+}
+
+size_t QuantizedNetwork::getNbBytes() const
+{
+	size_t nbBytes = 0;
+	for(const QuantizedLayer& layer : layers)
+		nbBytes += layer.getNbBytes();
+	return nbBytes;
+}
+
+bool QuantizedNetwork::quantize(const NeuralNetwork& nn, const LabeledImageSet& calibrationImages)
+{
+	if(nn.getNbLayers() == 0 || nn.layers[0].nbInputs != IMG_SX*IMG_SY || calibrationImages.empty())
+	{
+		fprintf(stderr, "Quantization needs a network of %d inputs and calibration images\n", IMG_SX*IMG_SY);
+		return false;
+	}
+	const int nbLayers = nn.getNbLayers();
+
+	// Calibration: maximum absolute activation of each hidden neuron
+	std::vector<std::vector<float>> maxAbsActivations(nbLayers);
+	for(int idxLayer=0 ; idxLayer < nbLayers ; idxLayer++)
+		maxAbsActivations[idxLayer].assign(nn.layers[idxLayer].nbOutputs, 0.f);
+
+	InferenceWorkspace inferenceWs;
+	inferenceWs.init(nn);
+	for(int idxImage=0 ; idxImage < calibrationImages.size() ; idxImage++)
+	{
+		nn.predict(calibrationImages[idxImage], inferenceWs);
+		for(int idxLayer=0 ; idxLayer < nbLayers-1 ; idxLayer++)
+		{
+			std::vector<float>& maxAbs = maxAbsActivations[idxLayer];
+			for(int idxNeuron=0 ; idxNeuron < (int)maxAbs.size() ; idxNeuron++)
+				maxAbs[idxNeuron] = std::max(maxAbs[idxNeuron], fabsf(inferenceWs.neuronValues[idxLayer][idxNeuron]));
+		}
+	}
+
+	// Scales of the inputs of the current layer: raw pixels for the first one
+	std::vector<float> inputScales(IMG_SX*IMG_SY, kPixelScale);
+	int inputZeroPoint = 0;
+
+	layers.assign(nbLayers, QuantizedLayer());
+	std::vector<float> scaledWeights;
+	for(int idxLayer=0 ; idxLayer < nbLayers ; idxLayer++)
+	{
+		const Layer& layer = nn.layers[idxLayer];
+		QuantizedLayer& qLayer = layers[idxLayer];
+		qLayer.nbInputs = layer.nbInputs;
+		qLayer.nbOutputs = layer.nbOutputs;
+		qLayer.inputsStride = padInt8ToCacheLine(layer.nbInputs);
+		qLayer.outputsStride = padToCacheLine(layer.nbOutputs);
+		qLayer.activation = layer.activation;
+		qLayer.inputZeroPoint = inputZeroPoint;
+		qLayer.weights.assign((size_t)qLayer.outputsStride * qLayer.inputsStride, 0);
+		qLayer.weightScales.assign(qLayer.outputsStride, 0.f);
+		qLayer.zeroPointCorrections.assign(qLayer.outputsStride, 0);
+		qLayer.biases.assign(qLayer.outputsStride, 0.f);
+
+		// Symmetric per-neuron quantization of the weights, input scales folded in
+		scaledWeights.resize(layer.nbInputs);
+		for(int idxNeuron=0 ; idxNeuron < layer.nbOutputs ; idxNeuron++)
+		{
+			float maxAbsWeight = 0.f;
+			for(int idxInput=0 ; idxInput < layer.nbInputs ; idxInput++)
+			{
+				scaledWeights[idxInput] = layer.getWeight(idxNeuron, idxInput) * inputScales[idxInput];
+				maxAbsWeight = std::max(maxAbsWeight, fabsf(scaledWeights[idxInput]));
+			}
+			const float weightScale = maxAbsWeight > 0.f ? maxAbsWeight / 127.f : 1.f;
+
+			int8_t* qWeights = &qLayer.weights[(size_t)idxNeuron * qLayer.inputsStride];
+			int32_t sumOfWeights = 0;
+			for(int idxInput=0 ; idxInput < layer.nbInputs ; idxInput++)
+			{
+				qWeights[idxInput] = (int8_t)std::clamp(_roundToInt(scaledWeights[idxInput] / weightScale), -127, 127);
+				sumOfWeights += qWeights[idxInput];
+			}
+			qLayer.weightScales[idxNeuron] = weightScale;
+			qLayer.zeroPointCorrections[idxNeuron] = inputZeroPoint * sumOfWeights;
+			qLayer.biases[idxNeuron] = layer.biases[idxNeuron];
+		}
+
+		// Quantization of the outputs, inputs of the next layer. Dead neurons (always 0) get any scale.
+		if(idxLayer < nbLayers-1)
+		{
+			const bool bSignedOutputs = layer.activation == Activation::Tanh || layer.activation == Activation::LeakyReLU;
+			const float maxQuantizedValue = bSignedOutputs ? 127.f : 255.f;
+			inputScales.resize(layer.nbOutputs);
+			qLayer.outputInvScales.resize(layer.nbOutputs);
+			for(int idxNeuron=0 ; idxNeuron < layer.nbOutputs ; idxNeuron++)
+			{
+				const float maxAbs = maxAbsActivations[idxLayer][idxNeuron];
+				inputScales[idxNeuron] = maxAbs > 0.f ? maxAbs / maxQuantizedValue : 1.f;
+				qLayer.outputInvScales[idxNeuron] = 1.f / inputScales[idxNeuron];
+			}
+			inputZeroPoint = bSignedOutputs ? 128 : 0;
+		}
+	}
+	return true;
+}
+
+int QuantizedNetwork::predict(const LabeledImage& img, QuantizedWorkspace& ws) const
+{
+	assert(ws.inputValues.size() == layers.size());	// ws.init() not called for this network
+
+	const uint8_t* inputValues = img.data;
+	for(int idxLayer=0 ; idxLayer < getNbLayers() ; idxLayer++)
+	{
+		const QuantizedLayer& layer = layers[idxLayer];
+
+		// Rows by 4: the last group may include padding rows, which are 0
+		for(int idxNeuron=0 ; idxNeuron < layer.nbOutputs ; idxNeuron += 4)
+			gKernels.dot4U8S8(inputValues, &layer.weights[(size_t)idxNeuron * layer.inputsStride], layer.inputsStride, layer.nbInputs, &ws.sums[idxNeuron]);
+
+		float* neuronValues = ws.neuronValues.data();
+		for(int idxNeuron=0 ; idxNeuron < layer.nbOutputs ; idxNeuron++)
+			neuronValues[idxNeuron] = layer.weightScales[idxNeuron] * (float)(ws.sums[idxNeuron] - layer.zeroPointCorrections[idxNeuron]) + layer.biases[idxNeuron];
+		applyActivation(layer.activation, neuronValues, neuronValues, layer.nbOutputs);
+
+		if(idxLayer < getNbLayers()-1)
+		{
+			uint8_t* nextInputValues = ws.inputValues[idxLayer+1].data();
+			const int nextZeroPoint = layers[idxLayer+1].inputZeroPoint;
+			for(int idxNeuron=0 ; idxNeuron < layer.nbOutputs ; idxNeuron++)
+				nextInputValues[idxNeuron] = (uint8_t)std::clamp(_roundToInt(neuronValues[idxNeuron] * layer.outputInvScales[idxNeuron]) + nextZeroPoint, 0, 255);
+			inputValues = nextInputValues;
+		}
+	}
+
+	const float* outputs = ws.neuronValues.data();
+	int answer = 0;
+	for(int i=1 ; i < layers.back().nbOutputs ; i++)
+		answer = outputs[i] > outputs[answer] ? i : answer;
+	return answer;
+}
+
+int QuantizedNetwork::computeNbGoodAnswers(const LabeledImageSet& images) const
+{
+	QuantizedWorkspace ws;
+	ws.init(*this);
+	int nbGoodAnswers = 0;
+	for(int idxImage=0 ; idxImage < images.size() ; idxImage++)
+	{
+		const LabeledImage img = images[idxImage];
+		nbGoodAnswers += predict(img, ws) == img.label ? 1 : 0;
+	}
+	return nbGoodAnswers;
+}
+
+void printQuantizationReport(const NeuralNetwork& nn, const QuantizedNetwork& qnn, const LabeledImageSet& images)
+{
+	assert(nn.getNbLayers() == qnn.getNbLayers());
+
+	InferenceWorkspace floatWs;
+	QuantizedWorkspace quantizedWs;
+	floatWs.init(nn);
+	quantizedWs.init(qnn);
+	const int nbOutputs = nn.getLastLayer().nbOutputs;
+	int nbFloatGoodAnswers = 0;
+	int nbQuantizedGoodAnswers = 0;
+	int nbDifferentAnswers = 0;
+	float maxOutputDiff = 0.f;
+	double sumOutputDiffs = 0.;
+	for(int idxImage=0 ; idxImage < images.size() ; idxImage++)
+	{
+		const LabeledImage img = images[idxImage];
+		const int floatAnswer = nn.predict(img, floatWs);
+		const int quantizedAnswer = qnn.predict(img, quantizedWs);
+		nbFloatGoodAnswers += floatAnswer == img.label ? 1 : 0;
+		nbQuantizedGoodAnswers += quantizedAnswer == img.label ? 1 : 0;
+		nbDifferentAnswers += floatAnswer != quantizedAnswer ? 1 : 0;
+		for(int i=0 ; i < nbOutputs ; i++)
+		{
+			const float diff = fabsf(floatWs.neuronValues.back()[i] - quantizedWs.neuronValues[i]);
+			maxOutputDiff = std::max(maxOutputDiff, diff);
+			sumOutputDiffs += diff;
+		}
+	}
+
+	const int nbImages = std::max(images.size(), 1);
+	printf("Float: %d / %d good answers (%.2f%%)  int8: %d / %d (%.2f%%)  delta %+d (%+.2f%%)\n",
+		nbFloatGoodAnswers, images.size(), 100. * nbFloatGoodAnswers / nbImages,
+		nbQuantizedGoodAnswers, images.size(), 100. * nbQuantizedGoodAnswers / nbImages,
+		nbQuantizedGoodAnswers - nbFloatGoodAnswers, 100. * (nbQuantizedGoodAnswers - nbFloatGoodAnswers) / nbImages);
+	printf("Different answers: %d  output difference: max %.6f mean %.6f\n", nbDifferentAnswers, maxOutputDiff, sumOutputDiffs / ((double)nbImages * nbOutputs));
+	printf("Model size: float %zu bytes  int8 %zu bytes\n", nn.getNbParameters() * sizeof(float), qnn.getNbBytes());
+}
+
+// ============================== File ==============================
+
+static void _append(std::vector<unsigned char>& buffer, const void* data, size_t size)
+{
+	buffer.insert(buffer.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+}
+
+// Reads from a buffer whose end is checked before each read
+static uint32_t _computeQuantizedFileCrc(const QuantizedFileHeader& header, const unsigned char* content)
+{
+	QuantizedFileHeader headerWithoutCrc = header;
+	headerWithoutCrc.contentCrc = 0;
+	const uint32_t crc = updateCrc32(0, &headerWithoutCrc, sizeof(headerWithoutCrc));
+	return updateCrc32(crc, content, (size_t)header.contentSize);
+}
+
+struct _BufferReader
+{
+	const unsigned char*	pCur;
+	const unsigned char*	pEnd;
+
+	bool	read(void* outData, size_t size)
+	{
+		if(size > (size_t)(pEnd - pCur))
+			return false;
+		if(size > 0)	// empty arrays have no data pointer
+			memcpy(outData, pCur, size);
+		pCur += size;
+		return true;
+	}
+};
+
+bool QuantizedNetwork::saveToFile(const char* fileName) const
+{
+	std::vector<unsigned char> content;
+	for(int idxLayer=0 ; idxLayer < getNbLayers() ; idxLayer++)
+	{
+		const QuantizedLayer& layer = layers[idxLayer];
+		QuantizedFileLayer fileLayer = {};
+		fileLayer.nbInputs = layer.nbInputs;
+		fileLayer.nbOutputs = layer.nbOutputs;
+		fileLayer.activation = (uint32_t)layer.activation;
+		fileLayer.inputZeroPoint = layer.inputZeroPoint;
+		fileLayer.nbOutputInvScales = (uint32_t)layer.outputInvScales.size();
+		_append(content, &fileLayer, sizeof(fileLayer));
+		_append(content, layer.weights.data(), layer.weights.size());
+		_append(content, layer.weightScales.data(), layer.weightScales.size() * sizeof(float));
+		_append(content, layer.zeroPointCorrections.data(), layer.zeroPointCorrections.size() * sizeof(int32_t));
+		_append(content, layer.biases.data(), layer.biases.size() * sizeof(float));
+		_append(content, layer.outputInvScales.data(), layer.outputInvScales.size() * sizeof(float));
+	}
+
+	QuantizedFileHeader header = {};
+	memcpy(header.magic, kQuantizedFileMagic, sizeof(header.magic));
+	header.version = kQuantizedFileVersion;
+	header.nbLayers = (uint32_t)layers.size();
+	header.contentSize = content.size();
+	header.contentCrc = _computeQuantizedFileCrc(header, content.data());
+
+	FILE* f = fopen(fileName, "wb");
+	if(!f)
+	{
+		fprintf(stderr, "Failed to save quantized network to file: %s\n", fileName);
+		return false;
+	}
+	bool bSuccess = fwrite(&header, sizeof(header), 1, f) == 1;
+	bSuccess = bSuccess && fwrite(content.data(), 1, content.size(), f) == content.size();
+	bSuccess = (fclose(f) == 0) && bSuccess;
+	if(!bSuccess)
+		fprintf(stderr, "Failed to write quantized network file: %s\n", fileName);
+	return bSuccess;
+}
+
+bool QuantizedNetwork::initFromFile(const char* fileName)
+{
+	layers.clear();
+
+	MappedFile file;
+	if(!file.open(fileName))
+	{
+		fprintf(stderr, "Failed to init quantized network from file: %s\n", fileName);
+		return false;
+	}
+
+	QuantizedFileHeader header = {};
+	_BufferReader reader = {file.getData(), file.getData() + file.getSize()};
+	if(!reader.read(&header, sizeof(header)) || memcmp(header.magic, kQuantizedFileMagic, sizeof(header.magic)) != 0)
+	{
+		fprintf(stderr, "Not a quantized network file: %s\n", fileName);
+		return false;
+	}
+	if(header.version != kQuantizedFileVersion)
+	{
+		fprintf(stderr, "Unsupported quantized network file version %u (expected %u): %s\n", header.version, kQuantizedFileVersion, fileName);
+		return false;
+	}
+	// Sizes are checked against the bytes left before anything is allocated from them
+	if(header.contentSize != (uint64_t)(reader.pEnd - reader.pCur) || header.nbLayers > header.contentSize / sizeof(QuantizedFileLayer)
+		|| _computeQuantizedFileCrc(header, reader.pCur) != header.contentCrc)
+	{
+		fprintf(stderr, "Truncated or corrupted quantized network file: %s\n", fileName);
+		return false;
+	}
+
+	std::vector<QuantizedLayer> fileLayers;
+	fileLayers.reserve(header.nbLayers);
+	for(uint32_t idxLayer=0 ; idxLayer < header.nbLayers ; idxLayer++)
+	{
+		QuantizedFileLayer fileLayer = {};
+		const bool bLastLayer = idxLayer == header.nbLayers-1;
+		bool bValid = reader.read(&fileLayer, sizeof(fileLayer))
+			&& fileLayer.nbInputs > 0 && fileLayer.nbInputs < (1 << 24) && fileLayer.nbOutputs > 0 && fileLayer.nbOutputs < (1 << 24)
+			&& (idxLayer == 0 || fileLayer.nbInputs == fileLayers[idxLayer-1].nbOutputs)
+			&& fileLayer.activation <= (uint32_t)Activation::Softmax && (fileLayer.inputZeroPoint == 0 || fileLayer.inputZeroPoint == 128)
+			&& fileLayer.nbOutputInvScales == (bLastLayer ? 0u : (uint32_t)fileLayer.nbOutputs);
+		QuantizedLayer& layer = fileLayers.emplace_back();
+		if(bValid)
+		{
+			const size_t outputsStride = padToCacheLine(fileLayer.nbOutputs);
+			const size_t nbLayerBytes = outputsStride * padInt8ToCacheLine(fileLayer.nbInputs)
+				+ outputsStride * (sizeof(float) + sizeof(int32_t) + sizeof(float)) + fileLayer.nbOutputInvScales * sizeof(float);
+			bValid = nbLayerBytes <= (size_t)(reader.pEnd - reader.pCur);
+		}
+		if(bValid)
+		{
+			layer.nbInputs = fileLayer.nbInputs;
+			layer.nbOutputs = fileLayer.nbOutputs;
+			layer.inputsStride = padInt8ToCacheLine(layer.nbInputs);
+			layer.outputsStride = padToCacheLine(layer.nbOutputs);
+			layer.activation = (Activation)fileLayer.activation;
+			layer.inputZeroPoint = fileLayer.inputZeroPoint;
+			layer.weights.resize((size_t)layer.outputsStride * layer.inputsStride);
+			layer.weightScales.resize(layer.outputsStride);
+			layer.zeroPointCorrections.resize(layer.outputsStride);
+			layer.biases.resize(layer.outputsStride);
+			layer.outputInvScales.resize(fileLayer.nbOutputInvScales);
+			bValid = reader.read(layer.weights.data(), layer.weights.size())
+				&& reader.read(layer.weightScales.data(), layer.weightScales.size() * sizeof(float))
+				&& reader.read(layer.zeroPointCorrections.data(), layer.zeroPointCorrections.size() * sizeof(int32_t))
+				&& reader.read(layer.biases.data(), layer.biases.size() * sizeof(float))
+				&& reader.read(layer.outputInvScales.data(), layer.outputInvScales.size() * sizeof(float));
+		}
+		if(!bValid)
+		{
+			fprintf(stderr, "Invalid layer %u in quantized network file: %s\n", idxLayer, fileName);
+			return false;
+		}
+	}
+	if(fileLayers.empty() || fileLayers[0].nbInputs != IMG_SX*IMG_SY)
+	{
+		fprintf(stderr, "Quantized network file does not take %d pixels: %s\n", IMG_SX*IMG_SY, fileName);
+		return false;
+	}
+
+	layers = std::move(fileLayers);
+	return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+
+// Int8 rows are padded to a cache line of 64 values, as float rows are (see padToCacheLine())
+const int kNbInt8PerCacheLine = 64;
+constexpr int padInt8ToCacheLine(int nbValues)
+{
+	return (nbValues + kNbInt8PerCacheLine - 1) & ~(kNbInt8PerCacheLine - 1);
+}
+
+// Layer of a QuantizedNetwork. Its inputs are uint8 values q, standing for x[i] = inputScales[i] * (q[i] - inputZeroPoint).
+// The input scales are folded into the float weights before they are quantized to int8 with one scale per neuron, so that
+//   z[n] = weightScales[n] * (sum(q[i] * weights[n][i]) - zeroPointCorrections[n]) + biases[n]
+// where the sum is exact in int32 and zeroPointCorrections[n] = inputZeroPoint * sum(weights[n][i]).
+struct QuantizedLayer
+{
+	int			nbInputs = 0;
+	int			nbOutputs = 0;
+	int			inputsStride = 0;	// padInt8ToCacheLine(nbInputs)
+	int			outputsStride = 0;	// padToCacheLine(nbOutputs): rows are computed by 4, padding rows are 0
+	Activation	activation = Activation::Sigmoid;
+	int			inputZeroPoint = 0;	// 0 for non-negative inputs (pixels, sigmoid, ReLU), 128 for signed ones (tanh, leaky ReLU)
+
+	AlignedVector<int8_t>	weights;				// [outputsStride x inputsStride], in [-127;127], padding 0
+	AlignedVector<float>	weightScales;			// [outputsStride]
+	AlignedVector<int32_t>	zeroPointCorrections;	// [outputsStride]
+	AlignedVector<float>	biases;					// [outputsStride]
+
+	// Quantization of the outputs into the inputs of the next layer: q[n] = clamp(round(a[n] * outputInvScales[n]) + nextZeroPoint, 0, 255)
+	// with nextZeroPoint the inputZeroPoint of the next layer. Empty for the last layer, whose outputs stay float.
+	AlignedVector<float>	outputInvScales;	// [nbOutputs]
+
+	size_t	getNbBytes() const	{ return weights.size() + (weightScales.size() + zeroPointCorrections.size() + biases.size() + outputInvScales.size()) * 4; }
+};
+
+struct QuantizedNetwork;
+
+// Temporary values of a QuantizedNetwork inference, owned by the caller (see InferenceWorkspace)
+struct QuantizedWorkspace
+{
+	std::vector<AlignedVector<uint8_t>>	inputValues;	// quantized inputs of layers 1 to n-1, [inputsStride], padding 0
+	AlignedVector<int32_t>				sums;			// int32 sums of the current layer, [outputsStride]
+	AlignedVector<float>				neuronValues;	// float outputs of the current layer, the network outputs after predict()
+
+	void	init(const QuantizedNetwork& qnn);
+};
+
+// Int8 post-training quantization of a NeuralNetwork, for inference only.
+// The first layer takes the raw uint8 pixels of the images: their scale kPixelScale is folded into its weights, so they are
+// used as is, without any conversion. Hidden activations are requantized to uint8 with one scale per neuron, calibrated as
+// the maximum absolute activation of the neuron over a set of images. Outputs of the last layer stay float.
+// All paths of gKernels.dot4U8S8 give the same int32 sums, so results only depend on the float epilogue of each layer.
+struct QuantizedNetwork
+{
+	std::vector<QuantizedLayer>	layers;
+
+	int		getNbLayers() const		{ return (int)layers.size(); }
+	size_t	getNbBytes() const;		// size of the quantized model in memory
+
+	// Requires a network taking IMG_SX*IMG_SY pixels and at least one calibration image
+	bool	quantize(const NeuralNetwork& nn, const LabeledImageSet& calibrationImages);
+
+	// Own format: magic, version, layers, CRC-32 of the header and layers
+	bool	saveToFile(const char* fileName) const;
+	bool	initFromFile(const char* fileName);
+
+	// Single image inference, from the raw pixels of img. Returns the index of the highest output neuron.
+	int		predict(const LabeledImage& img, QuantizedWorkspace& ws) const;
+	int		computeNbGoodAnswers(const LabeledImageSet& images) const;
+};
+
+// Prints the accuracy of nn and of its quantized version qnn on images, the delta, how many answers differ, the largest
+// difference of their outputs, and the size of both models
+void printQuantizationReport(const NeuralNetwork& nn, const QuantizedNetwork& qnn, const LabeledImageSet& images);
@@ -0,0 +1,97 @@
+#include "Random.h"
+#include "Kernels.h"
+#include <atomic>
+
+// ===== GAUSSIAN GENERATOR =====
+
+// Values are generated by blocks of kNormalBlockSize, block b holding values [b*kNormalBlockSize; (b+1)*kNormalBlockSize[.
+// Each pair of values comes from one 64-bit counter-based draw, split into two 24-bit uniforms for the Box-Muller kernel.
+static const int kNormalBlockSize = 32;
+static const float kTwoPow24Inv = 1.f / 16777216.f;
+
+static void _generateNormalBlock(uint64_t key, uint64_t idxBlock, float* outBlock)
+{
+	const int kNbPairs = kNormalBlockSize / 2;
+	float radius[kNbPairs];
+	float angle[kNbPairs];
+	for(int i=0 ; i < kNbPairs ; i++)
+	{
+		const uint64_t bits = randomCounterU64(key, idxBlock * kNbPairs + i);
+		radius[i] = (float)((int)(bits >> 40) + 1) * kTwoPow24Inv;	// in ]0;1]
+		angle[i] = (float)(int)(bits & 0xFFFFFF) * kTwoPow24Inv;		// in [0;1[
+	}
+
+	gKernels.boxMuller(outBlock, radius, angle, kNbPairs);
+}
+
+void randomNormalFill(float* out, size_t n, uint64_t key, uint64_t firstIndex)
+{
+	// Whole blocks are always generated the same way, then the requested range is copied: values don't depend on the range
+	float block[kNormalBlockSize];
+	uint64_t idx = firstIndex;
+	const uint64_t idxEnd = firstIndex + n;
+	while(idx < idxEnd)
+	{
+		const uint64_t idxBlock = idx / kNormalBlockSize;
+		const uint64_t idxInBlock = idx % kNormalBlockSize;
+		const uint64_t nbValues = std::min<uint64_t>(kNormalBlockSize - idxInBlock, idxEnd - idx);
+		if(idxInBlock == 0 && nbValues == kNormalBlockSize)
+		{
+			_generateNormalBlock(key, idxBlock, &out[idx - firstIndex]);
+		}
+		else
+		{
+			_generateNormalBlock(key, idxBlock, block);
+			memcpy(&out[idx - firstIndex], &block[idxInBlock], nbValues * sizeof(float));
+		}
+		idx += nbValues;
+	}
+}
+
+RandomGenerator& getThreadRandomGenerator()
+{
+	static std::atomic<uint64_t> s_nbThreadGenerators{0};
+	static thread_local RandomGenerator s_generator(0, s_nbThreadGenerators++);
+	return s_generator;
+}
+
+// ===== EPOCH SAMPLER =====
+
+EpochSampler::EpochSampler(int nbImages, uint64_t seed, int idxPartition, int nbPartitions)
+	: m_seed(seed)
+{
+	assert(nbImages > 0 && idxPartition >= 0 && idxPartition < nbPartitions && nbPartitions <= nbImages);
+	m_permutation.resize(nbImages);
+	m_idxSliceStart = (int)((int64_t)nbImages * idxPartition / nbPartitions);
+	m_idxSliceEnd = (int)((int64_t)nbImages * (idxPartition+1) / nbPartitions);
+	m_nextIndex = m_idxSliceEnd;	// first nextBatch() shuffles epoch 0
+}
+
+void EpochSampler::shuffleEpoch()
+{
+	m_epoch++;
+
+	// Fisher-Yates from the identity, so that the permutation does not depend on the previous epochs.
+	// Draw i only depends on (seed, epoch, i): every partition computes the same permutation.
+	const int nbImages = (int)m_permutation.size();
+	for(int i=0 ; i < nbImages ; i++)
+		m_permutation[i] = i;
+
+	const uint64_t key = randomStreamKey(m_seed, (uint64_t)m_epoch);
+	for(int i = nbImages-1 ; i > 0 ; i--)
+	{
+		const int j = (int)randomBounded(randomCounterU64(key, (uint64_t)i), (uint32_t)i + 1);
+		std::swap(m_permutation[i], m_permutation[j]);
+	}
+	m_nextIndex = m_idxSliceStart;
+}
+
+void EpochSampler::nextBatch(int* outImageIndices, int batchSize)
+{
+	for(int i=0 ; i < batchSize ; i++)
+	{
+		if(m_nextIndex == m_idxSliceEnd)
+			shuffleEpoch();
+		outImageIndices[i] = m_permutation[m_nextIndex++];
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+// Counter-based random numbers: value n of a stream is a pure function of (key, n), computed with the SplitMix64 mixer.
+// There is no state to share or lock, a stream can be split across threads by counter ranges, and results only depend on
+// the seed, not on the order in which values are drawn.
+inline uint64_t randomMix64(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+// Key of an independent stream derived from a seed and a stream index (epoch, thread...)
+inline uint64_t randomStreamKey(uint64_t seed, uint64_t idxStream)
+{
+	return randomMix64(randomMix64(seed) ^ (idxStream * 0xD1B54A32D192ED03ull));
+}
+
+inline uint64_t randomCounterU64(uint64_t key, uint64_t counter)
+{
+	return randomMix64(key + counter * 0x9E3779B97F4A7C15ull);
+}
+
+// Uniform integer in [0;range[ with a multiply-shift (Lemire). The bias is below range / 2^32, negligible for image counts.
+inline uint32_t randomBounded(uint64_t randomBits, uint32_t range)
+{
+	return (uint32_t)(((randomBits >> 32) * range) >> 32);
+}
+
+// Fills out[0..n-1] with the standard normal values firstIndex..firstIndex+n-1 of stream key.
+// Value i is a pure function of (key, i): a range can be split in any way across threads and gives the same values.
+// Box-Muller on blocks of values with the gKernels.boxMuller SIMD kernel, whose results are identical on all ISAs.
+// Max error against Box-Muller with the standard library log/sin/cos: below 1e-6.
+void	randomNormalFill(float* out, size_t n, uint64_t key, uint64_t firstIndex = 0);
+
+// Seedable stream of random numbers, meant to be owned by one thread. Streams of a same seed with different
+// indices are independent, so threads get reproducible numbers by using their own stream index, without sharing state.
+class RandomGenerator
+{
+public:
+	explicit RandomGenerator(uint64_t seed = 0, uint64_t idxStream = 0)
+		: m_key(randomStreamKey(seed, idxStream))
+	{
+	}
+
+	uint64_t	nextU64()	{ return randomCounterU64(m_key, m_counter++); }
+	int			nextInt(int minVal, int maxVal)	{ return minVal + (int)randomBounded(nextU64(), (uint32_t)(maxVal - minVal) + 1); }	// in [minVal;maxVal]
+
+	float		nextNormal()
+	{
+		if(m_idxNextNormal == kNbBufferedNormals)
+		{
+			randomNormalFill(m_normals, kNbBufferedNormals, m_key ^ kNormalKeyMask, m_nbNormals);
+			m_nbNormals += kNbBufferedNormals;
+			m_idxNextNormal = 0;
+		}
+		return m_normals[m_idxNextNormal++];
+	}
+
+private:
+	static const int		kNbBufferedNormals = 32;
+	static const uint64_t	kNormalKeyMask = 0xA5A5A5A5A5A5A5A5ull;	// normals use their own stream
+
+	uint64_t	m_key = 0;
+	uint64_t	m_counter = 0;
+	uint64_t	m_nbNormals = 0;
+	int			m_idxNextNormal = kNbBufferedNormals;
+	float		m_normals[kNbBufferedNormals];
+};
+
+// Generator of the calling thread, used by randNormal() and randInt(). Its stream index is the order in which threads first used it.
+RandomGenerator&	getThreadRandomGenerator();
+
+// Samples images without replacement: each epoch visits all images once, in the order of an in-place Fisher-Yates shuffle.
+// The permutation of an epoch only depends on (seed, epoch), so runs are reproducible. It can also be partitioned:
+// the sampler of partition idxPartition / nbPartitions walks a disjoint slice of each epoch permutation, so that worker threads
+// sample their own batches without shared state, and all partitions together still visit each image once per epoch.
+class EpochSampler
+{
+public:
+	EpochSampler(int nbImages, uint64_t seed, int idxPartition = 0, int nbPartitions = 1);
+
+	// Writes the next batchSize image indices. When the slice of the current epoch is exhausted, the next epoch is shuffled.
+	void	nextBatch(int* outImageIndices, int batchSize);
+
+	int		getEpoch() const	{ return m_epoch; }
+
+private:
+	void	shuffleEpoch();
+
+	std::vector<int>	m_permutation;
+	uint64_t			m_seed = 0;
+	int					m_epoch = -1;
+	int					m_idxSliceStart = 0;
+	int					m_idxSliceEnd = 0;
+	int					m_nextIndex = 0;	// in m_permutation
+};
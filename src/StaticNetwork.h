@@ -0,0 +1,384 @@
+#pragma once
+
+#include <array>
+#include <utility>
+#include "NeuralNetwork.h"
+#include "Kernels.h"
+
+// Offsets in the StaticNetwork buffers. Free functions, so that they can size the arrays of the class being defined.
+constexpr int _getStaticValuesOffset(const int* layerSizes, int idxValues)
+{
+	int offset = 0;
+	for(int i=0 ; i < idxValues ; i++)
+		offset += padToCacheLine(layerSizes[i]);
+	return offset;
+}
+
+constexpr int _getStaticWeightsOffset(const int* layerSizes, int idxLayer)
+{
+	int offset = 0;
+	for(int i=0 ; i < idxLayer ; i++)
+		offset += (layerSizes[i] + 1) * padToCacheLine(layerSizes[i+1]);
+	return offset;
+}
+
+// Network whose topology is fixed at compile time, e.g. StaticNetwork<IMG_SX*IMG_SY, 16, 16, 10> for the deployed model.
+// It computes the same thing as a NeuralNetwork of these layer sizes, but every size, stride and offset is a constant:
+// - the loop over layers is expanded at compile time, each layer being its own function instantiation
+// - weights are stored input-major ([nbInputs x outputsStride] per layer), so that a layer is a sequence of full-width
+//   multiply-adds across its neurons: the compiler vectorizes them without reassociating any sum, and fully unrolls
+//   the loops over neurons, whose trip counts are small constants
+// Parameters live in one aligned std::array, as [weights | biases] blocks per layer like NeuralNetwork::parameters.
+// trainStep() runs both passes on blocks of kTrainingBlockSize images, so that each weight and gradient row is loaded
+// once per block rather than once per image: the passes become small GEMMs, as in NeuralNetwork::trainStep().
+template<int... LayerSizes>
+class StaticNetwork
+{
+public:
+	static constexpr int	kNbLayers = (int)sizeof...(LayerSizes) - 1;
+	static constexpr int	kLayerSizes[] = {LayerSizes...};	// from the inputs to the outputs
+	static constexpr int	kNbInputs = kLayerSizes[0];
+	static constexpr int	kNbOutputs = kLayerSizes[kNbLayers];
+	static constexpr int	kTrainingBlockSize = 8;	// images per block of trainStep(): their sums fit in vector registers
+
+	static_assert(kNbLayers >= 1, "a network needs at least one layer");
+
+	// Values idxValues of the network: 0 are the inputs, idxLayer+1 the outputs of layer idxLayer
+	static constexpr int	getValuesStride(int idxValues)	{ return padToCacheLine(kLayerSizes[idxValues]); }
+	static constexpr int	getValuesOffset(int idxValues)	{ return _getStaticValuesOffset(kLayerSizes, idxValues); }
+	static constexpr int	kNbValues = _getStaticValuesOffset(kLayerSizes, kNbLayers+1);
+
+	// Parameters block of layer idxLayer: weights [nbInputs x outputsStride], then biases [outputsStride]
+	static constexpr int	getWeightsOffset(int idxLayer)	{ return _getStaticWeightsOffset(kLayerSizes, idxLayer); }
+	static constexpr int	getBiasesOffset(int idxLayer)	{ return getWeightsOffset(idxLayer) + kLayerSizes[idxLayer] * getValuesStride(idxLayer+1); }
+	static constexpr int	kNbParameters = _getStaticWeightsOffset(kLayerSizes, kNbLayers);
+
+	using Parameters = std::array<float, kNbParameters>;
+	using Values = std::array<float, kNbValues>;
+
+	// Temporary values of the passes, owned by the caller like InferenceWorkspace: predict() is const
+	struct Workspace
+	{
+		alignas(64) Values	neuronValues = {};	// inputs, then outputs of each layer. Padding stays 0.
+
+		// Values and deltas of the images of a trainStep() block, each with the layout of neuronValues (inputs part of
+		// the deltas unused). Padding stays 0.
+		alignas(64) std::array<Values, kTrainingBlockSize>	blockNeuronValues = {};
+		alignas(64) std::array<Values, kTrainingBlockSize>	blockBackpropDeltas = {};
+
+		float*			getInputValues()		{ return neuronValues.data(); }
+		const float*	getOutputValues() const	{ return &neuronValues[getValuesOffset(kNbLayers)]; }
+	};
+
+	alignas(64) Parameters	parameters = {};
+
+	// Sum of the cost partial derivatives of the last trainStep(), same layout as parameters
+	alignas(64) Parameters	costGradient = {};
+
+	// Model or legacy file, read by NeuralNetwork::initFromFile(). Fails if the layer sizes of the file are not the ones
+	// of the template, or if a layer is not a sigmoid one.
+	bool initFromFile(const char* fileName)
+	{
+		NeuralNetwork nn;
+		if(!nn.initFromFile(fileName))
+			return false;
+
+		if(nn.getNbLayers() != kNbLayers)
+		{
+			fprintf(stderr, "%s has %d layers, not %d\n", fileName, nn.getNbLayers(), kNbLayers);
+			return false;
+		}
+
+		parameters.fill(0.f);
+		for(int idxLayer=0 ; idxLayer < kNbLayers ; idxLayer++)
+		{
+			const Layer& layer = nn.layers[idxLayer];
+			const int nbInputs = kLayerSizes[idxLayer];
+			const int nbOutputs = kLayerSizes[idxLayer+1];
+			const int outputsStride = getValuesStride(idxLayer+1);
+			if(layer.nbInputs != nbInputs || layer.nbOutputs != nbOutputs || layer.activation != Activation::Sigmoid)
+			{
+				fprintf(stderr, "Layer %d of %s is not a %dx%d sigmoid layer\n", idxLayer, fileName, nbInputs, nbOutputs);
+				return false;
+			}
+
+			// Layer rows are neuron-major: scatter them into the input-major weights
+			for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
+			{
+				for(int idxInput=0 ; idxInput < nbInputs ; idxInput++)
+					parameters[getWeightsOffset(idxLayer) + idxInput * outputsStride + idxNeuron] = layer.getWeight(idxNeuron, idxInput);
+				parameters[getBiasesOffset(idxLayer) + idxNeuron] = layer.biases[idxNeuron];
+			}
+		}
+		return true;
+	}
+
+	// Single image inference: inData holds kNbInputs values. Returns the index of the highest output neuron.
+	int predict(const float* inData, Workspace& ws) const
+	{
+		memcpy(ws.getInputValues(), inData, kNbInputs * sizeof(float));
+		feedForward(ws);
+		return getAnswer(ws);
+	}
+
+	int predict(const LabeledImage& img, Workspace& ws) const
+	{
+		static_assert(kNbInputs == IMG_SX*IMG_SY, "network inputs are not images");
+		img.convertToFloat(ws.getInputValues());
+		feedForward(ws);
+		return getAnswer(ws);
+	}
+
+	// One SGD step on images, by blocks of kTrainingBlockSize images: weights += -learningRate * costGradient, with the cost of NeuralNetwork
+	void trainStep(const LabeledImageSet& images, const int* imageIndices, int nbImages, float learningRate, Workspace& ws)
+	{
+		if(nbImages == 0)
+			return;
+
+		costGradient.fill(0.f);
+		switch(gKernels.isa)
+		{
+			case KernelsISA::AVX512:	accumulateCostGradientAVX512(images, imageIndices, nbImages, ws); break;
+			case KernelsISA::AVX2:		accumulateCostGradientAVX2(images, imageIndices, nbImages, ws); break;
+			default:					accumulateCostGradient(images, imageIndices, nbImages, ws); break;
+		}
+
+		const float alpha = -learningRate / (float)nbImages;
+		for(int i=0 ; i < kNbParameters ; i++)
+			parameters[i] += alpha * costGradient[i];
+	}
+
+	int computeNbGoodAnswers(const LabeledImageSet& images, Workspace& ws) const
+	{
+		int nbGoodAnswers = 0;
+		for(int idxImage=0 ; idxImage < images.size() ; idxImage++)
+			nbGoodAnswers += predict(images[idxImage], ws) == images.labels[idxImage] ? 1 : 0;
+		return nbGoodAnswers;
+	}
+
+private:
+	static int getAnswer(const Workspace& ws)
+	{
+		const float* outputs = ws.getOutputValues();
+		int answer = 0;
+		for(int i=1 ; i < kNbOutputs ; i++)
+			answer = outputs[i] > outputs[answer] ? i : answer;
+		return answer;
+	}
+
+	// The passes are inlined into functions targeting the ISA of gKernels, so that their loops are vectorized at its width
+	void feedForward(Workspace& ws) const
+	{
+		switch(gKernels.isa)
+		{
+			case KernelsISA::AVX512:	feedForwardAVX512(ws); break;
+			case KernelsISA::AVX2:		feedForwardAVX2(ws); break;
+			default:					feedForwardLayers(ws, std::make_integer_sequence<int, kNbLayers>()); break;
+		}
+	}
+
+	KERNELS_TARGET_AVX512 void	feedForwardAVX512(Workspace& ws) const	{ feedForwardLayers(ws, std::make_integer_sequence<int, kNbLayers>()); }
+	KERNELS_TARGET_AVX2 void	feedForwardAVX2(Workspace& ws) const	{ feedForwardLayers(ws, std::make_integer_sequence<int, kNbLayers>()); }
+
+	template<int... IdxLayers>
+	KERNELS_FORCE_INLINE void feedForwardLayers(Workspace& ws, std::integer_sequence<int, IdxLayers...>) const
+	{
+		(feedForwardLayer<IdxLayers>(ws), ...);
+	}
+
+	// Outputs of layer idxLayer from its inputs, both in ws.neuronValues
+	template<int IdxLayer>
+	KERNELS_FORCE_INLINE void feedForwardLayer(Workspace& ws) const
+	{
+		constexpr int nbInputs = kLayerSizes[IdxLayer];
+		constexpr int nbOutputs = kLayerSizes[IdxLayer+1];
+		constexpr int outputsStride = getValuesStride(IdxLayer+1);
+		const float* inData = &ws.neuronValues[getValuesOffset(IdxLayer)];
+		const float* weights = &parameters[getWeightsOffset(IdxLayer)];
+		const float* biases = &parameters[getBiasesOffset(IdxLayer)];
+		float* outData = &ws.neuronValues[getValuesOffset(IdxLayer+1)];
+
+		// Inputs are accumulated by 4 into independent partial sums, so that consecutive multiply-adds do not wait for each other
+		constexpr int nbBlockedInputs = nbInputs & ~3;
+		alignas(64) float z0[outputsStride] = {};
+		alignas(64) float z1[outputsStride] = {};
+		alignas(64) float z2[outputsStride] = {};
+		alignas(64) float z3[outputsStride] = {};
+		for(int idxInput=0 ; idxInput < nbBlockedInputs ; idxInput += 4)
+		{
+			const float* inputWeights = &weights[idxInput * outputsStride];
+			multiplyAddRow<outputsStride>(z0, inData[idxInput], inputWeights);
+			multiplyAddRow<outputsStride>(z1, inData[idxInput+1], &inputWeights[outputsStride]);
+			multiplyAddRow<outputsStride>(z2, inData[idxInput+2], &inputWeights[2*outputsStride]);
+			multiplyAddRow<outputsStride>(z3, inData[idxInput+3], &inputWeights[3*outputsStride]);
+		}
+		if constexpr(nbBlockedInputs < nbInputs)
+		{
+			for(int idxInput=nbBlockedInputs ; idxInput < nbInputs ; idxInput++)
+			{
+				for(int idxNeuron=0 ; idxNeuron < outputsStride ; idxNeuron++)
+					z0[idxNeuron] += inData[idxInput] * weights[idxInput * outputsStride + idxNeuron];
+			}
+		}
+
+		alignas(64) float z[outputsStride];
+		for(int idxNeuron=0 ; idxNeuron < outputsStride ; idxNeuron++)
+			z[idxNeuron] = biases[idxNeuron] + ((z0[idxNeuron] + z1[idxNeuron]) + (z2[idxNeuron] + z3[idxNeuron]));
+		gKernels.sigmoid(outData, z, nbOutputs);	// same activation evaluation as NeuralNetwork
+	}
+
+	KERNELS_TARGET_AVX512 void	accumulateCostGradientAVX512(const LabeledImageSet& images, const int* imageIndices, int nbImages, Workspace& ws)	{ accumulateCostGradient(images, imageIndices, nbImages, ws); }
+	KERNELS_TARGET_AVX2 void	accumulateCostGradientAVX2(const LabeledImageSet& images, const int* imageIndices, int nbImages, Workspace& ws)	{ accumulateCostGradient(images, imageIndices, nbImages, ws); }
+
+	KERNELS_FORCE_INLINE void accumulateCostGradient(const LabeledImageSet& images, const int* imageIndices, int nbImages, Workspace& ws)
+	{
+		int idxImage = 0;
+		for( ; idxImage + kTrainingBlockSize <= nbImages ; idxImage += kTrainingBlockSize)
+			accumulateBlockCostGradient<kTrainingBlockSize>(images, &imageIndices[idxImage], ws);
+		for( ; idxImage < nbImages ; idxImage++)
+			accumulateBlockCostGradient<1>(images, &imageIndices[idxImage], ws);
+	}
+
+	template<int NbImages>
+	KERNELS_FORCE_INLINE void accumulateBlockCostGradient(const LabeledImageSet& images, const int* imageIndices, Workspace& ws)
+	{
+		int labels[NbImages];
+		for(int i=0 ; i < NbImages ; i++)
+		{
+			const LabeledImage img = images[imageIndices[i]];
+			img.convertToFloat(ws.blockNeuronValues[i].data());
+			labels[i] = img.label;
+		}
+		feedForwardBlockLayers<NbImages>(ws, std::make_integer_sequence<int, kNbLayers>());
+		backPropagateBlockLayers<NbImages>(ws, labels, std::make_integer_sequence<int, kNbLayers>());
+	}
+
+	// sums[i] += value i * row, for each image i of a block. The images are expanded at compile time, so that the sums
+	// are independent registers.
+	template<int Stride, int... Is>
+	KERNELS_FORCE_INLINE static void multiplyAddBlockRow(float (*sums)[Stride], const Workspace& ws, int idxValue, const float* row, std::integer_sequence<int, Is...>)
+	{
+		(multiplyAddRow<Stride>(sums[Is], ws.blockNeuronValues[Is][idxValue], row), ...);
+	}
+
+	// sum += sum over the images i of a block of value i * rows[i]
+	template<int Stride, int... Is>
+	KERNELS_FORCE_INLINE static void multiplyAddBlockColumn(float* sum, const Workspace& ws, int idxValue, const float (*rows)[Stride], std::integer_sequence<int, Is...>)
+	{
+		(multiplyAddRow<Stride>(sum, ws.blockNeuronValues[Is][idxValue], rows[Is]), ...);
+	}
+
+	// sum += value * row over Stride values. Each call is its own loop over a vector or two, that the compiler fully unrolls:
+	// sums updated by consecutive calls then stay in registers, where a single loop updating all of them reloads and
+	// stores them at each iteration.
+	template<int Stride>
+	KERNELS_FORCE_INLINE static void multiplyAddRow(float* sum, float value, const float* row)
+	{
+		for(int i=0 ; i < Stride ; i++)
+			sum[i] += value * row[i];
+	}
+
+	template<int NbImages, int... IdxLayers>
+	KERNELS_FORCE_INLINE void feedForwardBlockLayers(Workspace& ws, std::integer_sequence<int, IdxLayers...>) const
+	{
+		(feedForwardBlockLayer<IdxLayers, NbImages>(ws), ...);
+	}
+
+	// feedForwardLayer() of NbImages images: each row of input weights is loaded once for all of them, and the images
+	// give independent sums, so that consecutive multiply-adds do not wait for each other
+	template<int IdxLayer, int NbImages>
+	KERNELS_FORCE_INLINE void feedForwardBlockLayer(Workspace& ws) const
+	{
+		constexpr int nbInputs = kLayerSizes[IdxLayer];
+		constexpr int nbOutputs = kLayerSizes[IdxLayer+1];
+		constexpr int outputsStride = getValuesStride(IdxLayer+1);
+		constexpr int inOffset = getValuesOffset(IdxLayer);
+		const float* weights = &parameters[getWeightsOffset(IdxLayer)];
+		const float* biases = &parameters[getBiasesOffset(IdxLayer)];
+
+		alignas(64) float z[NbImages][outputsStride];
+		for(int i=0 ; i < NbImages ; i++)
+			memcpy(z[i], biases, sizeof(z[i]));
+		for(int idxInput=0 ; idxInput < nbInputs ; idxInput++)
+		{
+			const float* inputWeights = &weights[idxInput * outputsStride];
+			multiplyAddBlockRow(z, ws, inOffset + idxInput, inputWeights, std::make_integer_sequence<int, NbImages>());
+		}
+		for(int i=0 ; i < NbImages ; i++)
+			gKernels.sigmoid(&ws.blockNeuronValues[i][getValuesOffset(IdxLayer+1)], z[i], nbOutputs);
+	}
+
+	// Layers are back-propagated from the last one
+	template<int NbImages, int... IdxLayers>
+	KERNELS_FORCE_INLINE void backPropagateBlockLayers(Workspace& ws, const int* labels, std::integer_sequence<int, IdxLayers...>)
+	{
+		(backPropagateBlockLayer<kNbLayers-1 - IdxLayers, NbImages>(ws, labels), ...);
+	}
+
+	// Deltas of layer idxLayer from the ones of the next layer (or from the label for the last layer),
+	// then accumulation of its cost partial derivatives. sigma'(z) = a * (1-a) is computed from the stored activations.
+	template<int IdxLayer, int NbImages>
+	KERNELS_FORCE_INLINE void backPropagateBlockLayer(Workspace& ws, const int* labels)
+	{
+		constexpr int nbInputs = kLayerSizes[IdxLayer];
+		constexpr int nbOutputs = kLayerSizes[IdxLayer+1];
+		constexpr int outputsStride = getValuesStride(IdxLayer+1);
+		constexpr int outOffset = getValuesOffset(IdxLayer+1);
+
+		// Deltas are kept in a local array: the compiler then knows the gradient stores cannot modify them, and keeps them in registers.
+		// Padding deltas are 0.
+		alignas(64) float deltas[NbImages][outputsStride] = {};
+		for(int i=0 ; i < NbImages ; i++)
+		{
+			const float* activations = &ws.blockNeuronValues[i][outOffset];
+			if constexpr(IdxLayer == kNbLayers-1)
+			{
+				for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
+				{
+					const float a = activations[idxNeuron];
+					const float dCostRelativeToActivation = 2.f * (a - (idxNeuron == labels[i] ? 1.f : 0.f));
+					deltas[i][idxNeuron] = dCostRelativeToActivation * a * (1.f - a);
+				}
+			}
+			else
+			{
+				// Delta = (NextW * NextDelta) .* sigma'(z): rows of the input-major NextW are contiguous
+				constexpr int nbNextOutputs = kLayerSizes[IdxLayer+2];
+				constexpr int nextOutputsStride = getValuesStride(IdxLayer+2);
+				const float* nextWeights = &parameters[getWeightsOffset(IdxLayer+1)];
+				const float* nextDeltas = &ws.blockBackpropDeltas[i][getValuesOffset(IdxLayer+2)];
+				for(int idxNeuron=0 ; idxNeuron < nbOutputs ; idxNeuron++)
+				{
+					float delta = 0.f;
+					for(int idxNextNeuron=0 ; idxNextNeuron < nbNextOutputs ; idxNextNeuron++)
+						delta += nextWeights[idxNeuron * nextOutputsStride + idxNextNeuron] * nextDeltas[idxNextNeuron];
+					const float a = activations[idxNeuron];
+					deltas[i][idxNeuron] = delta * a * (1.f - a);
+				}
+			}
+			if constexpr(IdxLayer > 0)	// read by the previous layer
+				memcpy(&ws.blockBackpropDeltas[i][outOffset], deltas[i], sizeof(deltas[i]));
+		}
+
+		// dCost/dW[idxInput][idxNeuron] += sum(input * delta) over the images, vectorized across neurons:
+		// each gradient row is loaded and stored once per block
+		constexpr int inOffset = getValuesOffset(IdxLayer);
+		float* weightsGradient = &costGradient[getWeightsOffset(IdxLayer)];
+		float* biasesGradient = &costGradient[getBiasesOffset(IdxLayer)];
+		for(int idxInput=0 ; idxInput < nbInputs ; idxInput++)
+		{
+			alignas(64) float inputGradient[outputsStride] = {};
+			multiplyAddBlockColumn(inputGradient, ws, inOffset + idxInput, deltas, std::make_integer_sequence<int, NbImages>());
+			for(int idxNeuron=0 ; idxNeuron < outputsStride ; idxNeuron++)
+				weightsGradient[idxInput * outputsStride + idxNeuron] += inputGradient[idxNeuron];
+		}
+		for(int i=0 ; i < NbImages ; i++)
+		{
+			for(int idxNeuron=0 ; idxNeuron < outputsStride ; idxNeuron++)
+				biasesGradient[idxNeuron] += deltas[i][idxNeuron];
+		}
+	}
+};
+
+// Topology of the deployed weightsAndBiases_*.bin models
+using DeployedStaticNetwork = StaticNetwork<IMG_SX*IMG_SY, 16, 16, 10>;
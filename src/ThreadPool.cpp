@@ -0,0 +1,95 @@
+#include "ThreadPool.h"
+
+int ThreadPool::getDefaultNbThreads()
+{
+#ifdef __EMSCRIPTEN__
+	return 1;
+#else
+	return std::max(1, (int)std::thread::hardware_concurrency());
+#endif
+}
+
+ThreadPool::ThreadPool(int nbThreads)
+{
+#ifdef __EMSCRIPTEN__
+	nbThreads = 1;
+#endif
+	m_nbThreads = std::max(1, nbThreads);
+	m_workerThreads.reserve(m_nbThreads - 1);
+	for(int i=1 ; i < m_nbThreads ; i++)
+		m_workerThreads.emplace_back(&ThreadPool::workerThreadFunc, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bExit = true;
+	}
+	m_jobStartedCondition.notify_all();
+	for(std::thread& thread : m_workerThreads)
+		thread.join();
+}
+
+void ThreadPool::runJob(int nbTasks, JobTaskFunc pTaskFunc, const void* pFunc)
+{
+	if(nbTasks <= 0)
+		return;
+
+	if(m_workerThreads.empty() || nbTasks == 1)
+	{
+		for(int idxTask=0 ; idxTask < nbTasks ; idxTask++)
+			pTaskFunc(pFunc, idxTask);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pJobTaskFunc = pTaskFunc;
+		m_pJobFunc = pFunc;
+		m_nbJobTasks = nbTasks;
+		m_nextJobTask = 0;
+		m_nbBusyWorkers = (int)m_workerThreads.size();
+		m_jobGeneration++;
+	}
+	m_jobStartedCondition.notify_all();
+
+	runTasks();
+
+	// Wait for workers to finish their last task before func goes out of scope
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_jobDoneCondition.wait(lock, [this]{ return m_nbBusyWorkers == 0; });
+	m_pJobTaskFunc = nullptr;
+	m_pJobFunc = nullptr;
+}
+
+void ThreadPool::runTasks()
+{
+	for(int idxTask = m_nextJobTask++ ; idxTask < m_nbJobTasks ; idxTask = m_nextJobTask++)
+		m_pJobTaskFunc(m_pJobFunc, idxTask);
+}
+
+void ThreadPool::workerThreadFunc()
+{
+	uint64_t lastJobGeneration = 0;
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobStartedCondition.wait(lock, [&]{ return m_bExit || m_jobGeneration != lastJobGeneration; });
+			if(m_bExit)
+				return;
+			lastJobGeneration = m_jobGeneration;
+		}
+
+		runTasks();
+
+		bool bLastWorker = false;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			bLastWorker = --m_nbBusyWorkers == 0;
+		}
+		if(bLastWorker)
+			m_jobDoneCondition.notify_one();
+	}
+}
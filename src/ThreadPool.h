@@ -0,0 +1,54 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Fixed pool of worker threads running blocking parallel-for jobs.
+// The calling thread takes part in the job, so a pool of N threads starts N-1 workers.
+// Without thread support (Emscripten build), jobs run on the calling thread.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int nbThreads = getDefaultNbThreads());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int		getNbThreads() const	{ return m_nbThreads; }
+
+	// Calls func(idxTask) for idxTask in [0;nbTasks[, spread over all threads. Returns once all tasks are done.
+	// func is called through a type-erased pointer, not a std::function, so that starting a job never allocates.
+	template<typename Func>
+	void	parallelFor(int nbTasks, const Func& func)
+	{
+		runJob(nbTasks, [](const void* pFunc, int idxTask){ (*(const Func*)pFunc)(idxTask); }, &func);
+	}
+
+	static int	getDefaultNbThreads();
+
+private:
+	using JobTaskFunc = void (*)(const void* pFunc, int idxTask);
+
+	void	runJob(int nbTasks, JobTaskFunc pTaskFunc, const void* pFunc);
+	void	workerThreadFunc();
+	void	runTasks();
+
+	int							m_nbThreads = 1;
+	std::vector<std::thread>	m_workerThreads;
+
+	std::mutex					m_mutex;
+	std::condition_variable		m_jobStartedCondition;
+	std::condition_variable		m_jobDoneCondition;
+	uint64_t					m_jobGeneration = 0;	// incremented for each new job
+	int							m_nbBusyWorkers = 0;
+	bool						m_bExit = false;
+
+	// Current job
+	JobTaskFunc						m_pJobTaskFunc = nullptr;
+	const void*						m_pJobFunc = nullptr;
+	int								m_nbJobTasks = 0;
+	std::atomic<int>				m_nextJobTask{0};
+};
@@ -1,24 +1,29 @@
 #include "NeuralNetwork.h"
 #include "GUI.h"
+#include "Kernels.h"
+#include "Benchmarks.h"
+#include "ThreadPool.h"
+#include "BatchPipeline.h"
+#include "Checkpointer.h"
+#include "QuantizedNetwork.h"
 
 //#pragma optimize("", off)
 
-static void _debugTestImage(NeuralNetwork& nn, LabeledImage& img, int epoch)
+static void _debugTestImage(NeuralNetwork& nn, const LabeledImage& img, int epoch)
 {
-	Layer& lastLayer = nn.layers[_countof(nn.layers)-1];
-	nn.feedForward(img, false);
-	int answer = 0;
-	for(int i=0 ; i < 10 ; i++)
-		answer = lastLayer.neuronValues[i] > lastLayer.neuronValues[answer] ? i : answer;
+	InferenceWorkspace ws;
+	ws.init(nn);
+	const int answer = nn.predict(img, ws);
+	const AlignedVector<float>& outputs = ws.neuronValues.back();
 	printf("Epoch: %d (wanted result: %d): %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f -> %d\n",
 		epoch,
 		(int)img.label,
-		lastLayer.neuronValues[0], lastLayer.neuronValues[1], lastLayer.neuronValues[2], lastLayer.neuronValues[3], lastLayer.neuronValues[4],
-		lastLayer.neuronValues[5], lastLayer.neuronValues[6], lastLayer.neuronValues[7], lastLayer.neuronValues[8], lastLayer.neuronValues[9],
+		outputs[0], outputs[1], outputs[2], outputs[3], outputs[4],
+		outputs[5], outputs[6], outputs[7], outputs[8], outputs[9],
 		answer);
 }
 
-static void _extractDebugImages(const std::vector<LabeledImage>& trainingImages, const std::vector<LabeledImage>& testImages)
+static void _extractDebugImages(const LabeledImageSet& trainingImages, const LabeledImageSet& testImages)
 {
 	// Debug training
 	for(int i=0 ; i < 30 ; i++)
@@ -37,20 +42,209 @@ static void _extractDebugImages(const std::vector<LabeledImage>& trainingImages,
 	}
 }
 
+// Decompressed IDX files are memory mapped: prefer them to the original .gz files, which must be decompressed at load time
+static const char* _pickDataFile(const char* strRawFileName, const char* strGzFileName)
+{
+	FILE* f = fopen(strRawFileName, "rb");
+	if(!f)
+		return strGzFileName;
+	fclose(f);
+	return strRawFileName;
+}
+
+// Layer sizes from the inputs to the outputs, separated by commas: "784,64,32,10"
+static bool _parseLayerSizes(const char* strLayerSizes, std::vector<int>& outLayerSizes)
+{
+	outLayerSizes.clear();
+	const char* str = strLayerSizes;
+	for(;;)
+	{
+		char* strEnd = nullptr;
+		const long layerSize = strtol(str, &strEnd, 10);
+		if(strEnd == str || layerSize <= 0 || layerSize > 0x7FFFFFFF)
+			break;
+		outLayerSizes.push_back((int)layerSize);
+		str = strEnd;
+		if(*str == '\0')
+		{
+			// The network is trained on images and their labels
+			if(outLayerSizes.size() >= 2 && outLayerSizes.front() == IMG_SX*IMG_SY && outLayerSizes.back() == 10)
+				return true;
+			break;
+		}
+		if(*str++ != ',')
+			break;
+	}
+	outLayerSizes.clear();
+	fprintf(stderr, "Invalid layer sizes: \"%s\" (expected %d,...,10)\n", strLayerSizes, IMG_SX*IMG_SY);
+	return false;
+}
+
+// Activation of each layer, separated by commas: "relu,relu,sigmoid". Names are those of getActivationName().
+static bool _parseActivations(const char* strActivations, std::vector<Activation>& outActivations)
+{
+	outActivations.clear();
+	const char* str = strActivations;
+	for(;;)
+	{
+		char strName[32] = {};
+		const size_t nameLength = strcspn(str, ",");
+		Activation activation = Activation::Sigmoid;
+		if(nameLength >= sizeof(strName))
+			break;
+		memcpy(strName, str, nameLength);
+		if(!parseActivation(strName, activation))
+			break;
+		outActivations.push_back(activation);
+		str += nameLength;
+		if(*str == '\0')
+			return true;
+		str++;	// ','
+	}
+	outActivations.clear();
+	fprintf(stderr, "Invalid activations: \"%s\" (expected sigmoid, tanh, relu, leakyrelu or softmax for each layer)\n", strActivations);
+	return false;
+}
+
+// Config file of "key = value" lines, '#' starting a comment. Known keys:
+// - layers: layer sizes, see _parseLayerSizes()
+// - activations: activation of each layer, see _parseActivations()
+static bool _readConfigFile(const char* fileName, std::vector<int>& outLayerSizes, std::vector<Activation>& outActivations)
+{
+	FILE* f = fopen(fileName, "rt");
+	if(!f)
+	{
+		fprintf(stderr, "Failed to open config file: %s\n", fileName);
+		return false;
+	}
+	Defer(fclose(f));
+
+	char line[1024];
+	while(fgets(line, sizeof(line), f))
+	{
+		line[strcspn(line, "#\r\n")] = '\0';
+		char key[64] = {};
+		char value[960] = {};
+		if(sscanf(line, " %63[^= \t] = %959s", key, value) != 2)
+			continue;
+		if(!strcmp(key, "layers"))
+		{
+			if(!_parseLayerSizes(value, outLayerSizes))
+				return false;
+		}
+		else if(!strcmp(key, "activations"))
+		{
+			if(!_parseActivations(value, outActivations))
+				return false;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown key in config file %s: %s\n", fileName, key);
+		}
+	}
+	return true;
+}
+
 int main(int argc, char* argv[])
 {
-	gData.pGUI = std::make_unique<GUI>();	// Comment to disable GUI
-	if(!gData.pGUI->init())
+	printf("Math kernels: %s\n", getKernelsISAName(gKernels.isa));
+
+	// Network topology: "--layers 784,64,32,10 [--activations relu,relu,sigmoid]" or "--config file" (see _readConfigFile()).
+	// "--model file" loads a model file saved by NeuralNetwork::saveToFile(), or a legacy one. By default, the pretrained network is loaded.
+	// "--quantize file" saves the int8 version of the network, calibrated on the test images, prints its accuracy delta and exits.
+	// "--weights f32|f16|bf16" sets the storage format of the weights used by forward passes and saved models.
+	std::vector<int> layerSizes;
+	std::vector<Activation> activations;
+	const char* strModelFileName = DATA_DIR "/weightsAndBiases_30000.bin";
+	const char* strQuantizedFileName = nullptr;
+	const char* strWeightsFormat = nullptr;
+	WeightsFormat weightsFormat = WeightsFormat::Float32;
+	for(int i=1 ; i < argc ; i++)
+	{
+		const bool bHasValue = i+1 < argc;
+		if(!strcmp(argv[i], "--layers") && bHasValue)
+		{
+			if(!_parseLayerSizes(argv[++i], layerSizes))
+				return EXIT_FAILURE;
+		}
+		else if(!strcmp(argv[i], "--activations") && bHasValue)
+		{
+			if(!_parseActivations(argv[++i], activations))
+				return EXIT_FAILURE;
+		}
+		else if(!strcmp(argv[i], "--config") && bHasValue)
+		{
+			if(!_readConfigFile(argv[++i], layerSizes, activations))
+				return EXIT_FAILURE;
+		}
+		else if(!strcmp(argv[i], "--model") && bHasValue)
+		{
+			strModelFileName = argv[++i];
+		}
+		else if(!strcmp(argv[i], "--quantize") && bHasValue)
+		{
+			strQuantizedFileName = argv[++i];
+		}
+		else if(!strcmp(argv[i], "--weights") && bHasValue)
+		{
+			strWeightsFormat = argv[++i];
+			if(!parseWeightsFormat(strWeightsFormat, weightsFormat))
+			{
+				fprintf(stderr, "Invalid weights format: \"%s\" (expected f32, f16 or bf16)\n", strWeightsFormat);
+				return EXIT_FAILURE;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [--layers 784,16,16,10] [--activations relu,relu,sigmoid] [--config file] [--model file] [--quantize file] [--weights f32|f16|bf16]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(!activations.empty() && activations.size() + 1 != layerSizes.size())
+	{
+		fprintf(stderr, "Activations need layer sizes, with one activation per layer\n");
 		return EXIT_FAILURE;
+	}
+
+	if(!strQuantizedFileName)
+	{
+		gData.pGUI = std::make_unique<GUI>();	// Comment to disable GUI
+		if(!gData.pGUI->init())
+			return EXIT_FAILURE;
+	}
 
-	readLabeledImages(TRAINING_IMAGES_FILENAME, TRAINING_LABELS_FILENAME, gData.trainingImages);
-	readLabeledImages(TEST_IMAGES_FILENAME, TEST_LABELS_FILENAME, gData.testImages);
+	if(!gData.trainingImages.load(_pickDataFile(TRAINING_IMAGES_FILENAME, TRAINING_IMAGES_GZ_FILENAME), _pickDataFile(TRAINING_LABELS_FILENAME, TRAINING_LABELS_GZ_FILENAME)))
+		return EXIT_FAILURE;
+	if(!gData.testImages.load(_pickDataFile(TEST_IMAGES_FILENAME, TEST_IMAGES_GZ_FILENAME), _pickDataFile(TEST_LABELS_FILENAME, TEST_LABELS_GZ_FILENAME)))
+		return EXIT_FAILURE;
 
 	//_extractDebugImages(gData.trainingImages, gData.testImages);
 
 	gData.pNN = std::make_unique<NeuralNetwork>();
-	//gData.pNN->initRandom();
-	gData.pNN->initFromFile(DATA_DIR "/weightsAndBiases_30000.bin");
+	if(!layerSizes.empty())
+	{
+		gData.pNN->initRandom(layerSizes, activations);
+		printf("Random network: %d layers, %d parameters\n", gData.pNN->getNbLayers(), (int)gData.pNN->parameters.size());
+	}
+	else
+	{
+		if(!gData.pNN->initFromFile(strModelFileName) || !gData.pNN->checkImageTopology(strModelFileName))
+			return EXIT_FAILURE;
+	}
+	if(strWeightsFormat)	// else the format of the model file is kept
+	{
+		gData.pNN->setWeightsFormat(weightsFormat);
+		printf("Weights format: %s\n", getWeightsFormatName(weightsFormat));
+	}
+
+	if(strQuantizedFileName)
+	{
+		QuantizedNetwork qnn;
+		if(!qnn.quantize(*gData.pNN, gData.testImages) || !qnn.saveToFile(strQuantizedFileName))
+			return EXIT_FAILURE;
+		printQuantizationReport(*gData.pNN, qnn, gData.testImages);
+		return EXIT_SUCCESS;
+	}
 	
 	if(gData.pGUI)
 	{
@@ -137,35 +331,67 @@ int main(int argc, char* argv[])
 			debugTestImage(nn, trainingImages[2], epoch);
 		}
 	}
-#elif 0	// WORKING CASE!!
-	// Training
-	for(int epoch=0 ; true ; epoch++)
+#elif 0
+	// Validate SIMD kernels: in strict mode, every ISA must give bit-for-bit the same outputs as the scalar path
 	{
-		std::vector<const LabeledImage*> imgBatch;
-		imgBatch.reserve(batchSize);
-		for(int i=0 ; i < batchSize ; i++)
+		NeuralNetwork& nn = *gData.pNN;
+		const int nbImages = 1000;
+		const Layer& lastLayer = nn.getLastLayer();
+		const LayerWorkspace& lastLayerWs = nn.workspace.layers.back();
+
+		initKernels(KernelsMode::Strict, KernelsISA::Scalar);
+		nn.feedForwardBatch(gData.testImages, 0, nbImages);
+		const AlignedVector<float> scalarOutputs = lastLayerWs.batchNeuronValues;
+
+		for(int isa = (int)KernelsISA::Scalar+1 ; isa <= (int)getBestSupportedKernelsISA() ; isa++)
 		{
-			const int idx = randInt(0, (int)(trainingImages.size()-1));
-			imgBatch.push_back(&trainingImages[idx]);
+			initKernels(KernelsMode::Strict, (KernelsISA)isa);
+			nn.feedForwardBatch(gData.testImages, 0, nbImages);
+			const bool bIdentical = memcmp(lastLayerWs.batchNeuronValues.data(), scalarOutputs.data(), nbImages * lastLayer.nbOutputs * sizeof(float)) == 0;
+			printf("Strict %s VS scalar: %s\n", getKernelsISAName((KernelsISA)isa), bIdentical ? "identical" : "DIFFERENT");
 		}
 
-		std::vector<std::vector<float>> weightAndBiasesCorrectionPerLayer;
-		nn.backPropagateImages(imgBatch, weightAndBiasesCorrectionPerLayer);
-
-		// weightAndBiasesCorrection = -learningRate * costGradient
+		initKernels(KernelsMode::Fast);
+	}
+#elif 0
+	// Benchmarks
+	{
+		benchmarkTransposedWeights();
+
+		ThreadPool threadPool;
+		benchmarkHogwild(gData.trainingImages, gData.testImages, threadPool);
+		benchmarkBatchPipeline(gData.trainingImages, threadPool);
+		benchmarkRandomInit(threadPool);
+		benchmarkNetworkSizes(gData.trainingImages, gData.testImages, threadPool);
+		benchmarkStaticNetwork(gData.testImages);
+		benchmarkSigmoidModes(gData.trainingImages, gData.testImages);
+		benchmarkActivations(gData.trainingImages, gData.testImages, threadPool);
+		benchmarkModelFile(gData.testImages, threadPool);
+		benchmarkCheckpointing(gData.trainingImages, threadPool);
+		benchmarkQuantization(gData.trainingImages, gData.testImages, threadPool);
+		benchmarkWeightsFormats(gData.trainingImages, gData.testImages, threadPool);
+		benchmarkPruning(gData.trainingImages, gData.testImages, threadPool);
+		checkTrainStepAllocations(gData.trainingImages, threadPool);
+	}
+#elif 0	// WORKING CASE!!
+	// Training
+	ThreadPool threadPool;
+	printf("Training threads: %d\n", threadPool.getNbThreads());
+	BatchPipeline batchPipeline(trainingImages, nn, batchSize, (uint64_t)randInt(0, 0x7FFFFFFF));	// next batches are prepared while the current one trains
+	Checkpointer checkpointer(nn, "checkpoint");	// written in the background: training does not wait for the disk
+	for(int epoch=0 ; true ; epoch++)
+	{
+		// weights += -learningRate * costGradient
 		static float s_learningRate = 3.f;
-		for(std::vector<float>& weightAndBiasesCorrection : weightAndBiasesCorrectionPerLayer)
-			for(float& f : weightAndBiasesCorrection)
-				f = -s_learningRate * f;
-		
-		nn.addToWeightAndBiases(weightAndBiasesCorrectionPerLayer);
+		nn.trainStep(batchPipeline.acquireBatch(), s_learningRate, &threadPool);
+		batchPipeline.releaseBatch();
 
 		// Debug test
 		static bool s_bDebugTest = false;
 		if(s_bDebugTest)
 		{
 			static int idxImageToTest = 0;
-			LabeledImage& img = testImages[idxImageToTest];
+			const LabeledImage img = testImages[idxImageToTest];
 
 			_debugTestImage(nn, img, epoch);
 		}
@@ -173,20 +399,8 @@ int main(int argc, char* argv[])
 		static int s_nbEpochsBetweenTests = 500;
 		if(s_nbEpochsBetweenTests > 0 && epoch % s_nbEpochsBetweenTests == 0)
 		{
-			int nbGoodAnswers = 0;
-			int nbBadAnswers = 0;
-			Layer& lastLayer = nn.layers[_countof(nn.layers)-1];
-			for(const LabeledImage& img : testImages)
-			{
-				nn.feedForward(img, false);
-				int answer = 0;
-				for(int i=0 ; i < 10 ; i++)
-					answer = lastLayer.neuronValues[i] > lastLayer.neuronValues[answer] ? i : answer;
-				if(answer == img.label)
-					nbGoodAnswers++;
-				else
-					nbBadAnswers++;
-			}
+			const int nbGoodAnswers = nn.computeNbGoodAnswers(testImages);
+			const int nbBadAnswers = (int)testImages.size() - nbGoodAnswers;
 			printf("--- Epoch %d: good: %d  bad: %d ---\n", epoch, nbGoodAnswers, nbBadAnswers);
 		}
 
@@ -197,11 +411,12 @@ int main(int argc, char* argv[])
 			printf("--- Epoch %d: cost: %f ---\n", epoch, cost);
 		}
 
+		static int s_nbEpochsBetweenCheckpoints = 5000;
 		static bool s_bSaveResults = false;
-		if(s_bSaveResults)
+		if(s_bSaveResults || (s_nbEpochsBetweenCheckpoints > 0 && epoch > 0 && epoch % s_nbEpochsBetweenCheckpoints == 0))
 		{
 			s_bSaveResults = false;
-			nn.saveToFile("weightsAndBiases.bin");
+			checkpointer.requestCheckpoint(nn, epoch);
 		}
 	}
 #endif